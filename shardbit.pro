@@ -200,6 +200,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/misc/coincontrol.h \
     src/misc/sync.h \
     src/misc/util.h \
+    src/misc/bloom.h \
     src/misc/hash.h \
     src/misc/uint256.h \
     src/misc/kernel.h \
@@ -330,6 +331,7 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/misc/sync.cpp \
     src/misc/txmempool.cpp \
     src/misc/util.cpp \
+    src/misc/bloom.cpp \
     src/misc/hash.cpp \
     src/misc/netbase.cpp \
     src/misc/ecwrapper.cpp \
@@ -373,6 +375,7 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/rpc/rpcwallet.cpp \
     src/rpc/rpcblockchain.cpp \
     src/rpc/rpcrawtransaction.cpp \
+    src/rpc/rest.cpp \
     src/qt/overviewpage.cpp \
     src/qt/csvmodelwriter.cpp \
     src/misc/crypter.cpp \
@@ -0,0 +1,134 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "json/json_spirit_value.h"
+#include "json/json_spirit_writer_template.h"
+#include "misc/util.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+namespace benchmark {
+
+State::State(const string& nameIn, int nWarmupIn, int nSamplesIn, int64_t nMinSampleMicrosIn)
+    : name(nameIn), nIterationsPerSample(1), nItemsPerIteration(1),
+      nWarmup(nWarmupIn), nSamples(nSamplesIn), nMinSampleMicros(nMinSampleMicrosIn),
+      fCalibrated(false), nWarmupDone(0), nLeft(0), nSampleStart(0)
+{
+}
+
+bool State::NextSample()
+{
+    int64_t nNow = GetTimeMicros();
+
+    if (nSampleStart != 0)
+    {
+        int64_t nElapsed = nNow - nSampleStart;
+        if (!fCalibrated)
+        {
+            // grow the batch until one sample is long enough to time reliably
+            if (nElapsed < nMinSampleMicros)
+                nIterationsPerSample *= 2;
+            else
+                fCalibrated = true;
+        }
+        else if (nWarmupDone < nWarmup)
+            nWarmupDone++;
+        else
+            vSampleNanos.push_back(1000.0 * nElapsed / nIterationsPerSample);
+    }
+
+    if ((int)vSampleNanos.size() >= nSamples)
+        return false;
+
+    // this call is the first iteration of the next sample
+    nLeft = nIterationsPerSample - 1;
+    nSampleStart = GetTimeMicros();
+    return true;
+}
+
+BenchRunner::BenchmarkMap& BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+BenchRunner::BenchRunner(const string& name, BenchFunction func)
+{
+    benchmarks().insert(make_pair(name, func));
+}
+
+// Value at fraction dPercentile of the sorted samples
+static double Percentile(const vector<double>& vSorted, double dPercentile)
+{
+    if (vSorted.empty())
+        return 0;
+    size_t nIndex = (size_t)(dPercentile * (vSorted.size() - 1) + 0.5);
+    return vSorted[min(nIndex, vSorted.size() - 1)];
+}
+
+void BenchRunner::RunAll(const string& strFilter, int nWarmup, int nSamples, int64_t nMinSampleMicros,
+                         const string& strJSONFile)
+{
+    Array results;
+
+    printf("%-32s %10s %12s %12s %12s %12s %12s\n",
+           "# Benchmark", "iters", "min(ns)", "median(ns)", "p90(ns)", "max(ns)", "items/s");
+    BOOST_FOREACH(const BenchmarkMap::value_type& p, benchmarks())
+    {
+        if (p.first.find(strFilter) == string::npos)
+            continue;
+
+        State state(p.first, nWarmup, nSamples, nMinSampleMicros);
+        p.second(state);
+
+        vector<double> vSorted = state.vSampleNanos;
+        sort(vSorted.begin(), vSorted.end());
+        double dMedian = Percentile(vSorted, 0.5);
+        double dItemsPerSecond = dMedian > 0 ? 1e9 * state.nItemsPerIteration / dMedian : 0;
+
+        printf("%-32s %10d %12.1f %12.1f %12.1f %12.1f %12.0f\n",
+               p.first.c_str(), (int)state.nIterationsPerSample,
+               Percentile(vSorted, 0), dMedian, Percentile(vSorted, 0.9), Percentile(vSorted, 1),
+               dItemsPerSecond);
+        fflush(stdout);
+
+        Object entry;
+        entry.push_back(Pair("name", p.first));
+        entry.push_back(Pair("iterations_per_sample", state.nIterationsPerSample));
+        entry.push_back(Pair("items_per_iteration", state.nItemsPerIteration));
+        entry.push_back(Pair("min_ns", Percentile(vSorted, 0)));
+        entry.push_back(Pair("median_ns", dMedian));
+        entry.push_back(Pair("p90_ns", Percentile(vSorted, 0.9)));
+        entry.push_back(Pair("p99_ns", Percentile(vSorted, 0.99)));
+        entry.push_back(Pair("max_ns", Percentile(vSorted, 1)));
+        entry.push_back(Pair("items_per_second", dItemsPerSecond));
+        Array samples;
+        BOOST_FOREACH(double d, state.vSampleNanos)
+            samples.push_back(d);
+        entry.push_back(Pair("samples_ns", samples));
+        results.push_back(entry);
+    }
+
+    if (!strJSONFile.empty())
+    {
+        boost::filesystem::ofstream file(strJSONFile);
+        if (!file)
+        {
+            fprintf(stderr, "Error: cannot write %s\n", strJSONFile.c_str());
+            return;
+        }
+        file << write_string(Value(results), true) << "\n";
+    }
+}
+
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the
+// Google Benchmark framework (see https://github.com/google/benchmark).
+// Usage:
+//
+// static void CODE_TO_TIME(benchmark::State& state)
+// {
+//     ... do any setup needed...
+//     while (state.KeepRunning()) {
+//        ... do stuff you want to time...
+//     }
+//     ... do any cleanup needed...
+// }
+//
+// BENCHMARK(CODE_TO_TIME);
+
+namespace benchmark {
+
+class State
+{
+public:
+    State(const std::string& nameIn, int nWarmupIn, int nSamplesIn, int64_t nMinSampleMicrosIn);
+
+    // Returns false once enough samples have been collected. Each sample
+    // times a batch of iterations, sized during calibration so that a
+    // sample takes at least nMinSampleMicros.
+    bool KeepRunning()
+    {
+        if (nLeft > 0)
+        {
+            nLeft--;
+            return true;
+        }
+        return NextSample();
+    }
+
+    // Work done per iteration, used to report throughput
+    void SetItemsPerIteration(int64_t n) { nItemsPerIteration = n; }
+
+    std::string name;
+    int64_t nIterationsPerSample;
+    int64_t nItemsPerIteration;
+    std::vector<double> vSampleNanos;    // nanoseconds per iteration
+
+private:
+    bool NextSample();
+
+    int nWarmup;
+    int nSamples;
+    int64_t nMinSampleMicros;
+    bool fCalibrated;
+    int nWarmupDone;
+    int64_t nLeft;
+    int64_t nSampleStart;
+};
+
+typedef boost::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+public:
+    typedef std::map<std::string, BenchFunction> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+    BenchRunner(const std::string& name, BenchFunction func);
+
+    // Run every benchmark whose name contains strFilter, print a table and
+    // optionally write the results as JSON to strJSONFile
+    static void RunAll(const std::string& strFilter, int nWarmup, int nSamples, int64_t nMinSampleMicros,
+                       const std::string& strJSONFile);
+};
+
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // BENCH_BENCH_H
@@ -0,0 +1,88 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams/chainparams.h"
+#include "main/main.h"
+#include "misc/key.h"
+#include "misc/pubkey.h"
+#include "misc/util.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+static const int BENCH_CHAIN_HEIGHT = 1000;
+
+// A synthetic best chain, so code that looks at pindexBest or the chain
+// snapshot runs without a block database. Hashes are arbitrary, block
+// times are one minute apart and end now.
+static void CreateBenchChain()
+{
+    LOCK(cs_main);
+
+    CBlockIndex* pprev = NULL;
+    for (int nHeight = 0; nHeight <= BENCH_CHAIN_HEIGHT; nHeight++)
+    {
+        uint256 hash = Hash(BEGIN(nHeight), END(nHeight));
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->phashBlock = &mapBlockIndex.insert(make_pair(hash, pindex)).first->first;
+        pindex->pprev = pprev;
+        pindex->nHeight = nHeight;
+        pindex->nTime = GetTime() - 60 * (BENCH_CHAIN_HEIGHT - nHeight);
+        pindex->nBits = Params().ProofOfWorkLimit().GetCompact();
+        pindex->nStakeModifier = GetRand(std::numeric_limits<uint64_t>::max());
+        pindex->bnStakeModifierV2 = GetRandHash();
+        pindex->nChainTrust = (pprev ? pprev->nChainTrust : 0) + pindex->GetBlockTrust();
+        if (pprev)
+            pprev->pnext = pindex;
+        else
+            pindexGenesisBlock = pindex;
+        pprev = pindex;
+    }
+
+    pindexBest = pprev;
+    nBestHeight = pindexBest->nHeight;
+    hashBestChain = pindexBest->GetBlockHash();
+    nBestChainTrust = pindexBest->nChainTrust;
+    UpdateChainSnapshot(pindexBest);
+}
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("-help"))
+    {
+        printf("Usage: bench_shardbit [options]\n\n"
+               "  -filter=<str>    Only run benchmarks whose name contains <str>\n"
+               "  -samples=<n>     Samples recorded per benchmark (default: 20)\n"
+               "  -warmup=<n>      Samples discarded before recording (default: 2)\n"
+               "  -mintime=<ms>    Minimum duration of one sample (default: 10)\n"
+               "  -json=<file>     Also write the results to <file> as JSON\n");
+        return 0;
+    }
+
+    // Everything, including debug.log and the txindex fixtures, goes to a
+    // scratch data directory that is removed afterwards
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() /
+                                       boost::filesystem::unique_path("bench_shardbit_%%%%%%%%");
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    SelectParams(CChainParams::MAIN);
+    ECC_Start();
+    ECCVerifyHandle globalVerifyHandle;
+    CreateBenchChain();
+
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ""),
+                                   GetArg("-warmup", 2),
+                                   GetArg("-samples", 20),
+                                   GetArg("-mintime", 10) * 1000,
+                                   GetArg("-json", ""));
+
+    boost::filesystem::remove_all(pathTemp);
+    ECC_Stop();
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "misc/serialize.h"
+#include "version.h"
+
+// A block of 1000 two-in, two-out transactions with signature sized
+// scriptSigs, about 370 kB serialized
+static void CreateBlock(CBlock& block)
+{
+    block.nVersion = 7;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = GetAdjustedTime();
+    block.nBits = 0x1d00ffff;
+    block.vchBlockSig.resize(72, 0x30);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        CTransaction tx;
+        tx.nTime = block.nTime;
+        for (int n = 0; n < 2; n++)
+        {
+            CTxIn txin(COutPoint(GetRandHash(), n));
+            txin.scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+            tx.vin.push_back(txin);
+
+            CScript scriptPubKey;
+            scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG;
+            tx.vout.push_back(CTxOut(GetRandInt(1000) * COIN, scriptPubKey));
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+}
+
+static void BlockSerialize(benchmark::State& state)
+{
+    CBlock block;
+    CreateBlock(block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    while (state.KeepRunning())
+    {
+        ss.clear();
+        ss << block;
+    }
+}
+
+static void BlockDeserialize(benchmark::State& state)
+{
+    CBlock block;
+    CreateBlock(block);
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock);
+        CBlock blockRead;
+        ss >> blockRead;
+    }
+}
+
+// Deserialize and hash everything, what handling a "block" message costs
+// before validation
+static void BlockDeserializeHash(benchmark::State& state)
+{
+    CBlock block;
+    CreateBlock(block);
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock);
+        CBlock blockRead;
+        ss >> blockRead;
+        blockRead.CacheHash();
+    }
+}
+
+BENCHMARK(BlockSerialize);
+BENCHMARK(BlockDeserialize);
+BENCHMARK(BlockDeserializeHash);
@@ -0,0 +1,99 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "misc/crypter.h"
+#include "misc/key.h"
+
+#include <vector>
+
+static const int BENCH_WALLET_KEYS = 10000;
+
+// An encrypted key store with BENCH_WALLET_KEYS keys, as a large staking
+// wallet has
+class CBenchKeyStore : public CCryptoKeyStore
+{
+public:
+    CKeyingMaterial vMasterKeyBench;
+    std::vector<CKeyID> vKeyIDs;
+
+    CBenchKeyStore()
+    {
+        for (int i = 0; i < BENCH_WALLET_KEYS; i++)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            AddKey(key);
+            vKeyIDs.push_back(key.GetPubKey().GetID());
+        }
+
+        vMasterKeyBench.resize(WALLET_CRYPTO_KEY_SIZE);
+        GetRandBytes(&vMasterKeyBench[0], WALLET_CRYPTO_KEY_SIZE);
+        EncryptKeys(vMasterKeyBench);
+    }
+
+    bool Unlock() { return CCryptoKeyStore::Unlock(vMasterKeyBench); }
+};
+
+static CBenchKeyStore& GetBenchKeyStore()
+{
+    static CBenchKeyStore keystore;
+    return keystore;
+}
+
+// Fetching every key right after unlocking, each one is decrypted
+static void WalletGetKeyUnlock(benchmark::State& state)
+{
+    CBenchKeyStore& keystore = GetBenchKeyStore();
+
+    CKey key;
+    state.SetItemsPerIteration(keystore.vKeyIDs.size());
+    while (state.KeepRunning())
+    {
+        keystore.LockKeyStore();
+        keystore.Unlock();
+        BOOST_FOREACH(const CKeyID& keyID, keystore.vKeyIDs)
+            keystore.GetKey(keyID, key);
+    }
+}
+
+// Fetching keys again while the wallet stays unlocked
+static void WalletGetKeyUnlocked(benchmark::State& state)
+{
+    CBenchKeyStore& keystore = GetBenchKeyStore();
+    keystore.Unlock();
+
+    CKey key;
+    state.SetItemsPerIteration(keystore.vKeyIDs.size());
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CKeyID& keyID, keystore.vKeyIDs)
+            keystore.GetKey(keyID, key);
+    }
+}
+
+// Signing with every key of the unlocked wallet, as the staker does
+static void WalletSign(benchmark::State& state)
+{
+    CBenchKeyStore& keystore = GetBenchKeyStore();
+    keystore.Unlock();
+
+    uint256 hash = GetRandHash();
+    CKey key;
+    std::vector<unsigned char> vchSig;
+    state.SetItemsPerIteration(keystore.vKeyIDs.size());
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(const CKeyID& keyID, keystore.vKeyIDs)
+        {
+            keystore.GetKey(keyID, key);
+            key.Sign(hash, vchSig);
+        }
+    }
+}
+
+BENCHMARK(WalletGetKeyUnlock);
+BENCHMARK(WalletGetKeyUnlocked);
+BENCHMARK(WalletSign);
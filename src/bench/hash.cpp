@@ -0,0 +1,38 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "misc/hash.h"
+#include "misc/hashblock.h"
+
+#include <vector>
+
+// X11 proof-of-work hash of an 80 byte block header
+static void HashX11BlockHeader(benchmark::State& state)
+{
+    std::vector<unsigned char> vHeader(80, 0x5a);
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        hash = Hash9(vHeader.begin(), vHeader.end());
+        // vary the nonce like a miner would
+        vHeader[76] = hash.Get64() & 0xff;
+    }
+}
+
+// Double SHA256 of 1 MB, the transaction and block hash
+static void HashSHA256d1MB(benchmark::State& state)
+{
+    std::vector<unsigned char> vData(1000 * 1000, 0x5a);
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        hash = Hash(vData.begin(), vData.end());
+        vData[0] = hash.Get64() & 0xff;
+    }
+}
+
+BENCHMARK(HashX11BlockHeader);
+BENCHMARK(HashSHA256d1MB);
@@ -0,0 +1,95 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "misc/bignum.h"
+#include "misc/kernel.h"
+
+// A realistic proof-of-stake target, almost every kernel misses it
+static const unsigned int BENCH_STAKE_BITS = 0x1d00ffff;
+
+// Kernel search over a minute of timestamps for one output, the inner loop
+// of the staker
+static void KernelSearch(benchmark::State& state)
+{
+    CBlockIndex* pindexPrev = pindexBest;
+
+    CTransaction txPrev;
+    txPrev.nTime = pindexPrev->nTime - nStakeMinAge - 3600;
+    txPrev.vin.resize(1);
+    txPrev.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txPrev.vout.push_back(CTxOut(1000 * COIN, CScript()));
+    COutPoint prevout(txPrev.GetHash(), 0);
+    unsigned int nTimeBlockFrom = txPrev.nTime;
+
+    uint256 hashProofOfStake, targetProofOfStake;
+    state.SetItemsPerIteration(60);
+    while (state.KeepRunning())
+    {
+        for (unsigned int n = 0; n < 60; n++)
+            CheckStakeKernelHash(pindexPrev, BENCH_STAKE_BITS, nTimeBlockFrom, txPrev, prevout,
+                                 pindexPrev->nTime + n, hashProofOfStake, targetProofOfStake, false);
+    }
+}
+
+// Block trust from nBits, as computed for every block index entry
+static void BlockTrustUint256(benchmark::State& state)
+{
+    unsigned int nBits = BENCH_STAKE_BITS;
+    uint256 nTrust;
+    while (state.KeepRunning())
+    {
+        uint256 bnTarget;
+        bnTarget.SetCompact(nBits);
+        nTrust = (~bnTarget / (bnTarget + 1)) + 1;
+        nBits ^= nTrust.Get64() & 0xff;
+    }
+}
+
+static void BlockTrustBigNum(benchmark::State& state)
+{
+    unsigned int nBits = BENCH_STAKE_BITS;
+    uint256 nTrust;
+    while (state.KeepRunning())
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        nTrust = ((CBigNum(1) << 256) / (bnTarget + 1)).getuint256();
+        nBits ^= nTrust.Get64() & 0xff;
+    }
+}
+
+// Coin weighted kernel target
+static void KernelTargetUint256(benchmark::State& state)
+{
+    uint64_t nWeight = 1000 * COIN;
+    while (state.KeepRunning())
+    {
+        uint256 bnTarget;
+        bnTarget.SetCompact(BENCH_STAKE_BITS);
+        bool fOverflow = bnTarget > ~uint256(0) / nWeight;
+        bnTarget *= nWeight;
+        nWeight += fOverflow + (bnTarget.Get64() & 1);
+    }
+}
+
+static void KernelTargetBigNum(benchmark::State& state)
+{
+    uint64_t nWeight = 1000 * COIN;
+    while (state.KeepRunning())
+    {
+        CBigNum bnTarget;
+        bnTarget.SetCompact(BENCH_STAKE_BITS);
+        bnTarget *= CBigNum(nWeight);
+        nWeight += bnTarget.getuint256().Get64() & 1;
+    }
+}
+
+BENCHMARK(KernelSearch);
+BENCHMARK(BlockTrustUint256);
+BENCHMARK(BlockTrustBigNum);
+BENCHMARK(KernelTargetUint256);
+BENCHMARK(KernelTargetBigNum);
@@ -0,0 +1,61 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "masternode/masternodeman.h"
+#include "misc/key.h"
+
+static const int BENCH_MASTERNODES = 1000;
+
+// Register BENCH_MASTERNODES masternodes with random collateral and keys.
+// unitTest skips the collateral lookup in CMasternode::Check().
+static CTxIn CreateMasternodes()
+{
+    static CTxIn vinFirst;
+    if (mnodeman.size() > 0)
+        return vinFirst;
+
+    for (int i = 0; i < BENCH_MASTERNODES; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+
+        CMasternode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), 0));
+        mn.pubkey = key.GetPubKey();
+        mn.pubkey2 = key.GetPubKey();
+        mn.protocolVersion = PROTOCOL_VERSION;
+        mn.lastTimeSeen = GetAdjustedTime();
+        mn.unitTest = true;
+        mnodeman.Add(mn);
+
+        if (i == 0)
+            vinFirst = mn.vin;
+    }
+    return vinFirst;
+}
+
+// Scoring and sorting every masternode for the tip
+static void MasternodeRanks(benchmark::State& state)
+{
+    CreateMasternodes();
+
+    state.SetItemsPerIteration(BENCH_MASTERNODES);
+    while (state.KeepRunning())
+        mnodeman.GetMasternodeRanks(nBestHeight, 0);
+}
+
+// Rank of one masternode, served from the rank cache after the first call
+static void MasternodeRankCached(benchmark::State& state)
+{
+    CTxIn vin = CreateMasternodes();
+
+    while (state.KeepRunning())
+        mnodeman.GetMasternodeRank(vin, nBestHeight, 0, true);
+}
+
+BENCHMARK(MasternodeRanks);
+BENCHMARK(MasternodeRankCached);
@@ -0,0 +1,73 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "misc/key.h"
+#include "misc/keystore.h"
+#include "misc/txdb.h"
+#include "misc/txmempool.h"
+
+#include <vector>
+
+static const int BENCH_MEMPOOL_TXS = 100;
+
+// A confirmed transaction with nOutputs outputs to one key, written to a
+// block file and the txindex as if it had been mined, and one signed
+// transaction spending each of its outputs
+static void CreateSpends(std::vector<CTransaction>& vSpends, int nOutputs)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+
+    CTransaction txFrom;
+    txFrom.nTime = GetAdjustedTime() - 3600;
+    txFrom.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    for (int i = 0; i < nOutputs; i++)
+        txFrom.vout.push_back(CTxOut(COIN, scriptPubKey));
+
+    CBlock block;
+    block.vtx.push_back(txFrom);
+    unsigned int nFile, nBlockPos;
+    block.WriteToDisk(nFile, nBlockPos);
+    // same offset as ConnectBlock() computes for the first transaction
+    unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(block.vtx.size());
+    CTxDB txdb("cr+");
+    txdb.AddTxIndex(txFrom, CDiskTxPos(nFile, nBlockPos, nTxPos), nBestHeight);
+
+    for (int i = 0; i < nOutputs; i++)
+    {
+        CTransaction tx;
+        tx.nTime = GetAdjustedTime();
+        tx.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), i)));
+        tx.vout.push_back(CTxOut(COIN - COIN / 100, scriptPubKey));
+        SignSignature(keystore, txFrom, tx, 0);
+        vSpends.push_back(tx);
+    }
+}
+
+// Full mempool acceptance of relayed transactions, including the txindex
+// lookups, input fetch and script checks. The signature cache is warm after
+// the first sample, as it is for transactions that come back in blocks.
+static void MempoolAccept(benchmark::State& state)
+{
+    std::vector<CTransaction> vSpends;
+    CreateSpends(vSpends, BENCH_MEMPOOL_TXS);
+
+    state.SetItemsPerIteration(vSpends.size());
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(CTransaction& tx, vSpends)
+            AcceptToMemoryPool(mempool, tx, true, NULL);
+        BOOST_FOREACH(const CTransaction& tx, vSpends)
+            mempool.remove(tx);
+    }
+}
+
+BENCHMARK(MempoolAccept);
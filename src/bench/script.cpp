@@ -0,0 +1,100 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "misc/key.h"
+#include "misc/keystore.h"
+#include "misc/script.h"
+
+// A transaction with nInputs pay-to-pubkey-hash inputs, all spending
+// outputs of txFrom and signed with one key
+static void CreateSpend(CBasicKeyStore& keystore, CTransaction& txFrom, CTransaction& txTo, int nInputs)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+
+    txFrom.vin.resize(1);
+    txFrom.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    for (int i = 0; i < nInputs; i++)
+    {
+        CScript scriptPubKey;
+        scriptPubKey.SetDestination(key.GetPubKey().GetID());
+        txFrom.vout.push_back(CTxOut(COIN, scriptPubKey));
+    }
+
+    for (int i = 0; i < nInputs; i++)
+        txTo.vin.push_back(CTxIn(COutPoint(txFrom.GetHash(), i)));
+    txTo.vout.push_back(txFrom.vout[0]);
+
+    CSignatureHasher hasher(txTo);
+    for (int i = 0; i < nInputs; i++)
+        SignSignature(keystore, txFrom, txTo, i, SIGHASH_ALL, &hasher);
+}
+
+// Signature check of an input already in the signature cache, the common
+// case for transactions that were relayed before they got mined
+static void VerifyScriptCached(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom, txTo;
+    CreateSpend(keystore, txFrom, txTo, 1);
+
+    const CScript& scriptSig = txTo.vin[0].scriptSig;
+    const CScript& scriptPubKey = txFrom.vout[0].scriptPubKey;
+    VerifyScript(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+    while (state.KeepRunning())
+        VerifyScript(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+}
+
+static void VerifyScriptUncached(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom, txTo;
+    CreateSpend(keystore, txFrom, txTo, 1);
+
+    const CScript& scriptSig = txTo.vin[0].scriptSig;
+    const CScript& scriptPubKey = txFrom.vout[0].scriptPubKey;
+    while (state.KeepRunning())
+        VerifyScript(scriptSig, scriptPubKey, txTo, 0, STANDARD_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_NOCACHE, 0);
+}
+
+// Signature hashes of every input of a 100 input transaction
+static void SignatureHashLegacy(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom, txTo;
+    CreateSpend(keystore, txFrom, txTo, 100);
+
+    const CScript& scriptCode = txFrom.vout[0].scriptPubKey;
+    state.SetItemsPerIteration(txTo.vin.size());
+    while (state.KeepRunning())
+    {
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++)
+            SignatureHash(scriptCode, txTo, nIn, SIGHASH_ALL);
+    }
+}
+
+static void SignatureHashMidstate(benchmark::State& state)
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom, txTo;
+    CreateSpend(keystore, txFrom, txTo, 100);
+
+    const CScript& scriptCode = txFrom.vout[0].scriptPubKey;
+    state.SetItemsPerIteration(txTo.vin.size());
+    while (state.KeepRunning())
+    {
+        CSignatureHasher hasher(txTo);
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++)
+            hasher.SignatureHash(scriptCode, nIn, SIGHASH_ALL);
+    }
+}
+
+BENCHMARK(VerifyScriptCached);
+BENCHMARK(VerifyScriptUncached);
+BENCHMARK(SignatureHashLegacy);
+BENCHMARK(SignatureHashMidstate);
@@ -0,0 +1,69 @@
+// Copyright (c) 2014 The Shardbit developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "main/main.h"
+#include "misc/txdb.h"
+
+#include <vector>
+
+static const int BENCH_TXINDEX_ENTRIES = 100000;
+
+// Fill the scratch txindex with entries for random transaction hashes
+static std::vector<uint256> CreateTxIndex(CTxDB& txdb)
+{
+    std::vector<uint256> vHashes;
+    txdb.TxnBegin();
+    for (int i = 0; i < BENCH_TXINDEX_ENTRIES; i++)
+    {
+        uint256 hash = GetRandHash();
+        CTxIndex txindex(CDiskTxPos(1, i, i), 2);
+        txdb.UpdateTxIndex(hash, txindex);
+        vHashes.push_back(hash);
+    }
+    txdb.TxnCommit();
+    return vHashes;
+}
+
+// Both benchmarks share one fixture
+static const std::vector<uint256>& GetTxIndexHashes(CTxDB& txdb)
+{
+    static const std::vector<uint256> vHashes = CreateTxIndex(txdb);
+    return vHashes;
+}
+
+// Random txindex lookups, as done for every input during block connection
+static void TxDBReadTxIndex(benchmark::State& state)
+{
+    CTxDB txdb("cr+");
+    const std::vector<uint256>& vHashes = GetTxIndexHashes(txdb);
+
+    CTxIndex txindex;
+    unsigned int n = 0;
+    while (state.KeepRunning())
+    {
+        txdb.ReadTxIndex(vHashes[n], txindex);
+        n = (n + 7919) % vHashes.size();
+    }
+}
+
+// Marking outputs spent
+static void TxDBUpdateTxIndex(benchmark::State& state)
+{
+    CTxDB txdb("cr+");
+    const std::vector<uint256>& vHashes = GetTxIndexHashes(txdb);
+
+    CTxIndex txindex(CDiskTxPos(1, 1, 1), 2);
+    unsigned int n = 0;
+    while (state.KeepRunning())
+    {
+        txindex.vSpent[0] = CDiskTxPos(2, n, n);
+        txdb.UpdateTxIndex(vHashes[n], txindex);
+        n = (n + 7919) % vHashes.size();
+    }
+}
+
+BENCHMARK(TxDBReadTxIndex);
+BENCHMARK(TxDBUpdateTxIndex);
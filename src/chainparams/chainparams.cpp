@@ -86,7 +86,7 @@ public:
         vAlertPubKey = ParseHex("72233deacecde21b1644efc56ed3594ef64425850aa52617506177cf245575f0aa11e5b1777cfd8621ea39a7996872a07631ea25b3fdda00df37f5e982fe58850a");
         nDefaultPort = 37451;
         nRPCPort = 37452;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 16); // starting difficulty is 1 / 2^12
+        bnProofOfWorkLimit = ~uint256(0) >> 16; // starting difficulty is 1 / 2^12
 
         const char* pszTimestamp = "Shardbit Genesis Final - (9/17/2018)";
         std::vector<CTxIn> vin;
@@ -168,7 +168,7 @@ public:
         pchMessageStart[1] = 0x9f;
         pchMessageStart[2] = 0x3a;
         pchMessageStart[3] = 0xef;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 16);
+        bnProofOfWorkLimit = ~uint256(0) >> 16;
         vAlertPubKey = ParseHex("75cedec3ddefcdae1d0e4a656ed3594ef64425850aa52617506177cf245575f0aa11e5b1777cfd8621ea39a7996872a07631ea25b3fdda00df37f5e982fe58850a");
         nDefaultPort = 47451;
         nRPCPort = 47452;
@@ -2190,10 +2190,12 @@ bool CDarksendQueue::Sign()
 bool CDarksendQueue::Relay()
 {
 
+    CNetMessageRef pmsg = MakeNetMessage("dsq", *this);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes){
         // always relay to everyone
-        pnode->PushMessage("dsq", (*this));
+        pnode->PushMessage(pmsg);
     }
 
     return true;
@@ -2218,10 +2220,14 @@ bool CDarksendQueue::CheckSignature()
 
 void CDarksendPool::RelayFinalTransaction(const int sessionID, const CTransaction& txNew)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << txNew;
+    CNetMessageRef pmsg = MakeNetMessage("dsf", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
-        pnode->PushMessage("dsf", sessionID, txNew);
+        pnode->PushMessage(pmsg);
     }
 }
 
@@ -2247,16 +2253,24 @@ void CDarksendPool::RelayIn(const std::vector<CTxDSIn>& vin, const int64_t& nAmo
 
 void CDarksendPool::RelayStatus(const int sessionID, const int newState, const int newEntriesCount, const int newAccepted, const std::string error)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << newState << newEntriesCount << newAccepted << error;
+    CNetMessageRef pmsg = MakeNetMessage("dssu", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
-        pnode->PushMessage("dssu", sessionID, newState, newEntriesCount, newAccepted, error);
+        pnode->PushMessage(pmsg);
 }
 
 void CDarksendPool::RelayCompletedTransaction(const int sessionID, const bool error, const std::string errorMessage)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << error << errorMessage;
+    CNetMessageRef pmsg = MakeNetMessage("dsc", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
-        pnode->PushMessage("dsc", sessionID, error, errorMessage);
+        pnode->PushMessage(pmsg);
 }
 
 //TODO: Rename/move to core
@@ -2294,7 +2308,7 @@ void ThreadCheckDarkSendPool()
                 CleanTransactionLocksList();
             }
 
-            //if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
+            if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
 
             darkSendPool.CheckTimeout();
             darkSendPool.CheckForCompleteQueue();
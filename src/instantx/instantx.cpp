@@ -20,6 +20,7 @@
 using namespace std;
 using namespace boost;
 
+CCriticalSection cs_instantx;
 std::map<uint256, CTransaction> mapTxLockReq;
 std::map<uint256, CTransaction> mapTxLockReqRejected;
 std::map<uint256, CConsensusVote> mapTxLockVote;
@@ -27,6 +28,85 @@ std::map<uint256, CTransactionLock> mapTxLocks;
 std::map<COutPoint, uint256> mapLockedInputs;
 std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
 int nCompleteTXLocks;
+CLockLatencyStats lockLatencyStats;
+
+const int64_t CLockLatencyStats::nBucketLimits[CLockLatencyStats::nBuckets] = {
+    250, 500, 1000, 2000, 4000, 8000, 15000, 30000, 60000, std::numeric_limits<int64_t>::max()
+};
+
+void CLockLatencyStats::Add(int64_t nMillis)
+{
+    if(nMillis < 0) nMillis = 0;
+
+    int nBucket = 0;
+    while(nMillis > nBucketLimits[nBucket]) nBucket++;
+
+    vBucketCount[nBucket]++;
+    nCount++;
+    nTotalMillis += nMillis;
+    nMaxMillis = std::max(nMaxMillis, nMillis);
+}
+
+/** A consensus vote waiting for signature verification, along with the key
+ *  of its masternode at the time it was received.
+ */
+class CQueuedVote
+{
+public:
+    CConsensusVote vote;
+    CPubKey pubkey;
+    NodeId nodeFrom;
+
+    CQueuedVote(const CConsensusVote& voteIn, const CPubKey& pubkeyIn, NodeId nodeFromIn)
+        : vote(voteIn), pubkey(pubkeyIn), nodeFrom(nodeFromIn) {}
+};
+
+/** Votes are verified in batches on their own threads, so that the message
+ *  handler never waits on ECDSA and a burst of votes for one lock doesn't
+ *  stall the rest of the network traffic.
+ */
+class CConsensusVoteQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condition;
+    std::deque<CQueuedVote> queue;
+
+public:
+    bool Push(const CQueuedVote& qv)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if(queue.size() >= INSTANTX_MAX_VOTE_QUEUE)
+                return false;
+            queue.push_back(qv);
+        }
+        condition.notify_one();
+        return true;
+    }
+
+    // block until there is work, then take up to nMax votes
+    void Wait(std::vector<CQueuedVote>& vBatch, unsigned int nMax)
+    {
+        vBatch.clear();
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while(queue.empty())
+            condition.wait(lock);
+
+        while(!queue.empty() && vBatch.size() < nMax) {
+            vBatch.push_back(queue.front());
+            queue.pop_front();
+        }
+    }
+
+    int size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+};
+
+static CConsensusVoteQueue voteQueue;
 
 //txlock - Locks transaction
 //
@@ -46,12 +126,16 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
+        tx.CacheHash();
 
         CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
-            return;
+        {
+            LOCK(cs_instantx);
+            if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
+                return;
+            }
         }
 
         if(!IsIXTXValid(tx)){
@@ -69,9 +153,6 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
 
         bool fMissingInputs = false;
         CValidationState state;
-        CBlockIndex* pindex;
-        CBlock block;
-        CTxDB txdb("r");
 
         bool fAccepted = false;
         {
@@ -84,7 +165,10 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
 
             DoConsensusVote(tx, nBlockHeight);
 
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            {
+                LOCK(cs_instantx);
+                mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            }
 
             LogPrintf("ProcessMessageInstantX::txlreq - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -94,6 +178,8 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
             return;
 
         } else {
+            {
+            LOCK(cs_instantx);
             mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
 
             // can we get the conflicting transaction as proof?
@@ -114,15 +200,13 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
             if (i != mapTxLocks.end()){
                 //we only care if we have a complete tx lock
                 if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-                    if(!CheckForConflictingLocks(tx)){
+                    // conflicting complete locks expire each other, blocks
+                    // are left to the normal chain selection
+                    if(!CheckForConflictingLocks(tx))
                         LogPrintf("ProcessMessageInstantX::txlreq - Found Existing Complete IX Lock\n");
-
-                        //reprocess the last 15 blocks
-                        block.DisconnectBlock(txdb, pindex);
-                        tx.DisconnectInputs(txdb);
-                    }
                 }
             }
+            }
 
             return;
         }
@@ -135,43 +219,101 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockVote.count(ctx.GetHash())){
+        {
+            LOCK(cs_instantx);
+            if(mapTxLockVote.count(ctx.GetHash())){
+                return;
+            }
+
+            mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+        }
+
+        CPubKey pubkeyMasternode;
+        if(!CheckConsensusVote(pfrom, ctx, pubkeyMasternode)){
             return;
         }
 
-        mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
-
-        if(ProcessConsensusVote(pfrom, ctx)){
-            //Spam/Dos protection
-            /*
-                Masternodes will sometimes propagate votes before the transaction is known to the client.
-                This tracks those messages and allows it at the same rate of the rest of the network, if
-                a peer violates it, it will simply be ignored
-            */
-            if(!mapTxLockReq.count(ctx.txHash) && !mapTxLockReqRejected.count(ctx.txHash)){
-                if(!mapUnknownVotes.count(ctx.vinMasternode.prevout.hash)){
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
-                }
+        if(!voteQueue.Push(CQueuedVote(ctx, pubkeyMasternode, pfrom->GetId()))){
+            LogPrint("instantx", "ProcessMessageInstantX::txlvote - vote queue full, dropping %s\n", ctx.GetHash().ToString());
+            // forget it so the vote can be accepted again once the queue drains
+            LOCK(cs_instantx);
+            mapTxLockVote.erase(ctx.GetHash());
+        }
+
+        return;
+    }
+}
+
+void ThreadConsensusVotes()
+{
+    std::vector<CQueuedVote> vBatch;
+
+    while(true)
+    {
+        voteQueue.Wait(vBatch, INSTANTX_VOTE_BATCH);
 
-                if(mapUnknownVotes[ctx.vinMasternode.prevout.hash] > GetTime() &&
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] - GetAverageVoteTime() > 60*10){
-                        LogPrintf("ProcessMessageInstantX::txlreq - masternode is spamming transaction votes: %s %s\n",
-                            ctx.vinMasternode.ToString().c_str(),
-                            ctx.txHash.ToString().c_str()
-                        );
-                        return;
-                } else {
-                    mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
+        BOOST_FOREACH(CQueuedVote& qv, vBatch)
+        {
+            CConsensusVote& ctx = qv.vote;
+
+            if(!ctx.SignatureValid(qv.pubkey)) {
+                LogPrintf("InstantX::ProcessConsensusVote - Signature invalid\n");
+                //don't ban, it could just be a non-synced masternode
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                    if(pnode->GetId() == qv.nodeFrom)
+                        mnodeman.AskForMN(pnode, ctx.vinMasternode);
+                continue;
+            }
+
+            if(!ProcessConsensusVote(ctx)) continue;
+
+            {
+                LOCK(cs_instantx);
+                //Spam/Dos protection
+                /*
+                    Masternodes will sometimes propagate votes before the transaction is known to the client.
+                    This tracks those messages and allows it at the same rate of the rest of the network, if
+                    a peer violates it, it will simply be ignored
+                */
+                if(!mapTxLockReq.count(ctx.txHash) && !mapTxLockReqRejected.count(ctx.txHash)){
+                    if(!mapUnknownVotes.count(ctx.vinMasternode.prevout.hash)){
+                        mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
+                    }
+
+                    if(mapUnknownVotes[ctx.vinMasternode.prevout.hash] > GetTime() &&
+                        mapUnknownVotes[ctx.vinMasternode.prevout.hash] - GetAverageVoteTime() > 60*10){
+                            LogPrintf("ProcessMessageInstantX::txlreq - masternode is spamming transaction votes: %s %s\n",
+                                ctx.vinMasternode.ToString().c_str(),
+                                ctx.txHash.ToString().c_str()
+                            );
+                            continue;
+                    } else {
+                        mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
+                    }
                 }
             }
 
+            CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
             RelayInventory(inv);
         }
-
-        return;
     }
 }
 
+void StartInstantXThreads(boost::thread_group& threadGroup)
+{
+    int nThreads = GetArg("-ixvotethreads", INSTANTX_DEFAULT_VOTE_THREADS);
+    nThreads = std::min(std::max(nThreads, 1), 16);
+
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "ixvote", &ThreadConsensusVotes));
+}
+
+int GetConsensusVoteQueueSize()
+{
+    return voteQueue.size();
+}
+
 bool IsIXTXValid(const CTransaction& txCollateral){
     if(txCollateral.vout.size() < 1) return false;
     if(txCollateral.nLockTime != 0) return false;
@@ -238,6 +380,7 @@ int64_t CreateNewLock(CTransaction tx)
     */
     int nBlockHeight = (pindexBest->nHeight - nTxAge)+4;
 
+    LOCK(cs_instantx);
     if (!mapTxLocks.count(tx.GetHash())){
         LogPrintf("CreateNewLock - New Transaction Lock %s !\n", tx.GetHash().ToString().c_str());
 
@@ -292,7 +435,10 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
         return;
     }
 
-    mapTxLockVote[ctx.GetHash()] = ctx;
+    {
+        LOCK(cs_instantx);
+        mapTxLockVote[ctx.GetHash()] = ctx;
+    }
 
     CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
 
@@ -301,7 +447,7 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
 }
 
 //received a consensus vote
-bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
+bool CheckConsensusVote(CNode* pnode, CConsensusVote& ctx, CPubKey& pubkeyRet)
 {
     int n = mnodeman.GetMasternodeRank(ctx.vinMasternode, ctx.nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
 
@@ -325,59 +471,61 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
-    if(!ctx.SignatureValid()) {
-        LogPrintf("InstantX::ProcessConsensusVote - Signature invalid\n");
-        //don't ban, it could just be a non-synced masternode
-        mnodeman.AskForMN(pnode, ctx.vinMasternode);
+    if(pmn == NULL)
+    {
+        LogPrintf("InstantX::ProcessConsensusVote - Unknown Masternode\n");
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)){
-        LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
+    pubkeyRet = pmn->pubkey2;
+    return true;
+}
 
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime()+(20*60);
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
-    } else {
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
-    }
+bool ProcessConsensusVote(CConsensusVote& ctx)
+{
+    bool fUpdateWallet = false;
+    CTransaction tx;
 
-    CBlockIndex* pindex;
-    CBlock block;
-    CTxDB txdb("r");
-    //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
-    if (i != mapTxLocks.end()){
-        (*i).second.AddSignature(ctx);
+    {
+        LOCK(cs_instantx);
 
-#ifdef ENABLE_WALLET
-        if(pwalletMain){
-            //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
-            if(pwalletMain->mapRequestCount.count(ctx.txHash))
-                pwalletMain->mapRequestCount[ctx.txHash]++;
+        if (!mapTxLocks.count(ctx.txHash)){
+            LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
+
+            CTransactionLock newLock;
+            newLock.nBlockHeight = 0;
+            newLock.nExpiration = GetTime()+(20*60);
+            newLock.nTimeout = GetTime()+(60*5);
+            newLock.txHash = ctx.txHash;
+            mapTxLocks.insert(make_pair(ctx.txHash, newLock));
+        } else {
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
         }
-#endif
+
+        //compile consessus vote
+        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
+        if (i == mapTxLocks.end()) return false;
+
+        (*i).second.AddSignature(ctx);
 
         LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
 
         if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
             LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
-            if(!CheckForConflictingLocks(tx)){
+            if((*i).second.nTimeComplete == 0){
+                (*i).second.nTimeComplete = GetTimeMillis();
+                lockLatencyStats.Add((*i).second.nTimeComplete - (*i).second.nTimeCreated);
+            }
 
-#ifdef ENABLE_WALLET
-                if(pwalletMain){
-                    if(pwalletMain->UpdatedTransaction((*i).second.txHash)){
-                        nCompleteTXLocks++;
-                    }
-                }
-#endif
+            std::map<uint256, CTransaction>::iterator it = mapTxLockReq.find(ctx.txHash);
+            if(it != mapTxLockReq.end())
+                tx = (*it).second;
 
-                if(mapTxLockReq.count(ctx.txHash)){
+            if(!CheckForConflictingLocks(tx)){
+                fUpdateWallet = true;
+
+                if(it != mapTxLockReq.end()){
                     BOOST_FOREACH(const CTxIn& in, tx.vin){
                         if(!mapLockedInputs.count(in.prevout)){
                             mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
@@ -387,19 +535,33 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
 
                 // resolve conflicts
 
-                //if this tx lock was rejected, we need to remove the conflicting blocks
-                if(mapTxLockReqRejected.count((*i).second.txHash)){
-                    //reprocess the last 15 blocks
-                    block.DisconnectBlock(txdb, pindex);
-                    tx.DisconnectInputs(txdb);
-                }
+                // a lock completing for a rejected request is only logged;
+                // votes are processed without cs_main, so nothing here may
+                // touch the chain or the txdb
+                if(mapTxLockReqRejected.count((*i).second.txHash))
+                    LogPrintf("InstantX::ProcessConsensusVote - Lock completed for rejected request %s\n", ctx.txHash.ToString());
             }
         }
-        return true;
     }
 
+    // the wallet and the chain are only touched once cs_instantx is released
+#ifdef ENABLE_WALLET
+    if(pwalletMain){
+        {
+            LOCK(pwalletMain->cs_wallet);
+            //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
+            if(pwalletMain->mapRequestCount.count(ctx.txHash))
+                pwalletMain->mapRequestCount[ctx.txHash]++;
+        }
+
+        if(fUpdateWallet && pwalletMain->UpdatedTransaction(ctx.txHash)){
+            LOCK(cs_instantx);
+            nCompleteTXLocks++;
+        }
+    }
+#endif
 
-    return false;
+    return true;
 }
 
 bool CheckForConflictingLocks(CTransaction& tx)
@@ -437,6 +599,8 @@ int64_t GetAverageVoteTime()
         it++;
     }
 
+    if(count == 0) return 0;
+
     return total / count;
 }
 
@@ -444,6 +608,7 @@ void CleanTransactionLocksList()
 {
     if(pindexBest == NULL) return;
 
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
 
     while(it != mapTxLocks.end()) {
@@ -479,10 +644,6 @@ uint256 CConsensusVote::GetHash() const
 
 bool CConsensusVote::SignatureValid()
 {
-    std::string errorMessage;
-    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
-    //LogPrintf("verify strMessage %s \n", strMessage.c_str());
-
     CMasternode* pmn = mnodeman.Find(vinMasternode);
 
     if(pmn == NULL)
@@ -491,7 +652,17 @@ bool CConsensusVote::SignatureValid()
         return false;
     }
 
-    if(!darkSendSigner.VerifyMessage(pmn->pubkey2, vchMasterNodeSignature, strMessage, errorMessage)) {
+    return SignatureValid(pmn->pubkey2);
+}
+
+bool CConsensusVote::SignatureValid(const CPubKey& pubkeyMasternode) const
+{
+    std::string errorMessage;
+    std::string strMessage = txHash.ToString().c_str() + boost::lexical_cast<std::string>(nBlockHeight);
+    //LogPrintf("verify strMessage %s \n", strMessage.c_str());
+
+    std::vector<unsigned char> vchSig = vchMasterNodeSignature;
+    if(!darkSendSigner.VerifyMessage(pubkeyMasternode, vchSig, strMessage, errorMessage)) {
         LogPrintf("InstantX::CConsensusVote::SignatureValid() - Verify message failed\n");
         return false;
     }
@@ -531,8 +702,8 @@ bool CConsensusVote::Sign()
 
 bool CTransactionLock::SignaturesValid()
 {
-
-    BOOST_FOREACH(CConsensusVote vote, vecConsensusVotes)
+    // ranks come from the masternode rank cache, so this is cheap to call repeatedly
+    BOOST_FOREACH(CConsensusVote& vote, vecConsensusVotes)
     {
         int n = mnodeman.GetMasternodeRank(vote.vinMasternode, vote.nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
 
@@ -548,10 +719,7 @@ bool CTransactionLock::SignaturesValid()
             return false;
         }
 
-        if(!vote.SignatureValid()){
-            LogPrintf("CTransactionLock::SignaturesValid() - Signature not valid\n");
-            return false;
-        }
+        // signatures were checked before the vote was added to the lock
     }
 
     return true;
@@ -572,7 +740,7 @@ int CTransactionLock::CountSignatures()
     if(nBlockHeight == 0) return -1;
 
     int n = 0;
-    BOOST_FOREACH(CConsensusVote v, vecConsensusVotes){
+    BOOST_FOREACH(const CConsensusVote& v, vecConsensusVotes){
         if(v.nBlockHeight == nBlockHeight){
             n++;
         }
@@ -16,19 +16,27 @@
 
 #include "main/main.h"
 
+#define INSTANTX_VOTE_BATCH                    32
+#define INSTANTX_DEFAULT_VOTE_THREADS          2
+#define INSTANTX_MAX_VOTE_QUEUE                10000
+
 using namespace std;
 using namespace boost;
 
 class CConsensusVote;
 class CTransaction;
 class CTransactionLock;
+class CLockLatencyStats;
 
+// protects the maps below. Never acquire cs_main or cs_wallet while holding it.
+extern CCriticalSection cs_instantx;
 extern map<uint256, CTransaction> mapTxLockReq;
 extern map<uint256, CTransaction> mapTxLockReqRejected;
 extern map<uint256, CConsensusVote> mapTxLockVote;
 extern map<uint256, CTransactionLock> mapTxLocks;
 extern std::map<COutPoint, uint256> mapLockedInputs;
 extern int nCompleteTXLocks;
+extern CLockLatencyStats lockLatencyStats;
 
 
 int64_t CreateNewLock(CTransaction tx);
@@ -43,8 +51,17 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
 //check if we need to vote on this transaction
 void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight);
 
-//process consensus vote message
-bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx);
+//check that a consensus vote comes from the quorum of its block height, returns the key to verify it with
+bool CheckConsensusVote(CNode* pnode, CConsensusVote& ctx, CPubKey& pubkeyRet);
+
+//apply a consensus vote whose signature has been verified
+bool ProcessConsensusVote(CConsensusVote& ctx);
+
+// start the threads verifying queued consensus votes
+void StartInstantXThreads(boost::thread_group& threadGroup);
+
+// number of consensus votes waiting for signature verification
+int GetConsensusVoteQueueSize();
 
 // keep transaction locks in memory for an hour
 void CleanTransactionLocksList();
@@ -62,6 +79,7 @@ public:
     uint256 GetHash() const;
 
     bool SignatureValid();
+    bool SignatureValid(const CPubKey& pubkeyMasternode) const;
     bool Sign();
 
     IMPLEMENT_SERIALIZE
@@ -81,6 +99,17 @@ public:
     std::vector<CConsensusVote> vecConsensusVotes;
     int nExpiration;
     int nTimeout;
+    int64_t nTimeCreated; // milliseconds
+    int64_t nTimeComplete; // milliseconds, 0 until INSTANTX_SIGNATURES_REQUIRED votes are in
+
+    CTransactionLock()
+    {
+        nBlockHeight = 0;
+        nExpiration = 0;
+        nTimeout = 0;
+        nTimeCreated = GetTimeMillis();
+        nTimeComplete = 0;
+    }
 
     bool SignaturesValid();
     int CountSignatures();
@@ -93,4 +122,30 @@ public:
 };
 
 
+/** Histogram of the time it takes a transaction lock to collect INSTANTX_SIGNATURES_REQUIRED votes.
+ *  Guarded by cs_instantx.
+ */
+class CLockLatencyStats
+{
+public:
+    static const int nBuckets = 10;
+    // upper bound of each bucket in milliseconds, the last one is open ended
+    static const int64_t nBucketLimits[nBuckets];
+
+    uint64_t vBucketCount[nBuckets];
+    uint64_t nCount;
+    int64_t nTotalMillis;
+    int64_t nMaxMillis;
+
+    CLockLatencyStats()
+    {
+        memset(vBucketCount, 0, sizeof(vBucketCount));
+        nCount = 0;
+        nTotalMillis = 0;
+        nMaxMillis = 0;
+    }
+
+    void Add(int64_t nMillis);
+};
+
 #endif
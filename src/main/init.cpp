@@ -15,6 +15,7 @@
 
 #include "rpc/rpcserver.h"
 #include "darksend/darksend-relay.h"
+#include "instantx/instantx.h"
 
 #include "masternode/activemasternode.h"
 #include "masternode/masternode-payments.h"
@@ -106,10 +107,39 @@ bool ShutdownRequested()
 
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
+// peers.dat is read while the block index loads, and must be complete
+// before anything uses or writes addrman
+static boost::scoped_ptr<boost::thread> threadLoadAddresses;
+
+static void LoadAddresses()
+{
+    RenameThread("shardbit-loadaddr");
+    int64_t nStart = GetTimeMillis();
+
+    CAddrDB adb;
+    if (!adb.Read(addrman))
+        LogPrintf("Invalid or missing peers.dat; recreating\n");
+
+    LogPrintf("Loaded %i addresses from peers.dat  %dms\n",
+           addrman.size(), GetTimeMillis() - nStart);
+}
+
+static void WaitForAddresses()
+{
+    if (threadLoadAddresses)
+    {
+        threadLoadAddresses->join();
+        threadLoadAddresses.reset();
+    }
+}
+
 void Shutdown()
 {
 	fRequestShutdown = true; // Needed when we shutdown the wallet
     LogPrintf("Shutdown : In progress...\n");
+    // write the remaining lines as they are logged, a hang or crash during
+    // shutdown must not lose them
+    StopDebugLog();
     static CCriticalSection cs_Shutdown;
     TRY_LOCK(cs_Shutdown, lockShutdown);
     if (!lockShutdown) return;
@@ -124,6 +154,7 @@ void Shutdown()
     if (pwalletMain)
         bitdb.Flush(false);
 #endif
+    WaitForAddresses();
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
     DumpMasternodes();
@@ -195,7 +226,9 @@ std::string HelpMessage()
     strUsage += "  -pid=<file>            " + _("Specify pid file (default: shardbitd.pid)") + "\n";
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
-    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 100)") + "\n";
+    strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 100), also the transaction index cache unless -txdbcache is given") + "\n";
+    strUsage += "  -txdbcache=<n>         " + strprintf(_("Set transaction index cache size in megabytes, %d to %d (default: 1/64 of physical memory)"), MIN_TXDB_CACHE, MAX_TXDB_CACHE) + "\n";
+    strUsage += "  -txdbcompression       " + _("Compress transaction index tables (default: 1)") + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
@@ -218,6 +251,7 @@ std::string HelpMessage()
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+    strUsage += "  -maxrelaymemory=<n>    " + strprintf(_("Keep at most <n> MB of serialized transactions for answering relay requests (default: %u)"), DEFAULT_MAX_RELAY_MEMORY) + "\n";
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -237,7 +271,7 @@ std::string HelpMessage()
     strUsage += "  -debug=<category>      " + _("Output debugging information (default: 0, supplying <category> is optional)") + "\n";
     strUsage +=                               _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage +=                               _("<category> can be:");
-    strUsage +=                                 " addrman, alert, db, lock, rand, rpc, selectcoins, mempool, net,"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, db, import, lock, rand, rpc, selectcoins, mempool, net,"; // Don't translate these and qt below
     strUsage +=                                 " coinage, coinstake, creation, stakemodifier";
     if (fHaveGUI){
         strUsage += ", qt.\n";
@@ -245,6 +279,7 @@ std::string HelpMessage()
         strUsage += ".\n";
     }
     strUsage += "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n";
+    strUsage += "  -logratelimit=<n>      " + _("Maximum lines per second logged for each debug category, 0 = unlimited (default: 1000)") + "\n";
     strUsage += "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
     strUsage += "  -regtest               " + _("Enter regression test mode, which uses a special chain in which blocks can be "
@@ -253,11 +288,14 @@ std::string HelpMessage()
     strUsage += "  -rpcpassword=<pw>      " + _("Password for JSON-RPC connections") + "\n";
     strUsage += "  -rpcport=<port>        " + _("Listen for JSON-RPC connections on <port> (default: 37452)") + "\n";
     strUsage += "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified IP address") + "\n";
+    strUsage += "  -rest                  " + _("Accept public REST requests on the JSON-RPC port (default: 0)") + "\n";
     if (!fHaveGUI){
         strUsage += "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n";
         strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     }
     strUsage += "  -rpcthreads=<n>        " + _("Set the number of threads to service RPC calls (default: 4)") + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + _("Set the depth of the work queue to service RPC calls (default: 16)") + "\n";
+    strUsage += "  -rpcservertimeout=<n>  " + _("Seconds an RPC connection may stay idle or stall mid-request before it is closed (default: 30)") + "\n";
     strUsage += "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
@@ -270,6 +308,8 @@ std::string HelpMessage()
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
+    strUsage += "  -replaybench=<file>    " + _("Import blocks from <file> into an empty data directory with networking disabled, report per-phase timings and shut down") + "\n";
+    strUsage += "  -replaybenchinterval=<n> " + _("Report -replaybench timings every <n> blocks (default: 1000, 0 = only at the end)") + "\n";
     strUsage += "  -maxorphanblocks=<n>   " + strprintf(_("Keep at most <n> unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
     strUsage += "\n" + _("Block creation options:") + "\n";
@@ -301,6 +341,7 @@ strUsage += "\n" + _("Masternode options:") + "\n";
     strUsage += "\n" + _("InstantX options:") + "\n";
     strUsage += "  -enableinstantx=<n>    " + _("Enable instantx, show confirmations for locked transactions (bool, default: true)") + "\n";
     strUsage += "  -instantxdepth=<n>     " + strprintf(_("Show N confirmations for a successfully locked transaction (0-9999, default: %u)"), nInstantXDepth) + "\n";
+    strUsage += "  -ixvotethreads=<n>     " + strprintf(_("Number of threads verifying InstantX votes (1-16, default: %u)"), INSTANTX_DEFAULT_VOTE_THREADS) + "\n";
     strUsage += _("Secure messaging options:") + "\n" +
         "  -nosmsg                                  " + _("Disable secure messaging.") + "\n" +
         "  -debugsmsg                               " + _("Log extra debug messages.") + "\n" +
@@ -431,6 +472,14 @@ bool AppInit2(boost::thread_group& threadGroup)
             LogPrintf("AppInit2 : parameter interaction: -externalip set -> setting -discover=0\n");
     }
 
+    if (mapArgs.count("-replaybench")) {
+        // replay a block file in isolation so the timings are reproducible
+        if (SoftSetBoolArg("-staking", false))
+            LogPrintf("AppInit2 : parameter interaction: -replaybench set -> setting -staking=0\n");
+        if (SoftSetBoolArg("-listen", false))
+            LogPrintf("AppInit2 : parameter interaction: -replaybench set -> setting -listen=0\n");
+    }
+
     if (GetBoolArg("-salvagewallet", false)) {
         // Rewrite just private keys: rescan to find transactions
         if (SoftSetBoolArg("-rescan", true))
@@ -454,6 +503,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     const vector<string>& categories = mapMultiArgs["-debug"];
     if (GetBoolArg("-nodebug", false) || find(categories.begin(), categories.end(), string("0")) != categories.end())
         fDebug = false;
+    SetLogCategories(categories, GetArg("-logratelimit", 1000));
 
     if(fDebug)
     {
@@ -804,6 +854,8 @@ bool AppInit2(boost::thread_group& threadGroup)
         return false;
     }
 
+    threadLoadAddresses.reset(new boost::thread(&LoadAddresses));
+
     uiInterface.InitMessage(_("Loading block index..."));
 
     nStart = GetTimeMillis();
@@ -972,28 +1024,29 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif // !ENABLE_WALLET
     // ********************************************************* Step 9: import blocks
 
-    std::vector<boost::filesystem::path> vImportFiles;
-    if (mapArgs.count("-loadblock"))
+    bool fReplayBench = mapArgs.count("-replaybench");
+    if (fReplayBench)
+    {
+        if (nBestHeight != 0)
+            return InitError(_("-replaybench requires an empty data directory"));
+        threadGroup.create_thread(boost::bind(&ThreadReplayBench, boost::filesystem::path(mapArgs["-replaybench"])));
+    }
+    else
     {
-        BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
-            vImportFiles.push_back(strFile);
+        std::vector<boost::filesystem::path> vImportFiles;
+        if (mapArgs.count("-loadblock"))
+        {
+            BOOST_FOREACH(string strFile, mapMultiArgs["-loadblock"])
+                vImportFiles.push_back(strFile);
+        }
+        threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
     }
-    threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
     // ********************************************************* Step 10: load peers
 
     uiInterface.InitMessage(_("Loading addresses..."));
 
-    nStart = GetTimeMillis();
-
-    {
-        CAddrDB adb;
-        if (!adb.Read(addrman))
-            LogPrintf("Invalid or missing peers.dat; recreating\n");
-    }
-
-    LogPrintf("Loaded %i addresses from peers.dat  %dms\n",
-           addrman.size(), GetTimeMillis() - nStart);
+    WaitForAddresses();
 
     // ********************************************************* Step 10.1: startup secure messaging
 
@@ -1122,6 +1175,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     threadGroup.create_thread(boost::bind(&ThreadCheckDarkSendPool));
 
+    StartInstantXThreads(threadGroup);
+
 
 
     RandAddSeedPerfmon();
@@ -1141,6 +1196,8 @@ bool AppInit2(boost::thread_group& threadGroup)
 	        pblockAddr.RebuildAddressIndex(txdbAddr);
 	    pblockAddrIndex = pblockAddrIndex->pprev;
 	}
+	uiInterface.InitMessage(_("Compacting address index..."));
+	txdbAddr.CompactIndexRanges();
     }
 
     //// debug print
@@ -1152,7 +1209,10 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("mapAddressBook.size() = %u\n",  pwalletMain ? pwalletMain->mapAddressBook.size() : 0);
 #endif
 
-    StartNode(threadGroup);
+    if (fReplayBench)
+        LogPrintf("Networking disabled by -replaybench\n");
+    else
+        StartNode(threadGroup);
 #ifdef ENABLE_WALLET
     // InitRPCMining is needed here so getwork/getblocktemplate in the GUI debug console works properly.
     InitRPCMining();
@@ -1175,7 +1235,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
         // Add wallet transactions that aren't already in a block to mapTransactions
+        nStart = GetTimeMillis();
         pwalletMain->ReacceptWalletTransactions();
+        LogPrintf(" reaccept    %15dms\n", GetTimeMillis() - nStart);
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
@@ -5,6 +5,7 @@
 
 #include "main/main.h"
 #include "chainparams/chainparams.h"
+#include "crypto/common.h"
 #include "main/init.h"
 #include "instantx/instantx.h"
 
@@ -48,7 +49,7 @@ CTxMemPool mempool;
 map<uint256, CBlockIndex*> mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
-CBigNum bnProofOfStakeLimit(~uint256(0) >> 20);
+uint256 bnProofOfStakeLimit(~uint256(0) >> 20);
 
 unsigned int nStakeMinAge = 24 * 60 * 60; // 24 hours
 unsigned int nStakeMaxAge = 48 * 24 * 60 * 60; // 48 Days.
@@ -69,6 +70,13 @@ bool fReindex = false;
 bool fAddrIndex = false;
 bool fHaveGUI = false;
 
+boost::atomic<uint64_t> nTxHashesComputed(0);
+boost::atomic<uint64_t> nBlockHashesComputed(0);
+boost::atomic<uint64_t> nTxHashRequests(0);
+boost::atomic<uint64_t> nBlockHashRequests(0);
+
+CBlockProcessingTimes blockProcessingTimes;
+
 // Max number of Receive messages that can be processed in 1 cycle in
 // ProcessMessages() function.
 const int MAX_RECEIVE_MESSAGES_PROCESSED_IN_CYCLE = 500;
@@ -279,6 +287,7 @@ bool AddOrphanTx(const CTransaction& tx)
     }
 
     mapOrphanTransactions[hash] = tx;
+    mapOrphanTransactions[hash].CacheHash();
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
 
@@ -326,6 +335,12 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 // CTransaction and CTxIndex
 //
 
+uint256 CTransaction::ComputeHash() const
+{
+    nTxHashesComputed++;
+    return SerializeHash(*this);
+}
+
 bool CTransaction::ReadFromDisk(CTxDB& txdb, const uint256& hash, CTxIndex& txindexRet)
 {
     SetNull();
@@ -762,6 +777,8 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
 
     // ----------- instantX transaction scanning -----------
 
+    {
+    LOCK(cs_instantx);
     BOOST_FOREACH(const CTxIn& in, tx.vin){
         if(mapLockedInputs.count(in.prevout)){
             if(mapLockedInputs[in.prevout] != tx.GetHash()){
@@ -769,6 +786,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
             }
         }
     }
+    }
 
     // Check for conflicts with in-memory transactions
     {
@@ -935,6 +953,8 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
 
     // ----------- instantX transaction scanning -----------
 
+    {
+    LOCK(cs_instantx);
     BOOST_FOREACH(const CTxIn& in, tx.vin){
         if(mapLockedInputs.count(in.prevout)){
             if(mapLockedInputs[in.prevout] != tx.GetHash()){
@@ -942,6 +962,7 @@ bool AcceptableInputs(CTxMemPool& pool, const CTransaction &txo, bool fLimitFree
             }
         }
     }
+    }
 
     // Check for conflicts with in-memory transactions
     {
@@ -1083,6 +1104,7 @@ int CMerkleTx::GetTransactionLockSignatures() const
     if(!fEnableInstantX) return -1;
 
     //compile consessus vote
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
     if (i != mapTxLocks.end()){
         return (*i).second.CountSignatures();
@@ -1096,6 +1118,7 @@ bool CMerkleTx::IsTransactionLockTimedOut() const
     if(!fEnableInstantX) return -1;
 
     //compile consessus vote
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
     if (i != mapTxLocks.end()){
         return GetTime() > (*i).second.nTimeout;
@@ -1190,6 +1213,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
     if(nResult < 0) nResult = 0;
 
     if (nResult < 6){
+        LOCK(cs_instantx);
         std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
         if (i != mapTxLocks.end()){
             sigs = (*i).second.CountSignatures();
@@ -1206,6 +1230,7 @@ int GetIXConfirmations(uint256 nTXHash)
 {
     int sigs = 0;
 
+    LOCK(cs_instantx);
     std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
     if (i != mapTxLocks.end()){
         sigs = (*i).second.CountSignatures();
@@ -1217,14 +1242,27 @@ int GetIXConfirmations(uint256 nTXHash)
     return 0;
 }
 
-int CTxIndex::GetDepthInMainChain() const
+// Hash of the block stored at the given position, from the block position
+// index or, for a block stored by an older version, from its header
+static bool GetBlockHashAtPos(CTxDB& txdb, unsigned int nFile, unsigned int nBlockPos, uint256& hashBlock)
 {
-    // Read block header
+    if (txdb.ReadBlockHashAtPos(nFile, nBlockPos, hashBlock))
+        return true;
     CBlock block;
-    if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
+    if (!block.ReadFromDisk(nFile, nBlockPos, false))
+        return false;
+    hashBlock = block.GetHash();
+    return true;
+}
+
+int CTxIndex::GetDepthInMainChain() const
+{
+    CTxDB txdb("r");
+    uint256 hashBlock;
+    if (!GetBlockHashAtPos(txdb, pos.nFile, pos.nBlockPos, hashBlock))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1234,43 +1272,51 @@ int CTxIndex::GetDepthInMainChain() const
 }
 
 // Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock
+bool GetIndexedTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
+{
+    // mempool has its own lock, leveldb and the block files allow concurrent readers
+    if (mempool.lookup(hash, tx))
+        return true;
+
+    CTxDB txdb("r");
+    CTxIndex txindex;
+    if (tx.ReadFromDisk(txdb, hash, txindex))
+    {
+        GetBlockHashAtPos(txdb, txindex.pos.nFile, txindex.pos.nBlockPos, hashBlock);
+        return true;
+    }
+    return false;
+}
+
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 {
+    if (GetIndexedTransaction(hash, tx, hashBlock))
+        return true;
+
+    // look for transaction in disconnected blocks to find orphaned CoinBase and CoinStake transactions
+    CTxDB txdb("r");
+    uint256 hashSideBlock;
+    if (!txdb.ReadSideChainTx(hash, hashSideBlock))
+        return false;
+    unsigned int nFile, nBlockPos;
     {
         LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashSideBlock);
+        if (mi == mapBlockIndex.end())
+            return false;
+        nFile = mi->second->nFile;
+        nBlockPos = mi->second->nBlockPos;
+    }
+    CBlock block;
+    if (!block.ReadFromDisk(nFile, nBlockPos))
+        return false;
+    BOOST_FOREACH(const CTransaction& txOrphan, block.vtx)
+    {
+        if (txOrphan.GetHash() == hash)
         {
-            if (mempool.lookup(hash, tx))
-            {
-                return true;
-            }
-        }
-        CTxDB txdb("r");
-        CTxIndex txindex;
-        if (tx.ReadFromDisk(txdb, hash, txindex))
-        {
-            CBlock block;
-            if (block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-                hashBlock = block.GetHash();
+            tx = txOrphan;
             return true;
         }
-        // look for transaction in disconnected blocks to find orphaned CoinBase and CoinStake transactions
-        BOOST_FOREACH(PAIRTYPE(const uint256, CBlockIndex*)& item, mapBlockIndex)
-        {
-            CBlockIndex* pindex = item.second;
-            if (pindex == pindexBest || pindex->pnext != 0)
-                continue;
-            CBlock block;
-            if (!block.ReadFromDisk(pindex))
-                continue;
-            BOOST_FOREACH(const CTransaction& txOrphan, block.vtx)
-            {
-                if (txOrphan.GetHash() == hash)
-                {
-                    tx = txOrphan;
-                    return true;
-                }
-            }
-        }
     }
     return false;
 }
@@ -1280,6 +1326,67 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 // CBlock and CBlockIndex
 //
 
+static CCriticalSection cs_chainSnapshot;
+static CChainSnapshotRef pchainSnapshot(new CChainSnapshot());
+
+CChainSnapshotRef GetChainSnapshot()
+{
+    LOCK(cs_chainSnapshot);
+    return pchainSnapshot;
+}
+
+void UpdateChainSnapshot(CBlockIndex* pindexNew)
+{
+    AssertLockHeld(cs_main);
+
+    CChainSnapshotRef pold = GetChainSnapshot();
+    boost::shared_ptr<CChainSnapshot> pnew(new CChainSnapshot());
+    pnew->nHeight = pindexNew->nHeight;
+    pnew->hashBestChain = pindexNew->GetBlockHash();
+    pnew->pindexBest = pindexNew;
+    pnew->nBestChainTrust = pindexNew->nChainTrust;
+
+    // find where the new chain leaves the old one, usually the old tip
+    std::vector<CBlockIndex*> vConnect;
+    CBlockIndex* pindexFork = pindexNew;
+    while (pindexFork && !pold->Contains(pindexFork))
+    {
+        vConnect.push_back(pindexFork);
+        pindexFork = pindexFork->pprev;
+    }
+    int nForkHeight = pindexFork ? pindexFork->nHeight : -1;
+
+    // chunks entirely below the fork are shared, the rest are copied and patched
+    int nSharedChunks = (nForkHeight + 1) / CChainSnapshot::CHUNK_SIZE;
+    pnew->vChunks.assign(pold->vChunks.begin(), pold->vChunks.begin() + std::min((int)pold->vChunks.size(), nSharedChunks));
+
+    std::vector<CBlockIndex*> vChunk;
+    int nHeight = nSharedChunks * CChainSnapshot::CHUNK_SIZE;
+    for (; nHeight <= nForkHeight; nHeight++)
+    {
+        vChunk.push_back((*pold)[nHeight]);
+        if ((int)vChunk.size() == CChainSnapshot::CHUNK_SIZE)
+        {
+            pnew->vChunks.push_back(boost::shared_ptr<const std::vector<CBlockIndex*> >(new std::vector<CBlockIndex*>(vChunk)));
+            vChunk.clear();
+        }
+    }
+    BOOST_REVERSE_FOREACH(CBlockIndex* pindex, vConnect)
+    {
+        vChunk.push_back(pindex);
+        if ((int)vChunk.size() == CChainSnapshot::CHUNK_SIZE)
+        {
+            pnew->vChunks.push_back(boost::shared_ptr<const std::vector<CBlockIndex*> >(new std::vector<CBlockIndex*>(vChunk)));
+            vChunk.clear();
+        }
+    }
+    if (!vChunk.empty())
+        pnew->vChunks.push_back(boost::shared_ptr<const std::vector<CBlockIndex*> >(new std::vector<CBlockIndex*>(vChunk)));
+
+    LOCK(cs_chainSnapshot);
+    pchainSnapshot = pnew;
+}
+
 static CBlockIndex* pblockindexFBBHLast;
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
@@ -1413,7 +1520,7 @@ void static PruneOrphanBlocks()
     mapOrphanBlocks.erase(hash);
 }
 
-static CBigNum GetProofOfStakeLimit(int nHeight)
+static uint256 GetProofOfStakeLimit(int nHeight)
 {
     return bnProofOfStakeLimit;
 }
@@ -1489,7 +1596,7 @@ const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfSta
 
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake)
 {
-    CBigNum bnTargetLimit = fProofOfStake ? GetProofOfStakeLimit(pindexLast->nHeight) : Params().ProofOfWorkLimit();
+    uint256 bnTargetLimit = fProofOfStake ? GetProofOfStakeLimit(pindexLast->nHeight) : Params().ProofOfWorkLimit();
 
     if (pindexLast == NULL)
         return bnTargetLimit.GetCompact(); // genesis block
@@ -1514,14 +1621,17 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
     // ppcoin: target change every block
     // ppcoin: retarget with exponential moving toward target spacing
-    CBigNum bnNew;
-    bnNew.SetCompact(pindexPrev->nBits);
+    bool fNegative, fOverflow;
+    uint256 bnNew;
+    bnNew.SetCompact(pindexPrev->nBits, &fNegative, &fOverflow);
 
+    // Both factors are positive and the target is bounded by nBits, so the
+    // product stays far below 2^256.
     int64_t nInterval = nTargetTimespan / TARGET_SPACING;
     bnNew *= ((nInterval - 1) * TARGET_SPACING + nActualSpacing + nActualSpacing);
     bnNew /= ((nInterval + 1) * TARGET_SPACING);
 
-    if (bnNew <= 0 || bnNew > bnTargetLimit)
+    if (fNegative || fOverflow || bnNew == 0 || bnNew > bnTargetLimit)
         bnNew = bnTargetLimit;
 
     return bnNew.GetCompact();
@@ -1529,15 +1639,16 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit())
+    if (fNegative || fOverflow || bnTarget == 0 || bnTarget > Params().ProofOfWorkLimit())
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (hash > bnTarget)
         return error("CheckProofOfWork() : hash doesn't match nBits");
 
     return true;
@@ -1778,6 +1889,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        CSignatureHasher hasher(*this);
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1799,7 +1911,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                 if (!(fBlock && !IsInitialBlockDownload()))
                 {
                     // Verify signature
-                    if (!VerifySignature(txPrev, *this, i, flags, 0))
+                    if (!VerifySignature(txPrev, *this, i, flags, 0, &hasher))
                     {
                         if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                             // Check whether the failure was caused by a
@@ -1808,7 +1920,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                             // if so, don't trigger DoS protection to
                             // avoid splitting the network between upgraded and
                             // non-upgraded nodes.
-                            if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
+                            if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0, &hasher))
                                 return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
                         }
                         // Failures of other flags indicate a transaction that is
@@ -1976,10 +2088,16 @@ void CBlock::RebuildAddressIndex(CTxDB& txdb)
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 {
     // Check it again in case a previous version let a bad block in, but skip BlockSig checking
+    uint64_t nTxHashRequestsStart = nTxHashRequests;
+    uint64_t nTxHashesStart = nTxHashesComputed;
     if (!CheckBlock(!fJustCheck, !fJustCheck, false))
         return false;
+    int64_t nTimeFetch = 0, nTimeConnect = 0;
 
-    unsigned int flags = SCRIPT_VERIFY_NOCACHE;
+    // Block scripts are checked with P2SH (BIP16). Signatures seen in the
+    // mempool are served from the cache; block transactions are not added
+    // to it.
+    unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_NOCACHE;
 
     //// issue here: it doesn't know the version
     unsigned int nTxPos;
@@ -2017,8 +2135,10 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         else
         {
             bool fInvalid;
+            int64_t nTimeTx = GetTimeMicros();
             if (!tx.FetchInputs(txdb, mapQueuedChanges, true, false, mapInputs, fInvalid))
                 return false;
+            nTimeFetch += GetTimeMicros() - nTimeTx;
 
             // Add in sigops done by pay-to-script-hash inputs;
             // this is to prevent a "rogue miner" from creating
@@ -2036,9 +2156,10 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (tx.IsCoinStake())
                 nStakeReward = nTxValueOut - nTxValueIn;
 
-
+            nTimeTx = GetTimeMicros();
             if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, flags))
                 return false;
+            nTimeConnect += GetTimeMicros() - nTimeTx;
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
@@ -2194,7 +2315,13 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     if (fJustCheck)
         return true;
 
+    blockProcessingTimes.nFetchInputs += nTimeFetch;
+    blockProcessingTimes.nConnectInputs += nTimeConnect;
+    blockProcessingTimes.nTransactions += vtx.size();
+    blockProcessingTimes.nInputs += nInputs;
+
     // Write queued txindex changes
+    int64_t nTimeWrite = GetTimeMicros();
     for (map<uint256, CTxIndex>::iterator mi = mapQueuedChanges.begin(); mi != mapQueuedChanges.end(); ++mi)
     {
         if (!txdb.UpdateTxIndex((*mi).first, (*mi).second))
@@ -2260,12 +2387,17 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : WriteBlockIndex failed");
     }
 
+    int64_t nTimeSync = GetTimeMicros();
+    blockProcessingTimes.nTxDBWrite += nTimeSync - nTimeWrite;
+
     // Watch for transactions paying to me
     BOOST_FOREACH(CTransaction& tx, vtx)
         SyncWithWallets(tx, this);
+    blockProcessingTimes.nWalletSync += GetTimeMicros() - nTimeSync;
 
-
-
+    // Without memoization every request would have serialized the transaction
+    LogPrint("bench", "ConnectBlock(): %u txs, %u/%u tx hashes computed/requested\n",
+        vtx.size(), nTxHashesComputed - nTxHashesStart, nTxHashRequests - nTxHashRequestsStart);
 
     return true;
 }
@@ -2311,6 +2443,8 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
             return error("Reorganize() : ReadFromDisk for disconnect failed");
         if (!block.DisconnectBlock(txdb, pindex))
             return error("Reorganize() : DisconnectBlock %s failed", pindex->GetBlockHash().ToString());
+        if (!txdb.WriteSideChainBlock(block))
+            return error("Reorganize() : WriteSideChainBlock failed");
 
         // Queue memory transactions to resurrect.
         // We only do this for blocks after the last checkpoint (reorganisation before that
@@ -2383,8 +2517,10 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
         InvalidChainFound(pindexNew);
         return false;
     }
+    int64_t nTimeCommit = GetTimeMicros();
     if (!txdb.TxnCommit())
         return error("SetBestChain() : TxnCommit failed");
+    blockProcessingTimes.nTxDBCommit += GetTimeMicros() - nTimeCommit;
 
     // Add to current best branch
     pindexNew->pprev->pnext = pindexNew;
@@ -2475,6 +2611,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexNew->nChainTrust;
+    UpdateChainSnapshot(pindexNew);
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
@@ -2613,6 +2750,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     if (!txdb.TxnBegin())
         return false;
     txdb.WriteBlockIndex(CDiskBlockIndex(pindexNew));
+    txdb.WriteBlockHashAtPos(nFile, nBlockPos, hash);
     if (!txdb.TxnCommit())
         return false;
 
@@ -2621,6 +2759,11 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
         if (!SetBestChain(txdb, pindexNew))
             return false;
 
+    // Transactions of a block left off the main chain can only be found
+    // through the side chain index
+    if (pindexNew != pindexBest)
+        txdb.WriteSideChainBlock(*this);
+
     if (pindexNew == pindexBest)
     {
         // Notify UI to display prev block's coinbase if it was ours
@@ -2637,10 +2780,11 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     return true;
 }
 
-bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) const
+bool CBlock::CheckBlockContextFree(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) const
 {
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
+    // They touch no global state and may run on any thread.
 
     // Size limits
     if (vtx.empty() || vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
@@ -2650,10 +2794,6 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     if (fCheckPOW && IsProofOfWork() && !CheckProofOfWork(GetPoWHash(), nBits))
         return DoS(50, error("CheckBlock() : proof of work failed"));
 
-    // Check timestamp
-    if (GetBlockTime() > FutureDrift(GetAdjustedTime()))
-        return error("CheckBlock() : block timestamp too far in the future");
-
     // First transaction must be coinbase, the rest must not be
     if (vtx.empty() || !vtx[0].IsCoinBase())
         return DoS(100, error("CheckBlock() : first tx is not coinbase"));
@@ -2679,10 +2819,56 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     if (fCheckSig && !CheckBlockSignature())
         return DoS(100, error("CheckBlock() : bad proof-of-stake block signature"));
 
+    // Check transactions
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        if (!tx.CheckTransaction())
+            return DoS(tx.nDoS, error("CheckBlock() : CheckTransaction failed"));
+
+        // ppcoin: check transaction timestamp
+        if (GetBlockTime() < (int64_t)tx.nTime)
+            return DoS(50, error("CheckBlock() : block timestamp earlier than transaction timestamp"));
+    }
+
+    // Check for duplicate txids. This is caught by ConnectInputs(),
+    // but catching it earlier avoids a potential DoS attack:
+    set<uint256> uniqueTx;
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        uniqueTx.insert(tx.GetHash());
+    }
+    if (uniqueTx.size() != vtx.size())
+        return DoS(100, error("CheckBlock() : duplicate transaction"));
+
+    unsigned int nSigOps = 0;
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+    {
+        nSigOps += GetLegacySigOpCount(tx);
+    }
+    if (nSigOps > MAX_BLOCK_SIGOPS)
+        return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
+
+    // Check merkle root
+    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
+        return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
+
+    return true;
+}
+
+bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) const
+{
+    // The block import pipeline runs the context-free checks ahead of time
+    if (!fChecked && !CheckBlockContextFree(fCheckPOW, fCheckMerkleRoot, fCheckSig))
+        return false;
+
+    // Check timestamp
+    if (GetBlockTime() > FutureDrift(GetAdjustedTime()))
+        return error("CheckBlock() : block timestamp too far in the future");
 
 // ----------- instantX transaction scanning -----------
 
     if(IsSporkActive(SPORK_3_INSTANTX_BLOCK_FILTERING)){
+        LOCK(cs_instantx);
         BOOST_FOREACH(const CTransaction& tx, vtx){
             if (!tx.IsCoinBase()){
                 //only reject blocks when it's based on complete consensus
@@ -2769,48 +2955,6 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
         if(fDebug) { LogPrintf("CheckBlock() : Is initial download, skipping masternode payment check %d\n", pindexBest->nHeight+1); }
     }
 
-
-
-
-
-
-
-
-
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, vtx)
-    {
-        if (!tx.CheckTransaction())
-            return DoS(tx.nDoS, error("CheckBlock() : CheckTransaction failed"));
-
-        // ppcoin: check transaction timestamp
-        if (GetBlockTime() < (int64_t)tx.nTime)
-            return DoS(50, error("CheckBlock() : block timestamp earlier than transaction timestamp"));
-    }
-
-    // Check for duplicate txids. This is caught by ConnectInputs(),
-    // but catching it earlier avoids a potential DoS attack:
-    set<uint256> uniqueTx;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
-    {
-        uniqueTx.insert(tx.GetHash());
-    }
-    if (uniqueTx.size() != vtx.size())
-        return DoS(100, error("CheckBlock() : duplicate transaction"));
-
-    unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
-    }
-    if (nSigOps > MAX_BLOCK_SIGOPS)
-        return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
-
-    // Check merkle root
-    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
-        return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
-
-
     return true;
 }
 
@@ -2918,13 +3062,18 @@ bool CBlock::AcceptBlock()
 
 uint256 CBlockIndex::GetBlockTrust() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
-    if (bnTarget <= 0)
+    if (fNegative || fOverflow || bnTarget == 0)
         return 0;
 
-    return ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+    // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+    // as it's too large for a uint256. However, as 2**256 is at least as large
+    // as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) / (bnTarget+1)) + 1,
+    // or ~bnTarget / (bnTarget+1) + 1.
+    return (~bnTarget / (bnTarget + 1)) + 1;
 }
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
@@ -2969,6 +3118,12 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 {
     AssertLockHeld(cs_main);
 
+    int64_t nTimeStart = GetTimeMicros();
+    uint64_t nTxHashRequestsStart = nTxHashRequests;
+    uint64_t nTxHashesStart = nTxHashesComputed;
+    uint64_t nBlockHashRequestsStart = nBlockHashRequests;
+    uint64_t nBlockHashesStart = nBlockHashesComputed;
+
     // Check for duplicate
     uint256 hash = pblock->GetHash();
     if (mapBlockIndex.count(hash))
@@ -3005,8 +3160,10 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     }
 
     // Preliminary checks
+    int64_t nTimeCheck = GetTimeMicros();
     if (!pblock->CheckBlock())
         return error("ProcessBlock() : CheckBlock FAILED");
+    blockProcessingTimes.nCheckBlock += GetTimeMicros() - nTimeCheck;
 
     // If we don't already have its previous block, shunt it off to holding area until we get it
     if (!mapBlockIndex.count(pblock->hashPrevBlock))
@@ -3068,6 +3225,7 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
                 CDataStream ss(mi->second->vchBlock, SER_DISK, CLIENT_VERSION);
                 ss >> block;
             }
+            block.CacheHash();
             block.BuildMerkleTree();
             if (block.AcceptBlock())
                 vWorkQueue.push_back(mi->second->hashBlock);
@@ -3117,8 +3275,13 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 
     }
 
+    LogPrint("bench", "ProcessBlock(): %u txs, %u/%u tx hashes and %u/%u block hashes computed/requested\n",
+        pblock->vtx.size(), nTxHashesComputed - nTxHashesStart, nTxHashRequests - nTxHashRequestsStart,
+        nBlockHashesComputed - nBlockHashesStart, nBlockHashRequests - nBlockHashRequestsStart);
     LogPrintf("ProcessBlock: ACCEPTED\n");
 
+    blockProcessingTimes.nBlocks++;
+    blockProcessingTimes.nTotal += GetTimeMicros() - nTimeStart;
     return true;
 }
 
@@ -3383,57 +3546,308 @@ void PrintBlockTree()
     }
 }
 
-bool LoadExternalBlockFile(FILE* fileIn)
+std::string CBlockProcessingTimes::ToString() const
+{
+    double nBlocksDiv = std::max(nBlocks, (uint64_t)1);
+    return strprintf("blocks=%u txs=%u inputs=%u total=%.2fms/blk importwait=%.2fms checkblock=%.2fms fetchinputs=%.2fms connectinputs=%.2fms (%.3fms/txin) txdbwrite=%.2fms txdbcommit=%.2fms walletsync=%.2fms",
+        nBlocks, nTransactions, nInputs, 0.001 * nTotal / nBlocksDiv, 0.001 * nImportWait / nBlocksDiv,
+        0.001 * nCheckBlock / nBlocksDiv, 0.001 * nFetchInputs / nBlocksDiv, 0.001 * nConnectInputs / nBlocksDiv,
+        nInputs ? 0.001 * nConnectInputs / nInputs : 0.0, 0.001 * nTxDBWrite / nBlocksDiv,
+        0.001 * nTxDBCommit / nBlocksDiv, 0.001 * nWalletSync / nBlocksDiv);
+}
+
+std::string CBlockProcessingTimes::ToJSON(int nHeight, bool fFinal) const
+{
+    return strprintf("{\"height\":%d,\"final\":%s,\"blocks\":%u,\"transactions\":%u,\"inputs\":%u,"
+        "\"total_us\":%d,\"importwait_us\":%d,\"checkblock_us\":%d,\"fetchinputs_us\":%d,"
+        "\"connectinputs_us\":%d,\"txdbwrite_us\":%d,\"txdbcommit_us\":%d,\"walletsync_us\":%d}",
+        nHeight, fFinal ? "true" : "false", nBlocks, nTransactions, nInputs,
+        nTotal, nImportWait, nCheckBlock, nFetchInputs,
+        nConnectInputs, nTxDBWrite, nTxDBCommit, nWalletSync);
+}
+
+// -replaybench: log the cumulative timings and append them as one JSON
+// object per line to $DATADIR/replaybench.json
+static void ReportBlockProcessingTimes(bool fFinal)
+{
+    AssertLockHeld(cs_main);
+
+    LogPrintf("replaybench: height=%d %s\n", nBestHeight, blockProcessingTimes.ToString());
+
+    boost::filesystem::path pathReport = GetDataDir() / "replaybench.json";
+    FILE* file = fopen(pathReport.string().c_str(), "a");
+    if (!file)
+        return;
+    fprintf(file, "%s\n", blockProcessingTimes.ToJSON(nBestHeight, fFinal).c_str());
+    fclose(file);
+}
+
+// Bootstrap import pipeline: a reader thread finds the block boundaries in
+// the file, workers deserialize the blocks and run the context-free checks,
+// and the thread calling LoadExternalBlockFile() connects them in order.
+struct CImportBlock
+{
+    std::vector<char> vchData;
+    CBlock block;
+    // serialized size, used to account the memory the block holds
+    unsigned int nSize;
+    bool fReady;
+    bool fValid;
+
+    CImportBlock() : nSize(0), fReady(false), fValid(false) {}
+};
+
+typedef boost::shared_ptr<CImportBlock> CImportBlockRef;
+
+// Blocks can be up to MAX_BLOCK_SIZE, so the queues are bounded by the
+// serialized size of the blocks they hold as well as by their number. A
+// deserialized block takes about as much again as its serialized size.
+static const unsigned int IMPORT_MAX_BLOCKS_IN_FLIGHT = 256;
+static const uint64_t IMPORT_MAX_BYTES_IN_FLIGHT = 64 * 1024 * 1024;
+static const unsigned int IMPORT_MAX_PENDING_BLOCKS = 1024;
+static const uint64_t IMPORT_MAX_PENDING_BYTES = 128 * 1024 * 1024;
+static const int IMPORT_MAX_THREADS = 8;
+
+class CBlockImportQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condReady;
+    boost::condition_variable condSpace;
+    // every block read and not yet popped, in file order
+    std::deque<CImportBlockRef> queueInOrder;
+    // serialized size of the blocks in queueInOrder
+    uint64_t nBytesInFlight;
+    // the blocks of queueInOrder no worker has picked up yet
+    std::deque<CImportBlockRef> queueWork;
+    boost::thread_group threads;
+    FILE* file;
+    bool fReaderDone;
+    bool fShutdown;
+
+    void Reader()
+    {
+        RenameThread("shardbit-loadblk");
+
+        unsigned int nPos = 0;
+        while (true)
+        {
+            unsigned char pchData[65536];
+            do {
+                fseek(file, nPos, SEEK_SET);
+                int nRead = fread(pchData, 1, sizeof(pchData), file);
+                if (nRead <= 8)
+                {
+                    nPos = (unsigned int)-1;
+                    break;
+                }
+                void* nFind = memchr(pchData, Params().MessageStart()[0], nRead+1-MESSAGE_START_SIZE);
+                if (nFind)
+                {
+                    if (memcmp(nFind, Params().MessageStart(), MESSAGE_START_SIZE)==0)
+                    {
+                        nPos += ((unsigned char*)nFind - pchData) + MESSAGE_START_SIZE;
+                        break;
+                    }
+                    nPos += ((unsigned char*)nFind - pchData) + 1;
+                }
+                else
+                    nPos += sizeof(pchData) - MESSAGE_START_SIZE + 1;
+            } while(true);
+            if (nPos == (unsigned int)-1)
+                break;
+
+            fseek(file, nPos, SEEK_SET);
+            unsigned char pchSize[4];
+            if (fread(pchSize, 1, sizeof(pchSize), file) != sizeof(pchSize))
+                break;
+            unsigned int nSize = ReadLE32(pchSize);
+            if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+                continue;
+
+            // wait for room before reading the block, a single block larger
+            // than the budget is let through once the queue has drained
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!queueInOrder.empty() && !fShutdown &&
+                       (queueInOrder.size() >= IMPORT_MAX_BLOCKS_IN_FLIGHT || nBytesInFlight + nSize > IMPORT_MAX_BYTES_IN_FLIGHT))
+                    condSpace.wait(lock);
+                if (fShutdown)
+                    return;
+            }
+
+            CImportBlockRef pimport(new CImportBlock());
+            pimport->nSize = nSize;
+            pimport->vchData.resize(nSize);
+            if (fread(&pimport->vchData[0], 1, nSize, file) != nSize)
+                break;
+            nPos += sizeof(pchSize) + nSize;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            queueInOrder.push_back(pimport);
+            nBytesInFlight += nSize;
+            queueWork.push_back(pimport);
+            condWork.notify_one();
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fReaderDone = true;
+        }
+        condWork.notify_all();
+        condReady.notify_all();
+    }
+
+    void Worker()
+    {
+        RenameThread("shardbit-loadblk");
+
+        while (true)
+        {
+            CImportBlockRef pimport;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queueWork.empty() && !fReaderDone && !fShutdown)
+                    condWork.wait(lock);
+                if (queueWork.empty() || fShutdown)
+                    return;
+                pimport = queueWork.front();
+                queueWork.pop_front();
+            }
+
+            try {
+                CDataStream ss(pimport->vchData, SER_DISK, CLIENT_VERSION);
+                ss >> pimport->block;
+                pimport->block.CacheHash();
+                pimport->fValid = true;
+            }
+            catch (std::exception &e) {
+                LogPrintf("%s() : Deserialize error caught during load\n",
+                       __PRETTY_FUNCTION__);
+            }
+            std::vector<char>().swap(pimport->vchData);
+            if (pimport->fValid)
+            {
+                pimport->fValid = pimport->block.CheckBlockContextFree();
+                pimport->block.fChecked = pimport->fValid;
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                pimport->fReady = true;
+            }
+            condReady.notify_all();
+        }
+    }
+
+public:
+    CBlockImportQueue(FILE* fileIn, int nWorkers) : nBytesInFlight(0), file(fileIn), fReaderDone(false), fShutdown(false)
+    {
+        threads.create_thread(boost::bind(&CBlockImportQueue::Reader, this));
+        for (int i = 0; i < nWorkers; i++)
+            threads.create_thread(boost::bind(&CBlockImportQueue::Worker, this));
+    }
+
+    ~CBlockImportQueue()
+    {
+        boost::this_thread::disable_interruption di;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fShutdown = true;
+        }
+        condWork.notify_all();
+        condSpace.notify_all();
+        threads.join_all();
+    }
+
+    // Next block in file order once the workers are done with it, NULL at
+    // the end of the file
+    CImportBlockRef Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queueInOrder.empty() ? !fReaderDone : !queueInOrder.front()->fReady)
+            condReady.wait(lock);
+        if (queueInOrder.empty())
+            return CImportBlockRef();
+        CImportBlockRef pimport = queueInOrder.front();
+        queueInOrder.pop_front();
+        nBytesInFlight -= pimport->nSize;
+        condSpace.notify_one();
+        return pimport;
+    }
+};
+
+bool LoadExternalBlockFile(FILE* fileIn, unsigned int nReportInterval)
 {
     int64_t nStart = GetTimeMillis();
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency() - 1, IMPORT_MAX_THREADS));
 
     int nLoaded = 0;
+    // Blocks stored ahead of their parent wait here, keyed by parent hash,
+    // instead of in the orphan map which is kept for blocks from peers
+    // the blocks are shared_ptr owned, so an interruption frees them too
+    std::multimap<uint256, CImportBlockRef> mapPending;
+    std::deque<CImportBlockRef> queuePending;
+    uint64_t nPendingBytes = 0;
+    std::vector<CImportBlockRef> vWorkQueue;
     {
+        CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
         try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != (unsigned int)-1 && blkdat.good())
+            CBlockImportQueue queue(blkdat.Get(), nThreads);
+            CImportBlockRef pimport;
+            // the workers run in parallel, only the time this loop is held
+            // up by them is counted
+            for (int64_t nTimeWait = GetTimeMicros(); (pimport = queue.Pop()); nTimeWait = GetTimeMicros())
             {
+                int64_t nTimeWaited = GetTimeMicros() - nTimeWait;
                 boost::this_thread::interruption_point();
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat.Get(), nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat.Get());
-                    if (nRead <= 8)
+                LOCK(cs_main);
+                blockProcessingTimes.nImportWait += nTimeWaited;
+                if (!pimport->fValid || mapBlockIndex.count(pimport->block.GetHash()))
+                    continue;
+
+                if (!mapBlockIndex.count(pimport->block.hashPrevBlock))
+                {
+                    while (!queuePending.empty() &&
+                           (queuePending.size() >= IMPORT_MAX_PENDING_BLOCKS || nPendingBytes + pimport->nSize > IMPORT_MAX_PENDING_BYTES))
                     {
-                        nPos = (unsigned int)-1;
-                        break;
+                        CImportBlockRef pevict = queuePending.front();
+                        queuePending.pop_front();
+                        nPendingBytes -= pevict->nSize;
+                        multimap<uint256, CImportBlockRef>::iterator mi = mapPending.lower_bound(pevict->block.hashPrevBlock);
+                        while (mi->second != pevict)
+                            ++mi;
+                        mapPending.erase(mi);
+                        LogPrint("import", "LoadExternalBlockFile : dropping block %s, parent not found\n", pevict->block.GetHash().ToString());
                     }
-                    void* nFind = memchr(pchData, Params().MessageStart()[0], nRead+1-MESSAGE_START_SIZE);
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, Params().MessageStart(), MESSAGE_START_SIZE)==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + MESSAGE_START_SIZE;
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - MESSAGE_START_SIZE + 1;
-                    boost::this_thread::interruption_point();
-                } while(true);
-                if (nPos == (unsigned int)-1)
-                    break;
-                fseek(blkdat.Get(), nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+                    mapPending.insert(make_pair(pimport->block.hashPrevBlock, pimport));
+                    queuePending.push_back(pimport);
+                    nPendingBytes += pimport->nSize;
+                    continue;
+                }
+
+                // Connect the block and then any descendants that were waiting for it
+                vWorkQueue.push_back(pimport);
+                for (unsigned int i = 0; i < vWorkQueue.size(); i++)
                 {
-                    CBlock block;
-                    blkdat >> block;
-                    LOCK(cs_main);
-                    if (ProcessBlock(NULL,&block))
+                    CBlock& block = vWorkQueue[i]->block;
+                    if (!ProcessBlock(NULL, &block))
+                        continue;
+                    nLoaded++;
+                    if (nReportInterval && nLoaded % nReportInterval == 0)
+                        ReportBlockProcessingTimes(false);
+
+                    uint256 hash = block.GetHash();
+                    for (multimap<uint256, CImportBlockRef>::iterator mi = mapPending.lower_bound(hash); mi != mapPending.upper_bound(hash); ++mi)
                     {
-                        nLoaded++;
-                        nPos += 4 + nSize;
+                        vWorkQueue.push_back(mi->second);
+                        queuePending.erase(std::find(queuePending.begin(), queuePending.end(), mi->second));
+                        nPendingBytes -= mi->second->nSize;
                     }
+                    mapPending.erase(hash);
                 }
+                vWorkQueue.clear();
             }
         }
         catch (std::exception &e) {
@@ -3441,6 +3855,8 @@ bool LoadExternalBlockFile(FILE* fileIn)
                    __PRETTY_FUNCTION__);
         }
     }
+    if (!mapPending.empty())
+        LogPrintf("LoadExternalBlockFile : %u blocks without a known parent were skipped\n", mapPending.size());
     LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
@@ -3463,12 +3879,15 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     RenameThread("shardbit-loadblk");
 
     CImportingNow imp;
+    bool fImported = false;
 
     // -loadblock=
     BOOST_FOREACH(boost::filesystem::path &path, vImportFiles) {
         FILE *file = fopen(path.string().c_str(), "rb");
-        if (file)
+        if (file) {
             LoadExternalBlockFile(file);
+            fImported = true;
+        }
     }
 
     // hardcoded $DATADIR/bootstrap.dat
@@ -3479,8 +3898,42 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
             filesystem::path pathBootstrapOld = GetDataDir() / "bootstrap.dat.old";
             LoadExternalBlockFile(file);
             RenameOver(pathBootstrap, pathBootstrapOld);
+            fImported = true;
         }
     }
+
+    if (fImported) {
+        CTxDB txdb;
+        txdb.CompactIndexRanges();
+    }
+}
+
+void ThreadReplayBench(boost::filesystem::path pathReplay)
+{
+    RenameThread("shardbit-replay");
+
+    {
+        CImportingNow imp;
+
+        {
+            LOCK(cs_main);
+            blockProcessingTimes.SetNull();
+        }
+
+        FILE *file = fopen(pathReplay.string().c_str(), "rb");
+        if (!file)
+            LogPrintf("replaybench: unable to open %s\n", pathReplay.string());
+        else
+        {
+            LogPrintf("replaybench: replaying %s\n", pathReplay.string());
+            LoadExternalBlockFile(file, GetArg("-replaybenchinterval", 1000));
+        }
+
+        LOCK(cs_main);
+        ReportBlockProcessingTimes(true);
+    }
+
+    StartShutdown();
 }
 
 
@@ -3575,10 +4028,16 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
         return mapBlockIndex.count(inv.hash) ||
                mapOrphanBlocks.count(inv.hash);
     case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
+        {
+            LOCK(cs_instantx);
+            return mapTxLockReq.count(inv.hash) ||
+                   mapTxLockReqRejected.count(inv.hash);
+        }
     case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
+        {
+            LOCK(cs_instantx);
+            return mapTxLockVote.count(inv.hash);
+        }
     case MSG_SPORK:
         return mapSporks.count(inv.hash);
     case MSG_MASTERNODE_WINNER:
@@ -3635,15 +4094,14 @@ void static ProcessGetData(CNode* pfrom)
                 if(fDebug) LogPrintf("ProcessGetData -- Starting \n");
                 // Send stream from relay memory
                 bool pushed = false;
-                /*{
+                if (inv.type == MSG_TX) {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CNetMessageRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                        if(fDebug) LogPrintf("ProcessGetData -- pushed = true Rest will fail\n");
+                        pfrom->PushMessage((*mi).second);
                         pushed = true;
                     }
-                }*/
+                }
                 if (!pushed && inv.type == MSG_TX) {
 
                     CTransaction tx;
@@ -3656,6 +4114,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
+                    LOCK(cs_instantx);
                     if(mapTxLockVote.count(inv.hash)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -3665,6 +4124,7 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
+                    LOCK(cs_instantx);
                     if(mapTxLockReq.count(inv.hash)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
@@ -3896,7 +4356,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the addrKnown filters of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -4103,6 +4563,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
         if(strCommand == "tx") {
             vRecv >> tx;
+            tx.CacheHash();
             inv = CInv(MSG_TX, tx.GetHash());
             // Check for recently rejected (and do other quick existence checks)
             if (AlreadyHave(txdb, inv))
@@ -4110,6 +4571,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
         else if (strCommand == "dstx") {
             vRecv >> tx >> vin >> vchSig >> sigTime;
+            tx.CacheHash();
             inv = CInv(MSG_DSTX, tx.GetHash());
             // Check for recently rejected (and do other quick existence checks)
             if (AlreadyHave(txdb, inv))
@@ -4229,6 +4691,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     {
         CBlock block;
         vRecv >> block;
+        block.CacheHash();
         uint256 hashBlock = block.GetHash();
 
         LogPrint("net", "received block %s\n", hashBlock.ToString());
@@ -4612,9 +5075,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 LOCK(cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
                 {
-                    // Periodically clear setAddrKnown to allow refresh broadcasts
+                    // Periodically clear addrKnown to allow refresh broadcasts
                     if (nLastRebroadcast)
-                        pnode->setAddrKnown.clear();
+                        pnode->addrKnown.reset();
 
                     // Rebroadcast our address
                     if (!fNoListen)
@@ -4637,9 +5100,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                if (!pto->addrKnown.contains(addr.GetKey()))
                 {
+                    pto->addrKnown.insert(addr.GetKey());
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000)
@@ -4675,7 +5138,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                std::vector<unsigned char> vKey = CNode::InventoryKnownKey(inv);
+                if (pto->filterInventoryKnown.contains(vKey))
                     continue;
 
                 // trickle out tx inv to protect privacy
@@ -4696,15 +5160,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                // a duplicate later in vInventoryToSend is caught by the check above
+                pto->filterInventoryKnown.insert(vKey);
+                vInv.push_back(inv);
+                if (vInv.size() >= 1000)
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
-                    }
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
                 }
             }
             pto->vInventoryToSend = vInvWait;
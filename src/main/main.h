@@ -17,6 +17,9 @@
 
 #include <list>
 
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
 class CValidationState;
 
 #define START_MASTERNODE_PAYMENTS_TESTNET 1234567890
@@ -144,9 +147,14 @@ FILE* AppendBlockFile(unsigned int& nFileRet);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Look up a transaction in the mempool and the transaction index, without cs_main */
+bool GetIndexedTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
+/** Import a block file into an empty chain and report per-phase timings (-replaybench) */
+void ThreadReplayBench(boost::filesystem::path pathReplay);
+bool LoadExternalBlockFile(FILE* fileIn, unsigned int nReportInterval = 0);
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
@@ -245,6 +253,53 @@ enum GetMinFee_mode
 
 typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
 
+/** Transaction and block hashes actually computed, as opposed to served from
+ *  the hash memoized by CacheHash(). Reported per block with -debug=bench. */
+extern boost::atomic<uint64_t> nTxHashesComputed;
+extern boost::atomic<uint64_t> nBlockHashesComputed;
+/** GetHash() calls, each of which serialized and hashed before memoization */
+extern boost::atomic<uint64_t> nTxHashRequests;
+extern boost::atomic<uint64_t> nBlockHashRequests;
+
+/** Cumulative wall time in microseconds spent in each phase of block
+ *  processing, all measured on the thread holding cs_main so that each
+ *  interval is counted once. nTotal covers ProcessBlock; nImportWait is the
+ *  time the -loadblock import loop spent outside it waiting for its workers
+ *  to deserialize and check blocks. nConnectInputs is ConnectInputs as a
+ *  whole, script verification included. Always collected (the cost is a few
+ *  clock reads per transaction) and reported by -replaybench. Protected by
+ *  cs_main. */
+struct CBlockProcessingTimes
+{
+    int64_t nImportWait;
+    int64_t nCheckBlock;
+    int64_t nFetchInputs;
+    int64_t nConnectInputs;
+    int64_t nTxDBWrite;
+    int64_t nTxDBCommit;
+    int64_t nWalletSync;
+    int64_t nTotal;
+    uint64_t nBlocks;
+    uint64_t nTransactions;
+    uint64_t nInputs;
+
+    CBlockProcessingTimes()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nImportWait = nCheckBlock = nFetchInputs = nConnectInputs = 0;
+        nTxDBWrite = nTxDBCommit = nWalletSync = nTotal = 0;
+        nBlocks = nTransactions = nInputs = 0;
+    }
+
+    std::string ToString() const;
+    std::string ToJSON(int nHeight, bool fFinal) const;
+};
+extern CBlockProcessingTimes blockProcessingTimes;
+
 int64_t GetMinFee(const CTransaction& tx, unsigned int nBytes, bool fAllowFree, enum GetMinFee_mode mode);
 
 
@@ -266,18 +321,42 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+    // memory only, see CacheHash(). Not carried over by copies, which are
+    // often changed afterwards.
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
     CTransaction()
     {
         SetNull();
     }
 
     CTransaction(int nVersion, unsigned int nTime, const std::vector<CTxIn>& vin, const std::vector<CTxOut>& vout, unsigned int nLockTime)
-        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), nDoS(0)
+        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), nDoS(0), fHashCached(false)
+    {
+    }
+
+    CTransaction(const CTransaction& tx)
+        : nVersion(tx.nVersion), nTime(tx.nTime), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime), nDoS(tx.nDoS), fHashCached(false)
+    {
+    }
+
+    CTransaction& operator=(const CTransaction& tx)
     {
+        nVersion = tx.nVersion;
+        nTime = tx.nTime;
+        vin = tx.vin;
+        vout = tx.vout;
+        nLockTime = tx.nLockTime;
+        nDoS = tx.nDoS;
+        fHashCached = false;
+        return *this;
     }
 
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+            const_cast<CTransaction*>(this)->fHashCached = false;
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(nTime);
@@ -294,6 +373,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -303,9 +383,30 @@ public:
 
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        nTxHashRequests.fetch_add(1, boost::memory_order_relaxed);
+        if (fHashCached)
+            return hashCached;
+        return ComputeHash();
     }
 
+    uint256 ComputeHash() const;
+
+    // Remember the hash of a transaction that is not going to change any
+    // more: received from a peer, read from disk or stored in the mempool.
+    // Code that modifies such a transaction must call SetNull() or
+    // ClearHashCache(). Copies start uncached, call CacheHash() again on
+    // copies that are kept and hashed repeatedly.
+    void CacheHash() const
+    {
+        if (!fHashCached)
+        {
+            hashCached = ComputeHash();
+            fHashCached = true;
+        }
+    }
+
+    void ClearHashCache() { fHashCached = false; }
+
     bool IsCoinBase() const
     {
         return (vin.size() == 1 && vin[0].prevout.IsNull() && vout.size() >= 1);
@@ -361,6 +462,7 @@ public:
         catch (std::exception &e) {
             return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
         }
+        CacheHash();
 
         // Return file pointer
         if (pfileRet)
@@ -646,6 +748,13 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    // memory only, see CacheHash(). Not carried over by copies, which are
+    // often changed afterwards.
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+    // CheckBlockContextFree() already passed with all checks enabled, not
+    // carried over by copies either
+    bool fChecked;
 
     // Denial-of-service detection:
     mutable int nDoS;
@@ -656,8 +765,37 @@ public:
         SetNull();
     }
 
+    CBlock(const CBlock& block)
+        : nVersion(block.nVersion), hashPrevBlock(block.hashPrevBlock), hashMerkleRoot(block.hashMerkleRoot),
+          nTime(block.nTime), nBits(block.nBits), nNonce(block.nNonce), vtx(block.vtx), vchBlockSig(block.vchBlockSig),
+          vMerkleTree(block.vMerkleTree), fHashCached(false), fChecked(false), nDoS(block.nDoS)
+    {
+    }
+
+    CBlock& operator=(const CBlock& block)
+    {
+        nVersion = block.nVersion;
+        hashPrevBlock = block.hashPrevBlock;
+        hashMerkleRoot = block.hashMerkleRoot;
+        nTime = block.nTime;
+        nBits = block.nBits;
+        nNonce = block.nNonce;
+        vtx = block.vtx;
+        vchBlockSig = block.vchBlockSig;
+        vMerkleTree = block.vMerkleTree;
+        fHashCached = false;
+        fChecked = false;
+        nDoS = block.nDoS;
+        return *this;
+    }
+
     IMPLEMENT_SERIALIZE
     (
+        if (fRead)
+        {
+            const_cast<CBlock*>(this)->fHashCached = false;
+            const_cast<CBlock*>(this)->fChecked = false;
+        }
         READWRITE(this->nVersion);
         nVersion = this->nVersion;
         READWRITE(hashPrevBlock);
@@ -690,6 +828,8 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        fHashCached = false;
+        fChecked = false;
         nDoS = 0;
     }
 
@@ -699,16 +839,52 @@ public:
     }
 
     uint256 GetHash() const
+    {
+        nBlockHashRequests.fetch_add(1, boost::memory_order_relaxed);
+        if (fHashCached)
+            return hashCached;
+        return ComputeHash();
+    }
+
+    uint256 GetPoWHash() const
+    {
+        if (fHashCached && nVersion <= 6)
+            return hashCached;
+        nBlockHashesComputed++;
+        return Hash9(BEGIN(nVersion), END(nNonce));
+    }
+
+    uint256 ComputeHash() const
     {
         if (nVersion > 6)
+        {
+            nBlockHashesComputed++;
             return Hash(BEGIN(nVersion), END(nNonce));
+        }
         else
             return GetPoWHash();
     }
 
-    uint256 GetPoWHash() const
+    // Remember the header hash and the hashes of all transactions of a
+    // block that is not going to change any more (received or read from
+    // disk). The miner keeps working on uncached blocks, and copies of a
+    // block, its transactions included, start uncached.
+    void CacheHash() const
     {
-     return Hash9(BEGIN(nVersion), END(nNonce));
+        if (!fHashCached)
+        {
+            hashCached = ComputeHash();
+            fHashCached = true;
+        }
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            tx.CacheHash();
+    }
+
+    void ClearHashCache()
+    {
+        fHashCached = false;
+        BOOST_FOREACH(CTransaction& tx, vtx)
+            tx.ClearHashCache();
     }
 
     int64_t GetBlockTime() const
@@ -848,6 +1024,8 @@ public:
             return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
         }
 
+        CacheHash();
+
         // Check the header
         if (fReadTransactions && IsProofOfWork() && !CheckProofOfWork(GetPoWHash(), nBits))
             return error("CBlock::ReadFromDisk() : errors in block header");
@@ -886,6 +1064,7 @@ public:
     bool SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew);
     bool AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const uint256& hashProof);
     bool CheckBlock(bool fCheckPOW=true, bool fCheckMerkleRoot=true, bool fCheckSig=true) const;
+    bool CheckBlockContextFree(bool fCheckPOW=true, bool fCheckMerkleRoot=true, bool fCheckSig=true) const;
     bool AcceptBlock();
     bool SignBlock(CWallet& keystore, int64_t nFees);
     bool CheckBlockSignature() const;
@@ -1231,6 +1410,64 @@ public:
 
 
 
+/** Immutable view of the best chain, republished under cs_main after every
+ * tip change. Readers grab a reference with GetChainSnapshot() and can then
+ * walk heights and check main-chain membership without holding cs_main.
+ * CBlockIndex entries are never freed while running, so the pointers stay
+ * valid for the lifetime of the snapshot.
+ *
+ * The height index is split in fixed size chunks shared between snapshots,
+ * so publishing a new tip copies one chunk rather than the whole chain.
+ */
+class CChainSnapshot
+{
+public:
+    static const int CHUNK_SIZE = 4096;
+
+    int nHeight;
+    uint256 hashBestChain;
+    CBlockIndex* pindexBest;
+    uint256 nBestChainTrust;
+    std::vector<boost::shared_ptr<const std::vector<CBlockIndex*> > > vChunks;
+
+    CChainSnapshot()
+    {
+        nHeight = -1;
+        hashBestChain = 0;
+        pindexBest = NULL;
+        nBestChainTrust = 0;
+    }
+
+    /** Block of the best chain at nHeightIn, NULL if out of range */
+    CBlockIndex* operator[](int nHeightIn) const
+    {
+        if (nHeightIn < 0 || nHeightIn > nHeight)
+            return NULL;
+        return (*vChunks[nHeightIn / CHUNK_SIZE])[nHeightIn % CHUNK_SIZE];
+    }
+
+    bool Contains(const CBlockIndex* pindex) const
+    {
+        return pindex && (*this)[pindex->nHeight] == pindex;
+    }
+
+    /** Successor of pindex in the best chain, NULL for the tip or a side branch */
+    CBlockIndex* Next(const CBlockIndex* pindex) const
+    {
+        if (!Contains(pindex))
+            return NULL;
+        return (*this)[pindex->nHeight + 1];
+    }
+};
+
+typedef boost::shared_ptr<const CChainSnapshot> CChainSnapshotRef;
+
+/** Current best chain snapshot, never NULL */
+CChainSnapshotRef GetChainSnapshot();
+/** Publish the best chain ending at pindexNew, requires cs_main */
+void UpdateChainSnapshot(CBlockIndex* pindexNew);
+
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -131,7 +131,7 @@ bool CMasternodePayments::Sign(CMasternodePaymentWinner& winner)
     return true;
 }
 
-uint64_t CMasternodePayments::CalculateScore(uint256 blockHash, CTxIn& vin)
+uint64_t CMasternodePayments::CalculateScore(const uint256& blockHash, const CTxIn& vin)
 {
     uint256 n1 = blockHash;
     uint256 n2 = Hash(BEGIN(n1), END(n1));
@@ -147,27 +147,27 @@ uint64_t CMasternodePayments::CalculateScore(uint256 blockHash, CTxIn& vin)
 
 bool CMasternodePayments::GetBlockPayee(int nBlockHeight, CScript& payee, CTxIn& vin)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            payee = winner.payee;
-            vin = winner.vin;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    std::map<int, CMasternodePaymentWinner>::iterator mi = mapWinning.find(nBlockHeight);
+    if (mi == mapWinning.end())
+        return false;
+
+    payee = (*mi).second.payee;
+    vin = (*mi).second.vin;
+    return true;
 }
 
 bool CMasternodePayments::GetWinningMasternode(int nBlockHeight, CTxIn& vinOut)
 {
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == nBlockHeight) {
-            vinOut = winner.vin;
-            return true;
-        }
-    }
+    LOCK(cs_masternodepayments);
 
-    return false;
+    std::map<int, CMasternodePaymentWinner>::iterator mi = mapWinning.find(nBlockHeight);
+    if (mi == mapWinning.end())
+        return false;
+
+    vinOut = (*mi).second.vin;
+    return true;
 }
 
 bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerIn)
@@ -179,32 +179,29 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
 
     winnerIn.score = CalculateScore(blockHash, winnerIn.vin);
 
-    bool foundBlock = false;
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning){
-        if(winner.nBlockHeight == winnerIn.nBlockHeight) {
-            foundBlock = true;
-            if(winner.score < winnerIn.score){
-                winner.score = winnerIn.score;
-                winner.vin = winnerIn.vin;
-                winner.payee = winnerIn.payee;
-                winner.vchSig = winnerIn.vchSig;
+    LOCK(cs_masternodepayments);
 
-                mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+    std::map<int, CMasternodePaymentWinner>::iterator mi = mapWinning.find(winnerIn.nBlockHeight);
+    if (mi != mapWinning.end()) {
+        CMasternodePaymentWinner& winner = (*mi).second;
+        if(winner.score < winnerIn.score){
+            winner.score = winnerIn.score;
+            winner.vin = winnerIn.vin;
+            winner.payee = winnerIn.payee;
+            winner.vchSig = winnerIn.vchSig;
 
-                return true;
-            }
+            mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+
+            return true;
         }
+        return false;
     }
 
-    // if it's not in the vector
-    if(!foundBlock){
-        vWinning.push_back(winnerIn);
-        mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
+    // first vote for this height
+    mapWinning.insert(std::make_pair(winnerIn.nBlockHeight, winnerIn));
+    mapSeenMasternodeVotes.insert(make_pair(winnerIn.GetHash(), winnerIn));
 
-        return true;
-    }
-
-    return false;
+    return true;
 }
 
 void CMasternodePayments::CleanPaymentList()
@@ -215,14 +212,12 @@ void CMasternodePayments::CleanPaymentList()
 
     int nLimit = std::max(((int)mnodeman.size())*((int)1.25), 1000);
 
-    vector<CMasternodePaymentWinner>::iterator it;
-    for(it=vWinning.begin();it<vWinning.end();it++){
-        if(pindexBest->nHeight - (*it).nBlockHeight > nLimit){
-            if(fDebug) LogPrintf("CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", (*it).nBlockHeight);
-            vWinning.erase(it);
-            break;
-        }
-    }
+    // drop every winner more than nLimit blocks below the tip at once
+    std::map<int, CMasternodePaymentWinner>::iterator itEnd = mapWinning.lower_bound(pindexBest->nHeight - nLimit);
+    if (fDebug && itEnd != mapWinning.begin())
+        LogPrintf("CMasternodePayments::CleanPaymentList - Removing %d old Masternode payments below block %d\n",
+            std::distance(mapWinning.begin(), itEnd), pindexBest->nHeight - nLimit);
+    mapWinning.erase(mapWinning.begin(), itEnd);
 }
 
 bool CMasternodePayments::ProcessBlock(int nBlockHeight)
@@ -243,11 +238,11 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
     LogPrintf(" ProcessBlock Start nHeight %d - vin %s. \n", nBlockHeight, activeMasternode.vin.ToString().c_str());
 
     std::vector<CTxIn> vecLastPayments;
-    BOOST_REVERSE_FOREACH(CMasternodePaymentWinner& winner, vWinning)
+    for (std::map<int, CMasternodePaymentWinner>::reverse_iterator it = mapWinning.rbegin(); it != mapWinning.rend(); ++it)
     {
         //if we already have the same vin - we have one full payment cycle, break
         if(vecLastPayments.size() > (unsigned int)nMinimumAge) break;
-        vecLastPayments.push_back(winner.vin);
+        vecLastPayments.push_back((*it).second.vin);
     }
 
     // pay to the oldest MN that still had no payment but its input is old enough and it was active long enough
@@ -331,9 +326,10 @@ void CMasternodePayments::Relay(CMasternodePaymentWinner& winner)
 
     vector<CInv> vInv;
     vInv.push_back(inv);
+    CNetMessageRef pmsg = MakeNetMessage("inv", vInv);
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes){
-        pnode->PushMessage("inv", vInv);
+        pnode->PushMessage(pmsg);
     }
 }
 
@@ -341,9 +337,9 @@ void CMasternodePayments::Sync(CNode* node)
 {
     LOCK(cs_masternodepayments);
 
-    BOOST_FOREACH(CMasternodePaymentWinner& winner, vWinning)
-        if(winner.nBlockHeight >= pindexBest->nHeight-10 && winner.nBlockHeight <= pindexBest->nHeight + 20)
-            node->PushMessage("mnw", winner);
+    std::map<int, CMasternodePaymentWinner>::iterator it = mapWinning.lower_bound(pindexBest->nHeight - 10);
+    for (; it != mapWinning.end() && (*it).first <= pindexBest->nHeight + 20; ++it)
+        node->PushMessage("mnw", (*it).second);
 }
 
 
@@ -67,7 +67,8 @@ public:
 class CMasternodePayments
 {
 private:
-    std::vector<CMasternodePaymentWinner> vWinning;
+    // winning masternode by block height
+    std::map<int, CMasternodePaymentWinner> mapWinning;
     int nSyncedFromPeer;
     std::string strMasterPrivKey;
     std::string strMainPubKey;
@@ -90,7 +91,7 @@ public:
     // and get paid this block
     //
 
-    uint64_t CalculateScore(uint256 blockHash, CTxIn& vin);
+    uint64_t CalculateScore(const uint256& blockHash, const CTxIn& vin);
     bool GetWinningMasternode(int nBlockHeight, CTxIn& vinOut);
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
     bool ProcessBlock(int nBlockHeight);
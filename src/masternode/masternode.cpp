@@ -17,6 +17,14 @@ CCriticalSection cs_masternodes;
 map<uint256, int> mapSeenMasternodeScanningErrors;
 // cache block hashes as we calculate them
 std::map<int64_t, uint256> mapCacheBlockHashes;
+boost::atomic<unsigned int> nMasternodeStateChanges(0);
+
+// CMasternode::CalculateScore() results by (block hash, masternode input).
+// The score also depends on the tip through the last-paid walk, so the
+// cache only holds results computed against hashScoreCacheBest.
+static CCriticalSection cs_mapScoreCache;
+static std::map<std::pair<uint256, COutPoint>, uint256> mapScoreCache;
+static uint256 hashScoreCacheBest;
 
 
 struct CompareValueOnly
@@ -155,7 +163,8 @@ CMasternode::CMasternode(CService newAddr, CTxIn newVin, CPubKey newPubkey, std:
 //
 uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
 {
-    if(pindexBest == NULL) return 0;
+    CBlockIndex* pindexTip = pindexBest;
+    if(pindexTip == NULL) return 0;
 
     uint256 r;
     if (nBlockHeight == 0)
@@ -166,6 +175,19 @@ uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
 
     if (!GetBlockHash(hash, nBlockHeight)) return 0;
 
+    std::pair<uint256, COutPoint> key(hash, vin.prevout);
+    {
+        LOCK(cs_mapScoreCache);
+        if (hashScoreCacheBest != pindexTip->GetBlockHash())
+        {
+            mapScoreCache.clear();
+            hashScoreCacheBest = pindexTip->GetBlockHash();
+        }
+        std::map<std::pair<uint256, COutPoint>, uint256>::iterator mi = mapScoreCache.find(key);
+        if (mi != mapScoreCache.end())
+            return (*mi).second;
+    }
+
     uint256 hash2 = Hash(BEGIN(hash), END(hash));
     uint256 hash3 = Hash(BEGIN(hash), END(hash), BEGIN(aux), END(aux));
 
@@ -186,7 +208,7 @@ uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
     unsigned int iAddrHash;
     memcpy(&iAddrHash, &hash4, 4);
     iAddrHash = iAddrHash << 11;
-    CBlockIndex* pIndexWork = pindexBest;
+    CBlockIndex* pIndexWork = pindexTip;
     for (iLastPaid = 1; iLastPaid < 4095; iLastPaid++) {
         if (pIndexWork) {
             if ((pIndexWork->nNonce & (~2047)) == iAddrHash)
@@ -199,6 +221,16 @@ uint256 CMasternode::CalculateScore(int mod, int64_t nBlockHeight)
     rInt32 = (rInt32 | (iLastPaid<<20));
     r = rInt32;
 
+    {
+        LOCK(cs_mapScoreCache);
+        if (hashScoreCacheBest == pindexTip->GetBlockHash())
+        {
+            if (mapScoreCache.size() >= MASTERNODE_SCORE_CACHE_SIZE)
+                mapScoreCache.clear();
+            mapScoreCache.insert(std::make_pair(key, r));
+        }
+    }
+
     return r;
 }
 
@@ -213,29 +245,25 @@ void CMasternode::Check()
     //once spent, stop doing the checks
     if(activeState == MASTERNODE_VIN_SPENT) return;
 
+    int nState = MASTERNODE_ENABLED; // OK
 
     if(!UpdatedWithin(MASTERNODE_REMOVAL_SECONDS)){
-        activeState = MASTERNODE_REMOVE;
-        return;
-    }
-
-    if(!UpdatedWithin(MASTERNODE_EXPIRATION_SECONDS)){
-        activeState = MASTERNODE_EXPIRED;
-        return;
-    }
-
-    if(!unitTest){
+        nState = MASTERNODE_REMOVE;
+    } else if(!UpdatedWithin(MASTERNODE_EXPIRATION_SECONDS)){
+        nState = MASTERNODE_EXPIRED;
+    } else if(!unitTest){
         CValidationState state;
         CTransaction tx = CTransaction();
         CTxOut vout = CTxOut(DARKSEND_POOL_MAX, darkSendPool.collateralPubKey);
         tx.vin.push_back(vin);
         tx.vout.push_back(vout);
 
-	if(!AcceptableInputs(mempool, tx, false, NULL)){
-            activeState = MASTERNODE_VIN_SPENT;
-            return;
-        }
+        if(!AcceptableInputs(mempool, tx, false, NULL))
+            nState = MASTERNODE_VIN_SPENT;
     }
 
-    activeState = MASTERNODE_ENABLED; // OK
+    if(activeState != nState){
+        activeState = nState;
+        nMasternodeStateChanges++;
+    }
 }
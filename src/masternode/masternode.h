@@ -34,6 +34,7 @@ class uint256;
 #define MASTERNODE_PING_SECONDS                (1*60)
 #define MASTERNODE_EXPIRATION_SECONDS          (65*60)
 #define MASTERNODE_REMOVAL_SECONDS             (70*60)
+#define MASTERNODE_SCORE_CACHE_SIZE            20000
 
 using namespace std;
 
@@ -41,6 +42,9 @@ class CMasternode;
 
 extern CCriticalSection cs_masternodes;
 extern map<int64_t, uint256> mapCacheBlockHashes;
+// bumped whenever a masternode's activeState or protocol version changes in
+// place, so cached rank orders can tell they are stale
+extern boost::atomic<unsigned int> nMasternodeStateChanges;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -48,29 +48,13 @@ bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
 {
     int64_t nStart = GetTimeMillis();
 
-    // serialize addresses, checksum data up to that point, then append csum
+    // snapshot the list under its lock, the file is written without it
     CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
     ssMasternodes << strMagicMessage; // masternode cache file specific magic message
     ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
     ssMasternodes << mnodemanToSave;
-    uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    ssMasternodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE *file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssMasternodes;
-    }
-    catch (std::exception &e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
-    }
-    FileCommit(fileout.Get());
-    fileout.fclose();
+    if (!WriteCacheFile(pathMN, ssMasternodes))
+        return false;
 
     LogPrintf("Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
     LogPrintf("  %s\n", mnodemanToSave.ToString());
@@ -161,15 +145,41 @@ CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
     return Ok;
 }
 
+CMasternodeDB::ReadResult CMasternodeDB::ReadHeader()
+{
+    FILE *file = fopen(pathMN.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return FileError;
+
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    try {
+        filein >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp)
+            return IncorrectMagicMessage;
+
+        filein >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return IncorrectMagicNumber;
+    }
+    catch (std::exception &e) {
+        return IncorrectFormat;
+    }
+
+    return Ok;
+}
+
 void DumpMasternodes()
 {
     int64_t nStart = GetTimeMillis();
 
     CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
 
+    // only the header decides whether the file is ours to overwrite, the
+    // rest is replaced anyway and was checked when it was loaded
     LogPrintf("Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman);
+    CMasternodeDB::ReadResult readResult = mndb.ReadHeader();
     // there was an error and it was not an error on file openning => do not proceed
     if (readResult == CMasternodeDB::FileError)
         LogPrintf("Missing masternode list file - mncache.dat, will try to recreate\n");
@@ -192,6 +202,9 @@ void DumpMasternodes()
 
 CMasternodeMan::CMasternodeMan() {
     nDsqCount = 0;
+    hashRankCacheBest = 0;
+    nRankCacheTime = 0;
+    nRankCacheStateChanges = 0;
 }
 
 bool CMasternodeMan::Add(CMasternode &mn)
@@ -207,6 +220,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
     {
         LogPrint("masternode", "CMasternodeMan: Adding new masternode %s - %i now\n", mn.addr.ToString().c_str(), size() + 1);
         vMasternodes.push_back(mn);
+        ClearRankCache();
         return true;
     }
 
@@ -215,6 +229,8 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
 void CMasternodeMan::AskForMN(CNode* pnode, CTxIn &vin)
 {
+    LOCK(cs);
+
     std::map<COutPoint, int64_t>::iterator i = mWeAskedForMasternodeListEntry.find(vin.prevout);
     if (i != mWeAskedForMasternodeListEntry.end())
     {
@@ -250,6 +266,7 @@ void CMasternodeMan::CheckAndRemove()
         if((*it).activeState == CMasternode::MASTERNODE_REMOVE || (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT || (*it).protocolVersion < nMasternodeMinProtocol){
             LogPrint("masternode", "CMasternodeMan: Removing inactive masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
             it = vMasternodes.erase(it);
+            ClearRankCache();
         } else {
             ++it;
         }
@@ -291,6 +308,7 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    ClearRankCache();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -462,13 +480,28 @@ CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight,
     return winner;
 }
 
-int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+const std::vector<CTxIn>* CMasternodeMan::GetRankedMasternodes(int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
     //make sure we know about this block
     uint256 hash = 0;
-    if(!GetBlockHash(hash, nBlockHeight)) return -1;
+    if(!GetBlockHash(hash, nBlockHeight)) return NULL;
+
+    if(hashRankCacheBest != hashBestChain || nRankCacheStateChanges != nMasternodeStateChanges
+        || GetTime() - nRankCacheTime > MASTERNODES_RANK_CACHE_SECONDS) {
+        mapRankCache.clear();
+        hashRankCacheBest = hashBestChain;
+        nRankCacheStateChanges = nMasternodeStateChanges;
+        nRankCacheTime = GetTime();
+    }
+
+    std::pair<std::pair<int64_t, int>, bool> key = make_pair(make_pair(nBlockHeight, minProtocol), fOnlyActive);
+    std::map<std::pair<std::pair<int64_t, int>, bool>, std::vector<CTxIn> >::iterator it = mapRankCache.find(key);
+    if(it != mapRankCache.end())
+        return &it->second;
+
+    std::vector<pair<unsigned int, CTxIn> > vecMasternodeScores;
 
     // scan for winner
     BOOST_FOREACH(CMasternode& mn, vMasternodes) {
@@ -488,11 +521,28 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
     sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareValueOnly());
 
-    int rank = 0;
-    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecMasternodeScores){
-        rank++;
-        if(s.second == vin) {
-            return rank;
+    // heights are looked up in a narrow window around the tip, a small bound is plenty
+    if(mapRankCache.size() >= MASTERNODES_RANK_CACHE_SIZE)
+        mapRankCache.erase(mapRankCache.begin());
+
+    std::vector<CTxIn>& vecRanked = mapRankCache[key];
+    vecRanked.reserve(vecMasternodeScores.size());
+    BOOST_FOREACH (PAIRTYPE(unsigned int, CTxIn)& s, vecMasternodeScores)
+        vecRanked.push_back(s.second);
+
+    return &vecRanked;
+}
+
+int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
+{
+    LOCK(cs);
+
+    const std::vector<CTxIn>* pvecRanked = GetRankedMasternodes(nBlockHeight, minProtocol, fOnlyActive);
+    if(pvecRanked == NULL) return -1;
+
+    for(unsigned int i = 0; i < pvecRanked->size(); i++) {
+        if((*pvecRanked)[i] == vin) {
+            return i + 1;
         }
     }
 
@@ -757,7 +807,10 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                     pmn->pubkey2 = pubkey2;
                     pmn->sigTime = sigTime;
                     pmn->sig = vchSig;
-                    pmn->protocolVersion = protocolVersion;
+                    if(pmn->protocolVersion != protocolVersion){
+                        pmn->protocolVersion = protocolVersion;
+                        nMasternodeStateChanges++;
+                    }
                     pmn->addr = addr;
                     pmn->donationAddress = donationAddress;
                     pmn->donationPercentage = donationPercentage;
@@ -955,9 +1008,12 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 pmn->lastVote = GetAdjustedTime();
 
                 //send to all peers
+                CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                ss << vin << vchSig << nVote;
+                CNetMessageRef pmsg = MakeNetMessage("mvote", ss);
                 LOCK(cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
-                    pnode->PushMessage("mvote", vin, vchSig, nVote);
+                    pnode->PushMessage(pmsg);
             }
 
             return;
@@ -1016,16 +1072,24 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
 void CMasternodeMan::RelayMasternodeEntry(const CTxIn vin, const CService addr, const std::vector<unsigned char> vchSig, const int64_t nNow, const CPubKey pubkey, const CPubKey pubkey2, const int count, const int current, const int64_t lastUpdated, const int protocolVersion, CScript donationAddress, int donationPercentage)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vin << addr << vchSig << nNow << pubkey << pubkey2 << count << current << lastUpdated << protocolVersion << donationAddress << donationPercentage;
+    CNetMessageRef pmsg = MakeNetMessage("dsee", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
-        pnode->PushMessage("dsee", vin, addr, vchSig, nNow, pubkey, pubkey2, count, current, lastUpdated, protocolVersion, donationAddress, donationPercentage);
+        pnode->PushMessage(pmsg);
 }
 
 void CMasternodeMan::RelayMasternodeEntryPing(const CTxIn vin, const std::vector<unsigned char> vchSig, const int64_t nNow, const bool stop)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vin << vchSig << nNow << stop;
+    CNetMessageRef pmsg = MakeNetMessage("dseep", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
-        pnode->PushMessage("dseep", vin, vchSig, nNow, stop);
+        pnode->PushMessage(pmsg);
 }
 
 void CMasternodeMan::Remove(CTxIn vin)
@@ -1037,8 +1101,10 @@ void CMasternodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString().c_str(), size() - 1);
             vMasternodes.erase(it);
+            ClearRankCache();
             break;
         }
+        ++it;
     }
 }
 
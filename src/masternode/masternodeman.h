@@ -20,6 +20,8 @@
 
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_RANK_CACHE_SECONDS         (1*60)
+#define MASTERNODES_RANK_CACHE_SIZE            64
 
 using namespace std;
 
@@ -51,6 +53,8 @@ public:
     CMasternodeDB();
     bool Write(const CMasternodeMan &mnodemanToSave);
     ReadResult Read(CMasternodeMan& mnodemanToLoad);
+    // Check only the magic message and network of an existing file
+    ReadResult ReadHeader();
 };
 
 class CMasternodeMan
@@ -68,6 +72,20 @@ private:
     // which masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // masternodes in rank order, keyed by ((block height, min protocol), only active).
+    // Scores depend on the chain tip, so the whole cache is dropped when the tip
+    // changes, a masternode is added or removed, or one changes state
+    // (nMasternodeStateChanges), and at least every MASTERNODES_RANK_CACHE_SECONDS.
+    std::map<std::pair<std::pair<int64_t, int>, bool>, std::vector<CTxIn> > mapRankCache;
+    uint256 hashRankCacheBest;
+    int64_t nRankCacheTime;
+    unsigned int nRankCacheStateChanges;
+
+    // rank order of the masternodes for a block, NULL if the block is unknown.
+    // The result points into the cache and is only valid while cs is held.
+    const std::vector<CTxIn>* GetRankedMasternodes(int64_t nBlockHeight, int minProtocol, bool fOnlyActive);
+    void ClearRankCache() { mapRankCache.clear(); }
+
 public:
     // keep track of dsq count to prevent masternodes from gaming darksend queue
     int64_t nDsqCount;
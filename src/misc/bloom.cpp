@@ -0,0 +1,111 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+
+#include "hash.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+using namespace std;
+
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
+{
+    double logFpRate = log(fpRate);
+    // The optimal number of hash functions is log(fpRate) / log(0.5), but
+    // restrict it to the range 1-50.
+    nHashFuncs = max(1, min((int)floor(logFpRate / log(0.5) + 0.5), 50));
+    // In this rolling bloom filter, we'll store between 2 and 3 generations of nElements / 2 entries.
+    nEntriesPerGeneration = (nElements + 1) / 2;
+    uint32_t nMaxElements = nEntriesPerGeneration * 3;
+    // The maximum fpRate = pow(1.0 - exp(-nHashFuncs * nMaxElements / nFilterBits), nHashFuncs)
+    // =>                     nFilterBits = -nHashFuncs * nMaxElements / log(1.0 - pow(fpRate, 1.0 / nHashFuncs))
+    uint32_t nFilterBits = (uint32_t)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    // Each 64-bit word pair holds the generation of 64 filter positions,
+    // one bit per plane
+    data.resize(((nFilterBits + 63) / 64) << 1);
+    reset();
+}
+
+static inline uint32_t RollingBloomHash(unsigned int nHashNum, uint32_t nTweak, const vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash);
+}
+
+// Map a 32-bit hash onto [0, n) without a division
+static inline uint32_t FastMod(uint32_t x, size_t n)
+{
+    return ((uint64_t)x * (uint64_t)n) >> 32;
+}
+
+void CRollingBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration)
+    {
+        nEntriesThisGeneration = 0;
+        nGeneration++;
+        if (nGeneration == 4)
+            nGeneration = 1;
+        uint64_t nGenerationMask1 = 0 - (uint64_t)(nGeneration & 1);
+        uint64_t nGenerationMask2 = 0 - (uint64_t)(nGeneration >> 1);
+        // Wipe old entries that used this generation number
+        for (uint32_t p = 0; p < data.size(); p += 2)
+        {
+            uint64_t p1 = data[p], p2 = data[p + 1];
+            uint64_t mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+            data[p] = p1 & mask;
+            data[p + 1] = p2 & mask;
+        }
+    }
+    nEntriesThisGeneration++;
+
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint32_t h = RollingBloomHash(n, nTweak, vKey);
+        int bit = h & 0x3F;
+        // FastMod uses the upper bits of h, the lower ones picked the bit
+        uint32_t pos = FastMod(h, data.size());
+        // The lowest bit of pos selects the plane
+        data[pos & ~1] = (data[pos & ~1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration & 1)) << bit;
+        data[pos | 1] = (data[pos | 1] & ~(((uint64_t)1) << bit)) | ((uint64_t)(nGeneration >> 1)) << bit;
+    }
+}
+
+void CRollingBloomFilter::insert(const uint256& hash)
+{
+    vector<unsigned char> vData(hash.begin(), hash.end());
+    insert(vData);
+}
+
+bool CRollingBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint32_t h = RollingBloomHash(n, nTweak, vKey);
+        int bit = h & 0x3F;
+        uint32_t pos = FastMod(h, data.size());
+        // If the relevant bit is not set in either data[pos & ~1] or data[pos | 1], the filter does not contain vKey
+        if (!(((data[pos & ~1] | data[pos | 1]) >> bit) & 1))
+            return false;
+    }
+    return true;
+}
+
+bool CRollingBloomFilter::contains(const uint256& hash) const
+{
+    vector<unsigned char> vData(hash.begin(), hash.end());
+    return contains(vData);
+}
+
+void CRollingBloomFilter::reset()
+{
+    nTweak = GetRand(numeric_limits<unsigned int>::max());
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    fill(data.begin(), data.end(), 0);
+}
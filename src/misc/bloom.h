@@ -0,0 +1,46 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOOM_H
+#define BITCOIN_BLOOM_H
+
+#include <stdint.h>
+#include <vector>
+
+class uint256;
+
+/**
+ * RollingBloomFilter is a probabilistic "keep track of most recently inserted"
+ * set, in a fixed amount of memory. Construct it with the number of items to
+ * keep track of and a false-positive rate.
+ *
+ * contains(item) will always return true if item was one of the last N to 1.5*N
+ * insert()'ed ... but may also return true for items that were not inserted.
+ *
+ * Entries are tagged with one of three generations packed into two bit
+ * planes; starting a new generation wipes the entries of the oldest one.
+ * The hash seed is randomised on every reset() so a peer cannot arrange for
+ * its items to collide with ours.
+ */
+class CRollingBloomFilter
+{
+public:
+    CRollingBloomFilter(unsigned int nElements, double nFPRate);
+
+    void insert(const std::vector<unsigned char>& vKey);
+    void insert(const uint256& hash);
+    bool contains(const std::vector<unsigned char>& vKey) const;
+    bool contains(const uint256& hash) const;
+
+    void reset();
+
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    std::vector<uint64_t> data;
+    unsigned int nTweak;
+    int nHashFuncs;
+};
+
+#endif
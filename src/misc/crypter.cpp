@@ -228,6 +228,7 @@ bool CCryptoKeyStore::LockKeyStore()
     {
         LOCK(cs_KeyStore);
         vMasterKey.clear();
+        mapDecryptedKeys.clear();
     }
 
     NotifyStatusChanged(this);
@@ -258,6 +259,9 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
             return false;
         }
         vMasterKey = vMasterKeyIn;
+
+        // start over, the wallet may be unlocked for a different purpose now
+        mapDecryptedKeys.clear();
     }
     NotifyStatusChanged(this);
     return true;
@@ -293,17 +297,29 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
             return false;
 
         mapCryptedKeys[vchPubKey.GetID()] = make_pair(vchPubKey, vchCryptedSecret);
+        mapDecryptedKeys.erase(vchPubKey.GetID());
     }
     return true;
 }
 
 bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
 {
+    bool fCache = IsCrypted() && CanCacheKey(address);
     {
         LOCK(cs_KeyStore);
         if (!IsCrypted())
             return CBasicKeyStore::GetKey(address, keyOut);
 
+        if (vMasterKey.empty())
+            return false;
+
+        KeyMap::const_iterator it = mapDecryptedKeys.find(address);
+        if (it != mapDecryptedKeys.end())
+        {
+            keyOut = it->second;
+            return true;
+        }
+
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
         {
@@ -315,6 +331,8 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
             if (vchSecret.size() != 32)
                 return false;
             keyOut.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
+            if (fCache)
+                mapDecryptedKeys[address] = keyOut;
             return true;
         }
     }
@@ -142,6 +142,15 @@ protected:
     CryptedKeyMap mapCryptedKeys;
     CKeyingMaterial vMasterKey;
 
+    // Keys decrypted while unlocked, filled lazily by GetKey() so signing
+    // doesn't run AES for every input. CKey keeps the secret in locked
+    // pages and cleanses it when destroyed; wiped on lock and unlock.
+    mutable KeyMap mapDecryptedKeys;
+
+    // Whether GetKey() may keep the decrypted key in mapDecryptedKeys.
+    // Called without cs_KeyStore held.
+    virtual bool CanCacheKey(const CKeyID &address) const { return true; }
+
     bool SetCrypted();
 
     // will encrypt previously unencrypted keys
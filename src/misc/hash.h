@@ -184,4 +184,12 @@ int HMAC_SHA512_Init(HMAC_SHA512_CTX *pctx, const void *pkey, size_t len);
 int HMAC_SHA512_Update(HMAC_SHA512_CTX *pctx, const void *pdata, size_t len);
 int HMAC_SHA512_Final(unsigned char *pmd, HMAC_SHA512_CTX *pctx);
 void BIP32Hash(const unsigned char chainCode[32], unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
+
+/** Fast non-cryptographic hash, for hash tables and bloom filters. */
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pData, size_t nDataLen);
+
+inline unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashSeed, vDataToHash.empty() ? NULL : &vDataToHash[0], vDataToHash.size());
+}
 #endif
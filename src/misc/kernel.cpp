@@ -217,15 +217,20 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, unsigned
         return error("CheckStakeKernelHash() : max age violation");
 
     // Base target
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
+    if (fNegative)
+        return false;
 
-    // Weighted target
+    // Weighted target. The product may need more than 256 bits, in which
+    // case every hash meets it; targetProofOfStake keeps the low 256 bits.
     int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    CBigNum bnWeight = CBigNum(nValueIn);
-    bnTarget *= bnWeight;
+    uint64_t nWeight = nValueIn > 0 ? nValueIn : 0;
+    bool fTargetOverflow = nWeight > 0 && (fOverflow || bnTarget > ~uint256(0) / nWeight);
+    bnTarget *= nWeight;
 
-    targetProofOfStake = bnTarget.getuint256();
+    targetProofOfStake = bnTarget;
 
     uint64_t nStakeModifier = pindexPrev->nStakeModifier;
     uint256 bnStakeModifierV2 = pindexPrev->bnStakeModifierV2;
@@ -251,7 +256,7 @@ bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, unsigned
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnTarget){
+    if (!fTargetOverflow && hashProofOfStake > bnTarget){
          return false;
     }
 
@@ -5,8 +5,12 @@
 #ifndef BITCOIN_LIMITEDMAP_H
 #define BITCOIN_LIMITEDMAP_H
 
+#include <algorithm>
 #include <assert.h> // TODO: remove
 #include <map>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
 
 /** STL-like map container that only keeps the N elements with the highest value. */
 template <typename K, typename V> class limitedmap
@@ -98,4 +102,102 @@ public:
     }
 };
 
+/** Same as limitedmap, but with a hash table for lookups. The order of the
+ *  values is kept in a binary heap over a vector, whose entries go stale
+ *  when their key is erased or updated and are dropped lazily, instead of
+ *  a tree node per element. */
+template <typename K, typename V, typename Hash> class limitedhashmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const key_type, mapped_type> value_type;
+    typedef typename boost::unordered_map<K, V, Hash>::const_iterator const_iterator;
+    typedef typename boost::unordered_map<K, V, Hash>::size_type size_type;
+
+protected:
+    boost::unordered_map<K, V, Hash> map;
+    typedef typename boost::unordered_map<K, V, Hash>::iterator iterator;
+    typedef std::pair<V, K> heap_entry;
+    std::vector<heap_entry> heap;
+    size_type nMaxSize;
+
+    // min-heap on the value
+    static bool HeapOrder(const heap_entry& a, const heap_entry& b) { return b.first < a.first; }
+
+    void push(const V& v, const K& k)
+    {
+        heap.push_back(heap_entry(v, k));
+        std::push_heap(heap.begin(), heap.end(), HeapOrder);
+        if (heap.size() > 2 * map.size() + 64)
+        {
+            // too many stale entries, rebuild from the live ones
+            heap.clear();
+            for (iterator it = map.begin(); it != map.end(); ++it)
+                heap.push_back(heap_entry(it->second, it->first));
+            std::make_heap(heap.begin(), heap.end(), HeapOrder);
+        }
+    }
+
+    // Erase the live entry with the lowest value. pkeyKeep is a key just
+    // inserted and not pushed yet, heap entries for it are stale.
+    void evict(const key_type* pkeyKeep = NULL)
+    {
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), HeapOrder);
+            heap_entry entry = heap.back();
+            heap.pop_back();
+            if (pkeyKeep && entry.second == *pkeyKeep)
+                continue;
+            iterator it = map.find(entry.second);
+            if (it != map.end() && it->second == entry.first)
+            {
+                map.erase(it);
+                return;
+            }
+        }
+    }
+
+public:
+    limitedhashmap(size_type nMaxSizeIn = 0) { nMaxSize = nMaxSizeIn; }
+    const_iterator begin() const { return map.begin(); }
+    const_iterator end() const { return map.end(); }
+    size_type size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+    const_iterator find(const key_type& k) const { return map.find(k); }
+    size_type count(const key_type& k) const { return map.count(k); }
+    void insert(const value_type& x)
+    {
+        if (map.insert(x).second)
+        {
+            // like limitedmap, the new entry is never the one evicted
+            if (nMaxSize && map.size() >= nMaxSize)
+                evict(&x.first);
+            push(x.second, x.first);
+        }
+    }
+    void erase(const key_type& k)
+    {
+        map.erase(k);
+    }
+    void update(const_iterator itIn, const mapped_type& v)
+    {
+        iterator itTarget = map.find(itIn->first);
+        if (itTarget == map.end())
+            return;
+        itTarget->second = v;
+        push(v, itTarget->first);
+    }
+    size_type max_size() const { return nMaxSize; }
+    size_type max_size(size_type s)
+    {
+        if (s)
+            while (map.size() > s)
+                evict();
+        nMaxSize = s;
+        return nMaxSize;
+    }
+};
+
 #endif
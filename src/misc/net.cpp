@@ -60,10 +60,13 @@ int nMaxConnections = GetArg("-maxconnections", 125);
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CNetMessageRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
+size_t nRelayMemoryUsage = 0;
 CCriticalSection cs_mapRelay;
-limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
+static map<string, uint256> mapCacheFileHash;
+static CCriticalSection cs_mapCacheFileHash;
+limitedhashmap<CInv, int64_t, CInvHasher> mapAlreadyAskedFor(MAX_INV_SZ);
 
 static deque<string> vOneShots;
 CCriticalSection cs_vOneShots;
@@ -741,10 +744,10 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CNetMessageRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSerializeData &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -1903,29 +1906,49 @@ public:
 }
 instance_of_cnetcleanup;
 
+void FinishMessageHeader(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+}
+
 void RelayTransaction(const CTransaction& tx, const uint256& hash)
 {
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss.reserve(10000);
-    ss << tx;
-    RelayTransaction(tx, hash, ss);
+    RelayTransaction(tx, hash, MakeNetMessage("tx", tx));
 }
 
-void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss)
+void RelayTransaction(const CTransaction& tx, const uint256& hash, const CNetMessageRef& pmsg)
 {
     CInv inv(MSG_TX, hash);
     {
         LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime())
+        // Expire old relay messages, and the oldest ones beyond -maxrelaymemory
+        size_t nMaxRelayMemory = GetArg("-maxrelaymemory", DEFAULT_MAX_RELAY_MEMORY) * 1000000;
+        while (!vRelayExpiration.empty() && (vRelayExpiration.front().first < GetTime() || nRelayMemoryUsage + pmsg->size() > nMaxRelayMemory))
         {
-            mapRelay.erase(vRelayExpiration.front().second);
+            map<CInv, CNetMessageRef>::iterator mi = mapRelay.find(vRelayExpiration.front().second);
+            if (mi != mapRelay.end())
+            {
+                nRelayMemoryUsage -= (*mi).second->size();
+                mapRelay.erase(mi);
+            }
             vRelayExpiration.pop_front();
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+        if (mapRelay.insert(std::make_pair(inv, pmsg)).second)
+        {
+            nRelayMemoryUsage += pmsg->size();
+            vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+        }
     }
 
     RelayInventory(inv);
@@ -1934,6 +1957,7 @@ void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataSt
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
     CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+    CNetMessageRef pmsg = MakeNetMessage("txlreq", tx);
 
     //broadcast the new lock
     LOCK(cs_vNodes);
@@ -1942,7 +1966,7 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if(!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("txlreq", tx);
+        pnode->PushMessage(pmsg);
     }
 
 }
@@ -1980,44 +2004,59 @@ CAddrDB::CAddrDB()
     pathAddr = GetDataDir() / "peers.dat";
 }
 
-bool CAddrDB::Write(const CAddrMan& addr)
+bool WriteCacheFile(const boost::filesystem::path& path, CDataStream& ss)
 {
+    // checksum data up to that point, then append csum
+    uint256 hash = Hash(ss.begin(), ss.end());
+    {
+        LOCK(cs_mapCacheFileHash);
+        map<string, uint256>::iterator mi = mapCacheFileHash.find(path.string());
+        if (mi != mapCacheFileHash.end() && (*mi).second == hash && boost::filesystem::exists(path))
+        {
+            LogPrint("net", "%s : %s unchanged\n", __func__, path.filename().string());
+            return true;
+        }
+    }
+    ss << hash;
+
     // Generate random temporary filename
     unsigned short randv = 0;
     GetRandBytes((unsigned char *)&randv, sizeof(randv));
-    std::string tmpfn = strprintf("peers.dat.%04x", randv);
-
-    // serialize addresses, checksum data up to that point, then append csum
-    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
-    ssPeers << FLATDATA(Params().MessageStart());
-    ssPeers << addr;
-    uint256 hash = Hash(ssPeers.begin(), ssPeers.end());
-    ssPeers << hash;
+    boost::filesystem::path pathTmp = path.string() + strprintf(".%04x", randv);
 
     // open temp output file, and associate with CAutoFile
-    boost::filesystem::path pathTmp = GetDataDir() / tmpfn;
     FILE *file = fopen(pathTmp.string().c_str(), "wb");
-    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
     if (fileout.IsNull())
-        return error("CAddrman::Write() : open failed");
+        return error("%s : Failed to open file %s", __func__, pathTmp.string());
 
     // Write and commit header, data
     try {
-        fileout << ssPeers;
+        fileout << ss;
     }
     catch (std::exception &e) {
-        return error("CAddrman::Write() : I/O error");
+        return error("%s : Serialize or I/O error - %s", __func__, e.what());
     }
     FileCommit(fileout.Get());
     fileout.fclose();
 
-    // replace existing peers.dat, if any, with new peers.dat.XXXX
-    if (!RenameOver(pathTmp, pathAddr))
-        return error("CAddrman::Write() : Rename-into-place failed");
+    // replace the existing file, if any, with the new one
+    if (!RenameOver(pathTmp, path))
+        return error("%s : Rename-into-place failed for %s", __func__, path.string());
 
+    LOCK(cs_mapCacheFileHash);
+    mapCacheFileHash[path.string()] = hash;
     return true;
 }
 
+bool CAddrDB::Write(const CAddrMan& addr)
+{
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << FLATDATA(Params().MessageStart());
+    ssPeers << addr;
+    return WriteCacheFile(pathAddr, ssPeers);
+}
+
 bool CAddrDB::Read(CAddrMan& addr)
 {
     // open input file, and associate with CAutoFile
@@ -2086,40 +2125,10 @@ CBanDB::CBanDB()
 
 bool CBanDB::Write(const banmap_t& banSet)
 {
-    // Generate random temporary filename
-    unsigned short randv = 0;
-    GetRandBytes((unsigned char*)&randv, sizeof(randv));
-    std::string tmpfn = strprintf("banlist.dat.%04x", randv);
-
-    // serialize banlist, checksum data up to that point, then append csum
     CDataStream ssBanlist(SER_DISK, CLIENT_VERSION);
     ssBanlist << FLATDATA(Params().MessageStart());
     ssBanlist << banSet;
-    uint256 hash = Hash(ssBanlist.begin(), ssBanlist.end());
-    ssBanlist << hash;
-
-    // open temp output file, and associate with CAutoFile
-    boost::filesystem::path pathTmp = GetDataDir() / tmpfn;
-    FILE *file = fopen(pathTmp.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: Failed to open file %s", __func__, pathTmp.string());
-
-    // Write and commit header, data
-    try {
-        fileout << ssBanlist;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Serialize or I/O error - %s", __func__, e.what());
-    }
-    FileCommit(fileout.Get());
-    fileout.fclose();
-
-    // replace existing banlist.dat, if any, with new banlist.dat.XXXX
-    if (!RenameOver(pathTmp, pathBanlist))
-        return error("%s: Rename-into-place failed", __func__);
-
-    return true;
+    return WriteCacheFile(pathBanlist, ssBanlist);
 }
 
 bool CBanDB::Read(banmap_t& banSet)
@@ -7,9 +7,9 @@
 
 #include "compat.h"
 #include "core.h"
+#include "bloom.h"
 #include "hash.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "sync.h"
@@ -25,6 +25,7 @@
 
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <openssl/rand.h>
 
@@ -56,6 +57,27 @@ static const unsigned int MAX_ADDR_TO_SEND = 1000;
 
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
+/** Default for -maxrelaymemory, the payload bytes (in MB) of transactions kept in mapRelay */
+static const unsigned int DEFAULT_MAX_RELAY_MEMORY = 5;
+
+/** A complete network message, header and payload, serialized once and
+ *  shared between the send queues of any number of peers */
+typedef boost::shared_ptr<const CSerializeData> CNetMessageRef;
+
+/** Fill in the payload size and checksum of a message header at the start of ss */
+void FinishMessageHeader(CDataStream& ss);
+
+template<typename T>
+CNetMessageRef MakeNetMessage(const char* pszCommand, const T& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + 1000);
+    ss << CMessageHeader(pszCommand, 0) << payload;
+    FinishMessageHeader(ss);
+    boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+    ss.GetAndClear(*pmsg);
+    return pmsg;
+}
 
 void AddOneShot(std::string strDest);
 bool RecvLine(SOCKET hSocket, std::string& strLine);
@@ -136,10 +158,26 @@ extern int nMaxConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CNetMessageRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
+extern size_t nRelayMemoryUsage;
 extern CCriticalSection cs_mapRelay;
-extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
+/** Salted hash of an inventory item, for hash tables keyed by what peers send us */
+class CInvHasher
+{
+private:
+    unsigned int nSeed;
+
+public:
+    CInvHasher() : nSeed(GetRand(std::numeric_limits<unsigned int>::max())) {}
+
+    size_t operator()(const CInv& inv) const
+    {
+        return MurmurHash3(nSeed ^ inv.type, inv.hash.begin(), inv.hash.end() - inv.hash.begin());
+    }
+};
+
+extern limitedhashmap<CInv, int64_t, CInvHasher> mapAlreadyAskedFor;
 
 extern std::vector<std::string> vAddedNodes;
 extern CCriticalSection cs_vAddedNodes;
@@ -318,7 +356,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CNetMessageRef> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -375,13 +413,13 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    mruset<CAddress> setAddrKnown;
+    CRollingBloomFilter addrKnown;
     bool fGetAddr;
     std::set<uint256> setKnown;
     uint256 hashCheckpointKnown; // ppcoin: known sent sync-checkpoint
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::set<uint256> setAskFor;
@@ -399,7 +437,7 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), addrKnown(5000, 0.001), filterInventoryKnown(std::max(SendBufferSize() / 1000, 1000u), 0.000001)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -432,7 +470,6 @@ public:
         fGetAddr = false;
         fRelayTxes = false;
         hashCheckpointKnown = 0;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
         nPingNonceSent = 0;
         nPingUsecStart = 0;
         nPingUsecTime = 0;
@@ -516,7 +553,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -524,7 +561,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr)) {
+        if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
             } else {
@@ -534,11 +571,20 @@ public:
     }
 
 
+    // filterInventoryKnown key, the serialized type and hash: a transaction,
+    // its darksend broadcast and its lock request all share the txid
+    static std::vector<unsigned char> InventoryKnownKey(const CInv& inv)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << inv;
+        return std::vector<unsigned char>(ss.begin(), ss.end());
+    }
+
     void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(InventoryKnownKey(inv));
         }
     }
 
@@ -546,7 +592,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(InventoryKnownKey(inv)))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -563,7 +609,7 @@ public:
         // We're using mapAskFor as a priority queue,
         // the key is the earliest time the request can be sent
         int64_t nRequestTime;
-        limitedmap<CInv, int64_t>::const_iterator it = mapAlreadyAskedFor.find(inv);
+        limitedhashmap<CInv, int64_t, CInvHasher>::const_iterator it = mapAlreadyAskedFor.find(inv);
         if (it != mapAlreadyAskedFor.end())
             nRequestTime = it->second;
         else
@@ -626,30 +672,35 @@ public:
         if (ssSend.size() == 0)
             return;
 
-        // Set the size
-        unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-        memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-        // Set the checksum
-        uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-        unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
-        assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-        memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+        FinishMessageHeader(ssSend);
 
-        LogPrint("net", "(%d bytes)\n", nSize);
+        LogPrint("net", "(%d bytes)\n", ssSend.size() - CMessageHeader::HEADER_SIZE);
 
-        std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-        ssSend.GetAndClear(*it);
-        nSendSize += (*it).size();
+        boost::shared_ptr<CSerializeData> pmsg(new CSerializeData());
+        ssSend.GetAndClear(*pmsg);
+        vSendMsg.push_back(pmsg);
+        nSendSize += pmsg->size();
 
         // If write queue empty, attempt "optimistic write"
-        if (it == vSendMsg.begin())
+        if (vSendMsg.size() == 1)
             SocketSendData(this);
 
         LEAVE_CRITICAL_SECTION(cs_vSend);
     }
 
+    // Queue a message built by MakeNetMessage(), without copying it
+    void PushMessage(const CNetMessageRef& pmsg)
+    {
+        LOCK(cs_vSend);
+        LogPrint("net", "sending: shared message (%d bytes)\n", pmsg->size() - CMessageHeader::HEADER_SIZE);
+
+        vSendMsg.push_back(pmsg);
+        nSendSize += pmsg->size();
+
+        if (vSendMsg.size() == 1)
+            SocketSendData(this);
+    }
+
     void PushVersion();
 
 
@@ -933,9 +984,16 @@ inline void RelayInventory(const CInv& inv)
 
 class CTransaction;
 void RelayTransaction(const CTransaction& tx, const uint256& hash);
-void RelayTransaction(const CTransaction& tx, const uint256& hash, const CDataStream& ss);
+void RelayTransaction(const CTransaction& tx, const uint256& hash, const CNetMessageRef& pmsg);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll=false);
 
+/** Write a cache file (peers.dat, banlist.dat, mncache.dat) from the data
+ *  serialized in ss, followed by its checksum. The file is replaced through a
+ *  temporary file so a crash leaves the previous version intact, and the write
+ *  is skipped if the data has not changed since the last one. Callers serialize
+ *  their snapshot under their own locks and call this without holding them. */
+bool WriteCacheFile(const boost::filesystem::path& path, CDataStream& ss);
+
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
 {
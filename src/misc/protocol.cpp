@@ -136,6 +136,11 @@ bool operator<(const CInv& a, const CInv& b)
     return (a.type < b.type || (a.type == b.type && a.hash < b.hash));
 }
 
+bool operator==(const CInv& a, const CInv& b)
+{
+    return (a.type == b.type && a.hash == b.hash);
+}
+
 bool CInv::IsKnownType() const
 {
     return (type >= 1 && type < (int)ARRAYLEN(ppszTypeName));
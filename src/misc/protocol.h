@@ -113,6 +113,7 @@ class CInv
         )
 
         friend bool operator<(const CInv& a, const CInv& b);
+        friend bool operator==(const CInv& a, const CInv& b);
 
         bool IsKnownType() const;
         const char* GetCommand() const;
@@ -3,7 +3,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
 
@@ -106,7 +108,7 @@ const char* ScriptErrorString(const ScriptError serror)
 }
 
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, CSignatureHasher* phasher = NULL);
 
 static const valtype vchFalse(0);
 static const valtype vchZero(0);
@@ -435,7 +437,7 @@ bool static CheckPubKeyEncoding(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -1132,7 +1134,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         return false;
 
                     bool fSuccess = CheckSignatureEncoding(vchSig) && CheckPubKeyEncoding(vchPubKey) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                     popstack(stack);
                     popstack(stack);
@@ -1196,7 +1198,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                         // Check signature
                         bool fOk = CheckSignatureEncoding(vchSig) && CheckPubKeyEncoding(vchPubKey) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                         if (fOk)
                         {
@@ -2077,15 +2079,61 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return ss.GetHash();
 }
 
+void CSignatureHasher::Init()
+{
+    // Same layout as CTransaction serialization, with every scriptSig empty
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
+
+    vInputEnd.reserve(txTo.vin.size());
+    vMidstate.reserve(txTo.vin.size());
+    CHashWriter hasher(SER_GETHASH, 0);
+    unsigned int nHashed = 0;
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
+    {
+        hasher.write(&ss[nHashed], ss.size() - nHashed);
+        nHashed = ss.size();
+        vMidstate.push_back(hasher);
+
+        ss << txin.prevout << CScript() << txin.nSequence;
+        vInputEnd.push_back(ss.size());
+    }
+    ss << txTo.vout << txTo.nLockTime;
+
+    vchTx.assign(ss.begin(), ss.end());
+    fInitialized = true;
+}
+
+uint256 CSignatureHasher::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType)
+{
+    // NONE, SINGLE and ANYONECANPAY rewrite more than the signed input
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE ||
+        (nHashType & SIGHASH_ANYONECANPAY) || nIn >= txTo.vin.size())
+        return ::SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    if (!fInitialized)
+        Init();
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    const CTxIn& txin = txTo.vin[nIn];
+    CHashWriter ss(vMidstate[nIn]);
+    ss << txin.prevout << scriptCode << txin.nSequence;
+    ss.write(&vchTx[vInputEnd[nIn]], vchTx.size() - vInputEnd[nIn]);
+    ss << nHashType;
+    return ss.GetHash();
+}
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType, CSignatureHasher* phasher)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = phasher ? phasher->SignatureHash(fromPubKey, nIn, nHashType) : SignatureHash(fromPubKey, txTo, nIn, nHashType);
 
     txnouttype whichType;
     if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
@@ -2099,7 +2147,7 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         CScript subscript = txin.scriptSig;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = phasher ? phasher->SignatureHash(subscript, nIn, nHashType) : SignatureHash(subscript, txTo, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
@@ -2110,77 +2158,199 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
     }
 
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, SignatureChecker(txTo, nIn));
+    return VerifyScript(txin.scriptSig, fromPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, SignatureChecker(txTo, nIn, phasher));
 }
 
-bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType, CSignatureHasher* phasher)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
     assert(txin.prevout.n < txFrom.vout.size());
     const CTxOut& txout = txFrom.vout[txin.prevout.n];
 
-    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
+    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType, phasher);
 }
 
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
+//
+// Entries are the salted SHA256 of (signature hash, signature, public key),
+// kept in a fixed-size table of cache-line sized buckets. Every digest has
+// two candidate buckets; inserts displace older entries cuckoo-style and the
+// last one kicked out is dropped. Lookups take no lock: a slot that is being
+// rewritten can only read back as a miss, and the random salt keeps peers
+// from steering entries into chosen slots.
 
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int ENTRIES_PER_BUCKET = 2;
+    static const unsigned int MAX_KICKS = 8;
 
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    struct CEntry
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        boost::atomic<uint64_t> nWords[4];
+    };
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+    struct CBucket
+    {
+        CEntry entries[ENTRIES_PER_BUCKET];
+    };
+
+    uint256 nonce;
+    unsigned char* pchAlloc;
+    CBucket* pbuckets;
+    uint32_t nBucketMask;
+    unsigned int nKick;
+    boost::mutex cs_sigcache; // serializes writers only
+
+    static bool IsEqual(const CEntry& entry, const uint64_t* pdigest)
+    {
+        for (int i = 0; i < 4; i++)
+            if (entry.nWords[i].load(boost::memory_order_relaxed) != pdigest[i])
+                return false;
+        return true;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    static bool IsEmpty(const CEntry& entry)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
+        for (int i = 0; i < 4; i++)
+            if (entry.nWords[i].load(boost::memory_order_relaxed) != 0)
+                return false;
+        return true;
+    }
+
+    static void Store(CEntry& entry, const uint64_t* pdigest)
+    {
+        for (int i = 0; i < 4; i++)
+            entry.nWords[i].store(pdigest[i], boost::memory_order_relaxed);
+    }
+
+    static void Load(const CEntry& entry, uint64_t* pdigest)
+    {
+        for (int i = 0; i < 4; i++)
+            pdigest[i] = entry.nWords[i].load(boost::memory_order_relaxed);
+    }
+
+    CBucket& Bucket(const uint64_t* pdigest, int n) const
+    {
+        // the two halves of the digest pick the two candidate buckets
+        uint64_t h = n ? pdigest[1] : pdigest[0];
+        return pbuckets[(uint32_t)(h ^ (h >> 32)) & nBucketMask];
+    }
+
+    void ComputeEntry(const uint256 &hash, const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubKey, uint64_t* pdigest) const
+    {
+        unsigned char nLen = (unsigned char)nSigLen;
+        unsigned char digest[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&nLen, 1).Write(pchSig, nSigLen).Write(pubKey.begin(), pubKey.size()).Finalize(digest);
+        memcpy(pdigest, digest, sizeof(digest));
+        // zero marks an empty slot
+        if (!(pdigest[0] | pdigest[1] | pdigest[2] | pdigest[3]))
+            pdigest[0] = 1;
+    }
+
+public:
+    CSignatureCache() : pchAlloc(NULL), pbuckets(NULL), nBucketMask(0), nKick(0)
+    {
+        nonce = GetRandHash();
+
+        // DoS prevention: the table never grows past -maxsigcachesize entries
+        // (rounded up to a power of two buckets, 32 bytes per entry).
         // Since there are a maximum of 20,000 signature operations per block
         // 50,000 is a reasonable default.
         int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
+        if (nMaxCacheSize <= 0)
+            return;
+        nMaxCacheSize = std::min(nMaxCacheSize, (int64_t)1 << 24);
+
+        uint32_t nBuckets = 1;
+        while ((int64_t)nBuckets * ENTRIES_PER_BUCKET < nMaxCacheSize)
+            nBuckets <<= 1;
 
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
+        // align the table to the cache line, one bucket per line
+        pchAlloc = new unsigned char[nBuckets * sizeof(CBucket) + 64];
+        pbuckets = (CBucket*)(((uintptr_t)pchAlloc + 63) & ~(uintptr_t)63);
+        memset((void*)pbuckets, 0, nBuckets * sizeof(CBucket));
+        nBucketMask = nBuckets - 1;
+    }
+
+    ~CSignatureCache()
+    {
+        delete[] pchAlloc;
+    }
+
+    bool
+    Get(const uint256 &hash, const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubKey) const
+    {
+        if (!pbuckets)
+            return false;
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
+        uint64_t digest[4];
+        ComputeEntry(hash, pchSig, nSigLen, pubKey, digest);
+        for (int n = 0; n < 2; n++)
         {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            const CBucket& bucket = Bucket(digest, n);
+            for (unsigned int i = 0; i < ENTRIES_PER_BUCKET; i++)
+                if (IsEqual(bucket.entries[i], digest))
+                    return true;
         }
+        return false;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void Set(const uint256 &hash, const unsigned char* pchSig, size_t nSigLen, const CPubKey& pubKey)
+    {
+        if (!pbuckets)
+            return;
+
+        uint64_t digest[4];
+        ComputeEntry(hash, pchSig, nSigLen, pubKey, digest);
+
+        boost::unique_lock<boost::mutex> lock(cs_sigcache);
+
+        for (int n = 0; n < 2; n++)
+        {
+            CBucket& bucket = Bucket(digest, n);
+            for (unsigned int i = 0; i < ENTRIES_PER_BUCKET; i++)
+                if (IsEqual(bucket.entries[i], digest))
+                    return;
+        }
+
+        // Place the entry, moving residents to their alternate bucket
+        // until a free slot turns up; whatever is left over is evicted.
+        const CBucket* pbucketFrom = NULL;
+        for (unsigned int nKicks = 0; nKicks <= MAX_KICKS; nKicks++)
+        {
+            for (int n = 0; n < 2; n++)
+            {
+                CBucket& bucket = Bucket(digest, n);
+                for (unsigned int i = 0; i < ENTRIES_PER_BUCKET; i++)
+                {
+                    if (IsEmpty(bucket.entries[i]))
+                    {
+                        Store(bucket.entries[i], digest);
+                        return;
+                    }
+                }
+            }
+
+            // never push an entry back into the bucket it was just kicked from
+            int n = pbucketFrom ? (&Bucket(digest, 0) == pbucketFrom) : (nKick & 1);
+            CBucket& bucket = Bucket(digest, n);
+            CEntry& victim = bucket.entries[nKick++ % ENTRIES_PER_BUCKET];
+
+            uint64_t evicted[4];
+            Load(victim, evicted);
+            Store(victim, digest);
+            memcpy(digest, evicted, sizeof(evicted));
+            pbucketFrom = &bucket;
+        }
     }
 };
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+bool CheckSig(const vector<unsigned char>& vchSigIn, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, CSignatureHasher* phasher)
 {
     static CSignatureCache signatureCache;
 
@@ -2189,24 +2359,26 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
         return false;
 
     // Hash type is one byte tacked on to the end of the signature
-    if (vchSig.empty())
+    if (vchSigIn.empty())
         return false;
     if (nHashType == 0)
-        nHashType = vchSig.back();
-    else if (nHashType != vchSig.back())
+        nHashType = vchSigIn.back();
+    else if (nHashType != vchSigIn.back())
         return false;
-    vchSig.pop_back();
+    const unsigned char* pchSig = &vchSigIn[0];
+    size_t nSigLen = vchSigIn.size() - 1;
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = phasher ? phasher->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    if (signatureCache.Get(sighash, pchSig, nSigLen, pubkey))
         return true;
 
+    vector<unsigned char> vchSig(vchSigIn.begin(), vchSigIn.end() - 1);
     if (!pubkey.Verify(sighash, vchSig))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(sighash, pchSig, nSigLen, pubkey);
 
     return true;
 }
@@ -2695,7 +2867,7 @@ bool SignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn, const vec
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = phasher ? phasher->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -2704,15 +2876,15 @@ bool SignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn, const vec
 }
 
 
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher)
 {
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, phasher))
         return false;
 
     stackCopy = stack;
 
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, phasher))
         return false;
     if (stack.empty())
         return false;
@@ -2730,7 +2902,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, phasher))
             return false;
         if (stackCopy.empty())
             return false;
@@ -2840,7 +3012,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigne
     return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
 }*/
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -2851,7 +3023,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, flags, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, flags, nHashType, phasher);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -14,6 +14,7 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include "hash.h"
 #include "keystore.h"
 #include "bignum.h"
 #include "util.h"
@@ -25,6 +26,7 @@ class CKeyStore;
 class CTransaction;
 
 class BaseSignatureChecker;
+class CSignatureHasher;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
 static const unsigned int MAX_OP_RETURN_RELAY = 40;      // bytes
@@ -97,7 +99,6 @@ enum
 enum
 {
     SCRIPT_VERIFY_NONE      = 0,
-    SCRIPT_VERIFY_NOCACHE   = (1U << 0),
     // Evaluate P2SH subscripts (softfork safe, BIP16).
     SCRIPT_VERIFY_P2SH      = (1U << 0),
 
@@ -134,7 +135,12 @@ enum
     // discouraged NOPs fails the script. This verification flag will never be
     // a mandatory flag applied to scripts in a block. NOPs that are not
     // executed, e.g.  within an unexecuted IF ENDIF block, are *not* rejected.
-    SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS  = (1U << 7)
+    SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS  = (1U << 7),
+
+    // Look signatures up in the signature cache but don't add new ones.
+    // Used for block validation, where the mempool has already filled the
+    // cache for transactions we've seen relayed. Not a script rule.
+    SCRIPT_VERIFY_NOCACHE   = (1U << 31)
 
 };
 
@@ -972,7 +978,7 @@ public:
 
 
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher = NULL);
 bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
@@ -982,10 +988,10 @@ isminetype IsMine(const CKeyStore& keystore, const CTxDestination& dest);
 void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey, std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, CSignatureHasher* phasher = NULL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, CSignatureHasher* phasher = NULL);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher = NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, CSignatureHasher* phasher = NULL);
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, unsigned int flags, const BaseSignatureChecker& checker, ScriptError* error = NULL);
 
@@ -999,6 +1005,34 @@ CScript GetScriptForMultisig(int nRequired, const std::vector<CPubKey>& keys);
 bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey, uint256 hash, int nHashType,
                   CScript& scriptSigRet, txnouttype& whichTypeRet);
 //uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+/** Computes the signature hashes of every input of one transaction.
+ *
+ * The transaction is serialized once with all scriptSigs blanked, and the
+ * SHA-256 state at the start of each input is kept. A SIGHASH_ALL hash then
+ * resumes from the state of its input, adds the input with its scriptCode
+ * and hashes the recorded tail, instead of copying and reserializing the
+ * transaction. Other hash types fall back to SignatureHash().
+ *
+ * Only the scriptSigs of txTo may change while the hasher is in use, which
+ * is what signing does.
+ */
+class CSignatureHasher
+{
+private:
+    const CTransaction& txTo;
+    bool fInitialized;
+    std::vector<char> vchTx;                 // serialized with empty scriptSigs
+    std::vector<unsigned int> vInputEnd;     // offset just past each input in vchTx
+    std::vector<CHashWriter> vMidstate;      // hash state at the start of each input
+
+    void Init();
+
+public:
+    CSignatureHasher(const CTransaction& txToIn) : txTo(txToIn), fInitialized(false) {}
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType);
+};
 
 
 class BaseSignatureChecker
@@ -1017,12 +1051,13 @@ class SignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction& txTo;
     unsigned int nIn;
+    CSignatureHasher* phasher;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    SignatureChecker(const CTransaction& txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    SignatureChecker(const CTransaction& txToIn, unsigned int nInIn, CSignatureHasher* phasherIn = NULL) : txTo(txToIn), nIn(nInIn), phasher(phasherIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
 };
 
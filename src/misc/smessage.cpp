@@ -13,6 +13,12 @@ Notes:
         -smsgscanchain      Scan the block chain for public key addresses on startup
 
 
+    Message Store
+        Relayed messages are stored in smsgDB keyed by (bucket, timestamp, sample), see SecMsgDB::WriteBucketMsg
+        Buckets older than SMSG_RETENTION are removed with a single range erase, SecMsgDB::EraseBuckets
+        Bucket files from older versions (smsgStore/<bucket>_01.dat) are imported into smsgDB on startup
+
+
     Wallet Locked
         A copy of each incoming message is stored in bucket files ending in _wl.dat
         wl (wallet locked) bucket files are deleted if they expire, like normal buckets
@@ -57,6 +63,7 @@ Notes:
 #include "txdb.h"
 #include "sync.h"
 #include "ecwrapper.h"
+#include "crypto/common.h"
 
 #include "lz4/lz4.c"
 
@@ -170,19 +177,46 @@ void SecMsgBucket::hashBucket()
     
     std::set<SecMsgToken>::iterator it;
     
-    void* state = XXH32_init(1);
+    XXH32_resetState(&hashState, 1);
     
     for (it = setTokens.begin(); it != setTokens.end(); ++it)
     {
-        XXH32_update(state, it->sample, 8);
+        XXH32_update(&hashState, it->sample, 8);
     };
     
-    hash = XXH32_digest(state);
+    hash = XXH32_intermediateDigest(&hashState);
+    fHashDirty = false;
     
     if (fDebugSmsg)
         LogPrint("smessage", "Hashed %u messages, hash %u\n", setTokens.size(), hash);
 };
 
+bool SecMsgBucket::addToken(const SecMsgToken& token)
+{
+    /*
+        Tokens mostly arrive in timestamp order, when the new token sorts last
+        the running hash state is extended instead of rehashing the whole set.
+        Out of order inserts mark the hash dirty, it's rebuilt on next getHash().
+    */
+    bool fAppend = setTokens.empty() || *setTokens.rbegin() < token;
+
+    if (!setTokens.insert(token).second)
+        return false;
+
+    timeChanged = GetTime();
+
+    if (fAppend && !fHashDirty)
+    {
+        XXH32_update(&hashState, token.sample, 8);
+        hash = XXH32_intermediateDigest(&hashState);
+    } else
+    {
+        fHashDirty = true;
+    };
+
+    return true;
+};
+
 
 bool SecMsgDB::Open(const char* pszMode)
 {
@@ -575,6 +609,163 @@ bool SecMsgDB::EraseSmesg(uint8_t* chKey)
     return false;
 };
 
+/*
+    Relayed messages are kept in smsgDB under two key ranges, both ordered by
+    (bucket, timestamp, sample) with big endian integers so that leveldb key order
+    matches bucket and token order:
+        bi + bucket + timestamp + sample    -> (empty)          token index, scanned at startup
+        bm + bucket + timestamp + sample    -> header + payload
+*/
+static const size_t SMSG_BKT_KEY_LEN = 2 + 8 + 8 + 8;
+
+static void SecMsgBucketKey(const char* pPrefix, int64_t bucket, const SecMsgToken& token, uint8_t* chKey)
+{
+    memcpy(&chKey[0], pPrefix, 2);
+    WriteBE64(&chKey[2], (uint64_t)bucket);
+    WriteBE64(&chKey[10], (uint64_t)token.timestamp);
+    memcpy(&chKey[18], token.sample, 8);
+};
+
+bool SecMsgDB::NextBucketToken(leveldb::Iterator* it, int64_t& bucket, SecMsgToken& token)
+{
+    if (!pdb)
+        return false;
+
+    if (!it->Valid()) // first run
+        it->Seek(std::string("bi"));
+    else
+        it->Next();
+
+    if (!(it->Valid()
+        && it->key().size() == SMSG_BKT_KEY_LEN
+        && memcmp(it->key().data(), "bi", 2) == 0))
+        return false;
+
+    const uint8_t* p = (const uint8_t*)it->key().data();
+    bucket = (int64_t)ReadBE64(&p[2]);
+    token.timestamp = (int64_t)ReadBE64(&p[10]);
+    memcpy(token.sample, &p[18], 8);
+
+    return true;
+};
+
+bool SecMsgDB::ReadBucketMsg(int64_t bucket, const SecMsgToken& token, std::vector<uint8_t>& vchData)
+{
+    if (!pdb)
+        return false;
+
+    uint8_t chKey[SMSG_BKT_KEY_LEN];
+    SecMsgBucketKey("bm", bucket, token, chKey);
+
+    std::string strValue;
+    leveldb::Status s = pdb->Get(leveldb::ReadOptions(), leveldb::Slice((const char*)chKey, SMSG_BKT_KEY_LEN), &strValue);
+    if (!s.ok())
+    {
+        if (!s.IsNotFound())
+            LogPrint("smessage", "LevelDB read failure: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    if (strValue.size() < SMSG_HDR_LEN)
+    {
+        LogPrint("smessage", "SecMsgDB::ReadBucketMsg() short record %u.\n", strValue.size());
+        return false;
+    };
+
+    vchData.assign(strValue.begin(), strValue.end());
+    return true;
+};
+
+bool SecMsgDB::WriteBucketMsg(int64_t bucket, const SecMsgToken& token, uint8_t* pHeader, uint8_t* pPayload, uint32_t nPayload)
+{
+    if (!pdb)
+        return false;
+
+    uint8_t chKey[SMSG_BKT_KEY_LEN];
+    std::string strValue;
+    strValue.reserve(SMSG_HDR_LEN + nPayload);
+    strValue.append((const char*)pHeader, SMSG_HDR_LEN);
+    strValue.append((const char*)pPayload, nPayload);
+
+    leveldb::WriteBatch batch;
+    SecMsgBucketKey("bm", bucket, token, chKey);
+    batch.Put(leveldb::Slice((const char*)chKey, SMSG_BKT_KEY_LEN), strValue);
+    SecMsgBucketKey("bi", bucket, token, chKey);
+    batch.Put(leveldb::Slice((const char*)chKey, SMSG_BKT_KEY_LEN), leveldb::Slice());
+
+    // -- relayed messages can be fetched from peers again, no need to sync
+    leveldb::Status s = pdb->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok())
+    {
+        LogPrint("smessage", "SecMsgDB write failed: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    return true;
+};
+
+bool SecMsgDB::EraseBuckets(int64_t cutoffTime)
+{
+    /*
+        Erase all buckets older than cutoffTime, bucket is the leading key
+        component so expired buckets form a contiguous range in both prefixes.
+    */
+    if (!pdb)
+        return false;
+
+    uint32_t nErased = 0;
+    leveldb::WriteBatch batch;
+    const char* aPrefix[] = {"bi", "bm"};
+
+    for (int i = 0; i < 2; ++i)
+    {
+        uint8_t chEnd[10];
+        memcpy(&chEnd[0], aPrefix[i], 2);
+        WriteBE64(&chEnd[2], (uint64_t)cutoffTime);
+        leveldb::Slice sliceEnd((const char*)chEnd, sizeof(chEnd));
+
+        leveldb::Iterator* it = pdb->NewIterator(leveldb::ReadOptions());
+        for (it->Seek(std::string(aPrefix[i])); it->Valid() && it->key().compare(sliceEnd) < 0; it->Next())
+        {
+            batch.Delete(it->key());
+            nErased++;
+        };
+        delete it;
+    };
+
+    if (nErased == 0)
+        return true;
+
+    leveldb::Status s = pdb->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok())
+    {
+        LogPrint("smessage", "SecMsgDB erase buckets failed: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    if (fDebugSmsg)
+        LogPrint("smessage", "Erased %u bucket records older than %d.\n", nErased, cutoffTime);
+
+    return true;
+};
+
+uint64_t SecMsgDB::BucketSize(int64_t bucket)
+{
+    if (!pdb)
+        return 0;
+
+    uint8_t chStart[10], chEnd[10];
+    memcpy(&chStart[0], "bm", 2);
+    WriteBE64(&chStart[2], (uint64_t)bucket);
+    memcpy(&chEnd[0], "bm", 2);
+    WriteBE64(&chEnd[2], (uint64_t)bucket + 1);
+
+    leveldb::Range range(leveldb::Slice((const char*)chStart, sizeof(chStart)), leveldb::Slice((const char*)chEnd, sizeof(chEnd)));
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+};
+
 void ThreadSecureMsg()
 {
     // -- bucket management thread
@@ -595,7 +786,8 @@ void ThreadSecureMsg()
         {
             LOCK(cs_smsg);
             
-            for (std::map<int64_t, SecMsgBucket>::iterator it(smsgBuckets.begin()); it != smsgBuckets.end(); it++)
+            bool fExpired = false;
+            for (std::map<int64_t, SecMsgBucket>::iterator it(smsgBuckets.begin()); it != smsgBuckets.end(); )
             {
                 //if (fDebugSmsg)
                 //    LogPrint("smessage", "Checking bucket %d", size %u \n", it->first, it->second.setTokens.size());
@@ -606,21 +798,8 @@ void ThreadSecureMsg()
 
                     std::string fileName = boost::lexical_cast<std::string>(it->first);
 
-                    fs::path fullPath = GetDataDir() / "smsgStore" / (fileName + "_01.dat");
-                    if (fs::exists(fullPath))
-                    {
-                        try { fs::remove(fullPath);
-                        } catch (const fs::filesystem_error& ex)
-                        {
-                            LogPrint("smessage", "Error removing bucket file %s.\n", ex.what());
-                        };
-                    } else
-                    {
-                        LogPrint("smessage", "Path %s does not exist \n", fullPath.string().c_str());
-                    };
-                    
                     // -- look for a wl file, it stores incoming messages when wallet is locked
-                    fullPath = GetDataDir() / "smsgStore" / (fileName + "_01_wl.dat");
+                    fs::path fullPath = GetDataDir() / "smsgStore" / (fileName + "_01_wl.dat");
                     if (fs::exists(fullPath))
                     {
                         try { fs::remove(fullPath);
@@ -630,7 +809,9 @@ void ThreadSecureMsg()
                         };
                     };
 
-                    smsgBuckets.erase(it);
+                    smsgBuckets.erase(it++);
+                    fExpired = true;
+                    continue;
                 } else
                 if (it->second.nLockCount > 0) // -- tick down nLockCount, so will eventually expire if peer never sends data
                 {
@@ -644,6 +825,15 @@ void ThreadSecureMsg()
                     }; // if (it->second.nLockCount == 0)
                     
                 }; // ! if (it->first < cutoffTime)
+                ++it;
+            };
+
+            if (fExpired)
+            {
+                SecMsgDB dbStore;
+                LOCK(cs_smsgDB);
+                if (dbStore.Open("cr+"))
+                    dbStore.EraseBuckets(cutoffTime);
             };
         } // cs_smsg
         
@@ -764,17 +954,13 @@ void ThreadSecureMsgPow()
     };
 };
 
-int SecureMsgBuildBucketSet()
+static int SecureMsgImportBucketFiles()
 {
     /*
-        Build the bucket set by scanning the files in the smsgStore dir.
-
-        smsgBuckets should be empty
+        Move messages from the bucket files used by older versions into smsgDB.
+        Wallet locked (_wl.dat) files are left in place.
     */
 
-    if (fDebugSmsg)
-        LogPrint("smessage", "SecureMsgBuildBucketSet()\n");
-
     int64_t  now            = GetTime();
     uint32_t nFiles         = 0;
     uint32_t nMessages      = 0;
@@ -782,71 +968,43 @@ int SecureMsgBuildBucketSet()
     fs::path pathSmsgDir = GetDataDir() / "smsgStore";
     fs::directory_iterator itend;
 
-
     if (!fs::exists(pathSmsgDir)
         || !fs::is_directory(pathSmsgDir))
-    {
-        LogPrint("smessage", "Message store directory does not exist.\n");
         return 0; // not an error
-    }
 
+    SecMsgDB dbStore;
+    LOCK(cs_smsgDB);
+    if (!dbStore.Open("cr+"))
+        return errorN(1, "%s: could not open smsgDB.", __func__);
+
+    SecureMessage smsg;
+    std::vector<uint8_t> vchPayload;
 
     for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
     {
         if (!fs::is_regular_file(itd->status()))
             continue;
 
-        std::string fileType = (*itd).path().extension().string();
-
-        if (fileType.compare(".dat") != 0)
-            continue;
-
         std::string fileName = (*itd).path().filename().string();
 
+        if (!boost::algorithm::ends_with(fileName, "_01.dat"))
+            continue;
 
-        if (fDebugSmsg)
-            LogPrint("smessage", "Processing file: %s.\n", fileName.c_str());
-
-        nFiles++;
-
-        // TODO files must be split if > 2GB
         // time_noFile.dat
         size_t sep = fileName.find_first_of("_");
         if (sep == std::string::npos)
             continue;
 
-        std::string stime = fileName.substr(0, sep);
-
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
+        int64_t fileTime = boost::lexical_cast<int64_t>(fileName.substr(0, sep));
 
-        if (fileTime < now - SMSG_RETENTION)
-        {
-            LogPrint("smessage", "Dropping file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            } catch (const fs::filesystem_error& ex)
-            {
-                LogPrint("smessage", "Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
-            };
-            continue;
-        };
-
-        if (boost::algorithm::ends_with(fileName, "_wl.dat"))
-        {
-            if (fDebugSmsg)
-                LogPrint("smessage", "Skipping wallet locked file: %s.\n", fileName.c_str());
-            continue;
-        };
+        nFiles++;
 
-        size_t nTokenSetSize = 0;
-        SecureMessage smsg;
+        // Expired buckets are dropped unread, live ones only once fully imported
+        bool fOk = true;
+        if (fileTime >= now - SMSG_RETENTION)
         {
-            LOCK(cs_smsg);
-            
-            std::set<SecMsgToken>& tokenSet = smsgBuckets[fileTime].setTokens;
-            
             FILE *fp;
-
+            errno = 0;
             if (!(fp = fopen((*itd).path().string().c_str(), "rb")))
             {
                 LogPrint("smessage", "Error opening file: %s\n", strerror(errno));
@@ -855,54 +1013,103 @@ int SecureMsgBuildBucketSet()
 
             for (;;)
             {
-                long int ofs = ftell(fp);
-                SecMsgToken token;
-                token.offset = ofs;
-                errno = 0;
-                if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
+                size_t nRead = fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp);
+                if (nRead != (size_t)SMSG_HDR_LEN)
                 {
-                    if (errno != 0)
-                    {
-                        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-                    } else
-                    {
-                        //LogPrint("smessage", "End of file.\n");
-                    };
+                    // Anything but a clean end between records is a damaged file
+                    fOk = nRead == 0 && feof(fp);
                     break;
                 };
-                token.timestamp = smsg.timestamp;
 
-                if (smsg.nPayload < 8)
-                    continue;
-
-                if (fread(token.sample, sizeof(uint8_t), 8, fp) != 8)
+                try { vchPayload.resize(smsg.nPayload); } catch (std::exception& e)
                 {
-                    LogPrint("smessage", "fread data failed: %s\n", strerror(errno));
+                    LogPrint("smessage", "%s: Could not resize vchPayload, %u, %s\n", __func__, smsg.nPayload, e.what());
+                    fOk = false;
                     break;
                 };
 
-                if (fseek(fp, smsg.nPayload-8, SEEK_CUR) != 0)
+                if (smsg.nPayload < 8
+                    || fread(&vchPayload[0], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
                 {
-                    LogPrint("smessage", "fseek, strerror: %s.\n", strerror(errno));
+                    fOk = false;
                     break;
                 };
 
-                tokenSet.insert(token);
+                SecMsgToken token(smsg.timestamp, &vchPayload[0], smsg.nPayload);
+                if (!dbStore.WriteBucketMsg(fileTime, token, &smsg.hash[0], &vchPayload[0], smsg.nPayload))
+                {
+                    fOk = false;
+                    break;
+                };
+                nMessages++;
             };
 
             fclose(fp);
-            
-            smsgBuckets[fileTime].hashBucket();
-            
-            nTokenSetSize = tokenSet.size();
-        } // LOCK(cs_smsg);
-        
-        nMessages += nTokenSetSize;
-        if (fDebugSmsg)
-            LogPrint("smessage", "Bucket %d contains %u messages.\n", fileTime, nTokenSetSize);
+        };
+
+        if (!fOk)
+        {
+            LogPrint("smessage", "Could not fully import bucket file %s, keeping it.\n", fileName.c_str());
+            continue;
+        };
+
+        try {
+            fs::remove((*itd).path());
+        } catch (const fs::filesystem_error& ex)
+        {
+            LogPrint("smessage", "Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
+        };
     };
 
-    LogPrint("smessage", "Processed %u files, loaded %u buckets containing %u messages.\n", nFiles, smsgBuckets.size(), nMessages);
+    if (nFiles > 0)
+        LogPrint("smessage", "Imported %u messages from %u bucket files.\n", nMessages, nFiles);
+
+    return 0;
+};
+
+int SecureMsgBuildBucketSet()
+{
+    /*
+        Build the bucket set from the token index in smsgDB.
+
+        smsgBuckets should be empty
+    */
+
+    if (fDebugSmsg)
+        LogPrint("smessage", "SecureMsgBuildBucketSet()\n");
+
+    int64_t  mStart         = GetTimeMillis();
+    int64_t  now            = GetTime();
+    uint32_t nMessages      = 0;
+
+    if (SecureMsgImportBucketFiles() != 0)
+        LogPrint("smessage", "Failed to import bucket files.\n");
+
+    {
+        LOCK2(cs_smsg, cs_smsgDB);
+
+        SecMsgDB dbStore;
+        if (!dbStore.Open("cr+"))
+        {
+            LogPrint("smessage", "SecureMsgBuildBucketSet(): could not open smsgDB.\n");
+            return 1;
+        };
+
+        dbStore.EraseBuckets(now - SMSG_RETENTION);
+
+        // -- index is ordered by bucket then token, each token extends the running bucket hash
+        int64_t bucket;
+        SecMsgToken token;
+        leveldb::Iterator* it = dbStore.pdb->NewIterator(leveldb::ReadOptions());
+        while (dbStore.NextBucketToken(it, bucket, token))
+        {
+            smsgBuckets[bucket].addToken(token);
+            nMessages++;
+        };
+        delete it;
+    } // cs_smsg, cs_smsgDB
+
+    LogPrint("smessage", "Loaded %u buckets containing %u messages in %d ms.\n", smsgBuckets.size(), nMessages, GetTimeMillis() - mStart);
 
     return 0;
 };
@@ -1392,7 +1599,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
             if (fDebugSmsg)
             {
                 LogPrint("smessage", "peer bucket %d %u %u.\n", time, ncontent, hash);
-                LogPrint("smessage", "this bucket %d %u %u.\n", time, smsgBuckets[time].setTokens.size(), smsgBuckets[time].hash);
+                LogPrint("smessage", "this bucket %d %u %u.\n", time, smsgBuckets[time].setTokens.size(), smsgBuckets[time].getHash());
             };
             {
             LOCK(cs_smsg);
@@ -1408,7 +1615,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                 //    if then peer node has more this node will pull fom peer
                 if (smsgBuckets[time].setTokens.size() < ncontent
                     || (smsgBuckets[time].setTokens.size() == ncontent
-                        && smsgBuckets[time].hash != hash)) // if same amount in buckets check hash
+                        && smsgBuckets[time].getHash() != hash)) // if same amount in buckets check hash
                 {
                     if (fDebugSmsg)
                         LogPrint("smessage", "Requesting contents of bucket %d.\n", time);
@@ -1638,8 +1845,6 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                         LogPrint("smessage", "Don't have wanted message %d.\n", token.timestamp);
                 } else
                 {
-                    //LogPrint("smessage", "Have message at %d.\n", it->offset); // DEBUG
-                    token.offset = it->offset;
                     //LogPrint("smessage", "winb before SecureMsgRetrieve %d.\n", token.timestamp);
 
                     // -- place in vchOne so if SecureMsgRetrieve fails it won't corrupt vchBunch
@@ -1847,7 +2052,7 @@ bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
                     continue;
 
 
-                uint32_t hash = bkt.hash;
+                uint32_t hash = bkt.getHash();
 
                 try { vchData.resize(vchData.size() + 16); } catch (std::exception& e)
                 {
@@ -2159,138 +2364,55 @@ bool SecureMsgScanBuckets()
         return false;
 
     int64_t  mStart         = GetTimeMillis();
-    int64_t  now            = GetTime();
-    uint32_t nFiles         = 0;
     uint32_t nMessages      = 0;
     uint32_t nFoundMessages = 0;
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-    fs::directory_iterator itend;
-
-    if (!fs::exists(pathSmsgDir)
-        || !fs::is_directory(pathSmsgDir))
-    {
-        LogPrint("smessage", "Message store directory does not exist.\n");
-        return 0; // not an error
-    };
-
-    SecureMessage smsg;
     std::vector<uint8_t> vchData;
 
-    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
     {
-        if (!fs::is_regular_file(itd->status()))
-            continue;
-
-        std::string fileType = (*itd).path().extension().string();
-
-        if (fileType.compare(".dat") != 0)
-            continue;
-
-        std::string fileName = (*itd).path().filename().string();
-
-
-        if (fDebugSmsg)
-            LogPrint("smessage", "Processing file: %s.\n", fileName.c_str());
+        LOCK2(cs_smsg, cs_smsgDB);
 
-        nFiles++;
-
-        // TODO files must be split if > 2GB
-        // time_noFile.dat
-        size_t sep = fileName.find_first_of("_");
-        if (sep == std::string::npos)
-            continue;
-
-        std::string stime = fileName.substr(0, sep);
-
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
-
-        if (fileTime < now - SMSG_RETENTION)
+        SecMsgDB dbStore;
+        if (!dbStore.Open("cr+"))
         {
-            LogPrint("smessage", "Dropping file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            } catch (const fs::filesystem_error& ex)
-            {
-                LogPrint("smessage", "Error removing bucket file %s, %s.\n", fileName.c_str(), ex.what());
-            };
-            continue;
+            LogPrint("smessage", "SecureMsgScanBuckets(): could not open smsgDB.\n");
+            return false;
         };
 
-        if (boost::algorithm::ends_with(fileName, "_wl.dat"))
+        leveldb::Iterator* it = dbStore.pdb->NewIterator(leveldb::ReadOptions());
+        for (it->Seek(std::string("bm")); it->Valid(); it->Next())
         {
-            if (fDebugSmsg)
-                LogPrint("smessage", "Skipping wallet locked file: %s.\n", fileName.c_str());
-            continue;
-        };
+            if (it->key().size() < 2
+                || memcmp(it->key().data(), "bm", 2) != 0)
+                break;
 
-        {
-            LOCK(cs_smsg);
-            FILE *fp;
-            errno = 0;
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb")))
-            {
-                LogPrint("smessage", "Error opening file: %s\n", strerror(errno));
+            if (it->value().size() < SMSG_HDR_LEN)
                 continue;
-            };
 
-            for (;;)
-            {
-                errno = 0;
-                if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
-                {
-                    if (errno != 0)
-                    {
-                        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-                    } else
-                    {
-                        //LogPrint("smessage", "End of file.\n");
-                    };
-                    break;
-                };
-
-                try { vchData.resize(smsg.nPayload); } catch (std::exception& e)
-                {
-                    LogPrint("smessage", "SecureMsgWalletUnlocked(): Could not resize vchData, %u, %s\n", smsg.nPayload, e.what());
-                    fclose(fp);
-                    return 1;
-                };
-
-                if (fread(&vchData[0], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
-                {
-                    LogPrint("smessage", "fread data failed: %s\n", strerror(errno));
-                    break;
-                };
-
-                // -- don't report to gui,
-                int rv = SecureMsgScanMessage(&smsg.hash[0], &vchData[0], smsg.nPayload, false);
-
-                if (rv == 0)
-                {
-                    nFoundMessages++;
-                } else
-                if (rv != 0)
-                {
-                    // SecureMsgScanMessage failed
-                };
-
-                nMessages ++;
-            };
+            vchData.assign(it->value().data(), it->value().data() + it->value().size());
+            uint8_t* pHeader = &vchData[0];
+            SecureMessage* psmsg = (SecureMessage*) pHeader;
+            if (vchData.size() != SMSG_HDR_LEN + psmsg->nPayload)
+                continue;
 
-            fclose(fp);
+            // -- don't report to gui,
+            int rv = SecureMsgScanMessage(pHeader, pHeader + SMSG_HDR_LEN, psmsg->nPayload, false);
 
-            // -- remove wl file when scanned
-            try {
-                fs::remove((*itd).path());
-            } catch (const boost::filesystem::filesystem_error& ex)
+            if (rv == 0)
             {
-                LogPrint("smessage", "Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
-                return 1;
+                nFoundMessages++;
+            } else
+            if (rv != 0)
+            {
+                // SecureMsgScanMessage failed
             };
-        } // cs_smsg
-    };
 
-    LogPrint("smessage", "Processed %u files, scanned %u messages, received %u messages.\n", nFiles, nMessages, nFoundMessages);
+            nMessages ++;
+        };
+        delete it;
+    } // cs_smsg, cs_smsgDB
+
+    LogPrint("smessage", "Scanned %u messages, received %u messages.\n", nMessages, nFoundMessages);
     LogPrint("smessage", "Took %d ms\n", GetTimeMillis() - mStart);
 
     return true;
@@ -2734,61 +2856,26 @@ int SecureMsgRetrieve(SecMsgToken &token, std::vector<uint8_t>& vchData)
 
     // -- has cs_smsg lock from SecureMsgReceiveData
 
-    fs::path pathSmsgDir = GetDataDir() / "smsgStore";
-
-    //LogPrint("smessage", "token.offset %d.\n", token.offset); // DEBUG
     int64_t bucket = token.timestamp - (token.timestamp % SMSG_BUCKET_LEN);
-    std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
 
-    //LogPrint("smessage", "bucket %d.\n", bucket);
-    //LogPrint("smessage", "bucket d %d.\n", bucket);
-    //LogPrint("smessage", "fileName %s.\n", fileName.c_str());
+    SecMsgDB dbStore;
+    LOCK(cs_smsgDB);
+    if (!dbStore.Open("cr+"))
+        return errorN(1, "%s: could not open smsgDB.", __func__);
 
-    FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "rb")))
+    if (!dbStore.ReadBucketMsg(bucket, token, vchData))
     {
-        LogPrint("smessage", "Error opening file: %s\nPath %s\n", strerror(errno), fullpath.string().c_str());
+        LogPrint("smessage", "SecureMsgRetrieve(): message %d not found in bucket %d.\n", token.timestamp, bucket);
         return 1;
     };
 
-    errno = 0;
-    if (fseek(fp, token.offset, SEEK_SET) != 0)
+    SecureMessage* psmsg = (SecureMessage*) &vchData[0];
+    if (vchData.size() != SMSG_HDR_LEN + psmsg->nPayload)
     {
-        LogPrint("smessage", "fseek, strerror: %s.\n", strerror(errno));
-        fclose(fp);
+        LogPrint("smessage", "SecureMsgRetrieve(): bad record size %u, payload %u.\n", vchData.size(), psmsg->nPayload);
         return 1;
     };
 
-    SecureMessage smsg;
-    errno = 0;
-    if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
-    {
-        LogPrint("smessage", "fread header failed: %s\n", strerror(errno));
-        fclose(fp);
-        return 1;
-    };
-
-    try {
-        vchData.resize(SMSG_HDR_LEN + smsg.nPayload);
-    } catch (std::exception& e) {
-        LogPrint("smessage", "SecureMsgRetrieve(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + smsg.nPayload, e.what());
-        return 1;
-    };
-
-    memcpy(&vchData[0], &smsg.hash[0], SMSG_HDR_LEN);
-    errno = 0;
-    if (fread(&vchData[SMSG_HDR_LEN], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
-    {
-        LogPrint("smessage", "fread data failed: %s. Wanted %u bytes.\n", strerror(errno), smsg.nPayload);
-        fclose(fp);
-        return 1;
-    };
-
-
-    fclose(fp);
-
     return 0;
 };
 
@@ -2902,7 +2989,7 @@ int SecureMsgReceive(CNode* pfrom, std::vector<uint8_t>& vchData)
 
         itb->second.nLockCount  = 0; // this node has received data from peer, release lock
         itb->second.nLockPeerId = 0;
-        itb->second.hashBucket();
+        itb->second.getHash();
     } // cs_smsg
     return 0;
 };
@@ -2992,16 +3079,6 @@ int SecureMsgStore(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, bool
     SecureMessage* psmsg = (SecureMessage*) pHeader;
 
 
-    long int ofs;
-    fs::path pathSmsgDir;
-    try {
-        pathSmsgDir = GetDataDir() / "smsgStore";
-        fs::create_directory(pathSmsgDir);
-    } catch (const boost::filesystem::filesystem_error& ex)
-    {
-        return errorN(1, "Failed to create directory %s - %s.", pathSmsgDir.string().c_str(), ex.what());
-    };
-
     int64_t now = GetTime();
     if (psmsg->timestamp > now + SMSG_TIME_LEEWAY)
     {
@@ -3016,9 +3093,10 @@ int SecureMsgStore(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, bool
 
     int64_t bucket = psmsg->timestamp - (psmsg->timestamp % SMSG_BUCKET_LEN);
 
-    SecMsgToken token(psmsg->timestamp, pPayload, nPayload, 0);
+    SecMsgToken token(psmsg->timestamp, pPayload, nPayload);
 
-    std::set<SecMsgToken>& tokenSet = smsgBuckets[bucket].setTokens;
+    SecMsgBucket& bkt = smsgBuckets[bucket];
+    std::set<SecMsgToken>& tokenSet = bkt.setTokens;
     std::set<SecMsgToken>::iterator it;
     it = tokenSet.find(token);
     if (it != tokenSet.end())
@@ -3048,42 +3126,21 @@ int SecureMsgStore(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, bool
         return 1;
     };
 
-    std::string fileName = boost::lexical_cast<std::string>(bucket) + "_01.dat";
-    fs::path fullpath = pathSmsgDir / fileName;
-
-    FILE *fp;
-    errno = 0;
-    if (!(fp = fopen(fullpath.string().c_str(), "ab")))
-    {
-        return errorN(1, "fopen failed: %s.", strerror(errno));
-    };
-
-    // -- on windows ftell will always return 0 after fopen(ab), call fseek to set.
-    errno = 0;
-    if (fseek(fp, 0, SEEK_END) != 0)
-    {
-        return errorN(1, "fseek failed: %s.", strerror(errno));
-    };
-
-
-    ofs = ftell(fp);
-
-    if (fwrite(pHeader, sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN
-        || fwrite(pPayload, sizeof(uint8_t), nPayload, fp) != nPayload)
     {
-        fclose(fp);
-        return errorN(1, "fwrite failed: %s.", strerror(errno));
-    };
-
-    fclose(fp);
+        SecMsgDB dbStore;
+        LOCK(cs_smsgDB);
+        if (!dbStore.Open("cr+"))
+            return errorN(1, "Could not open smsgDB.");
 
-    token.offset = ofs;
+        if (!dbStore.WriteBucketMsg(bucket, token, pHeader, pPayload, nPayload))
+            return errorN(1, "Could not write message to smsgDB.");
+    }
 
-    //LogPrint("smessage", "token.offset: %d\n", token.offset); // DEBUG
-    tokenSet.insert(token);
+    bkt.addToken(token);
 
+    // -- the hash is extended in place for in order tokens, otherwise rebuilt here or on next use
     if (fUpdateBucket)
-        smsgBuckets[bucket].hashBucket();
+        bkt.getHash();
 
     if (fDebugSmsg)
         LogPrint("smessage", "SecureMsg added to bucket %d.\n", bucket);
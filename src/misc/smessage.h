@@ -13,6 +13,7 @@
 #include "wallet/wallet.h"
 #include "base58.h"
 #include "lz4/lz4.h"
+#include "xxhash/xxhash.h"
 
 
 const unsigned int SMSG_HDR_LEN         = 104;               // length of unencrypted header, 4 + 2 + 1 + 8 + 16 + 33 + 32 + 4 +4
@@ -112,7 +113,7 @@ public:
 class SecMsgToken
 {
 public:
-    SecMsgToken(int64_t ts, uint8_t* p, int np, long int o)
+    SecMsgToken(int64_t ts, uint8_t* p, int np)
     {
         timestamp = ts;
 
@@ -120,7 +121,6 @@ public:
             memset(sample, 0, 8);
         else
             memcpy(sample, p, 8);
-        offset = o;
     };
 
     SecMsgToken() {};
@@ -137,7 +137,6 @@ public:
 
     int64_t               timestamp;    // doesn't need to be full 64 bytes?
     uint8_t               sample[8];    // first 8 bytes of payload - a hash
-    int64_t               offset;       // offset
 
 };
 
@@ -148,20 +147,34 @@ public:
     SecMsgBucket()
     {
         timeChanged     = 0;
-        hash            = 0;
         nLockCount      = 0;
         nLockPeerId     = 0;
+        fHashDirty      = false;
+        XXH32_resetState(&hashState, 1);
+        hash            = XXH32_intermediateDigest(&hashState);
     };
     ~SecMsgBucket() {};
 
     void hashBucket();
+    bool addToken(const SecMsgToken& token);
+
+    uint32_t getHash()
+    {
+        if (fHashDirty)
+            hashBucket();
+        return hash;
+    };
 
     int64_t                     timeChanged;
-    uint32_t                    hash;           // token set should get ordered the same on each node
     uint32_t                    nLockCount;     // set when smsgWant first sent, unset at end of smsgMsg, ticks down in ThreadSecureMsg()
     NodeId                      nLockPeerId;    // id of peer that bucket is locked for
     std::set<SecMsgToken>       setTokens;
 
+private:
+    uint32_t                    hash;           // token set should get ordered the same on each node
+    bool                        fHashDirty;     // a token was inserted out of order, hashState must be rebuilt
+    XXH32_stateSpace_t          hashState;      // running hash over the samples of setTokens, in order
+
 };
 
 
@@ -320,6 +333,12 @@ public:
     bool ExistsSmesg(uint8_t* chKey);
     bool EraseSmesg(uint8_t* chKey);
 
+    bool NextBucketToken(leveldb::Iterator* it, int64_t& bucket, SecMsgToken& token);
+    bool ReadBucketMsg(int64_t bucket, const SecMsgToken& token, std::vector<uint8_t>& vchData);
+    bool WriteBucketMsg(int64_t bucket, const SecMsgToken& token, uint8_t* pHeader, uint8_t* pPayload, uint32_t nPayload);
+    bool EraseBuckets(int64_t cutoffTime);
+    uint64_t BucketSize(int64_t bucket);
+
     leveldb::DB *pdb;       // points to the global instance
     leveldb::WriteBatch *activeBatch;
 
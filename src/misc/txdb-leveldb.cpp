@@ -5,6 +5,7 @@
 
 #include <map>
 
+#include <boost/atomic.hpp>
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -26,11 +27,110 @@ using namespace boost;
 
 leveldb::DB *txdb; // global pointer for LevelDB object instance
 
-static leveldb::Options GetOptions() {
+// Block cache that counts lookups, so gettxdbinfo can report a hit rate.
+// LevelDB looks up every data block it reads here, a miss then reads the
+// block from the table file (possibly from the OS page cache). Index and
+// filter blocks stay with the open tables and are not counted.
+class CCountingCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* pcache;
+
+public:
+    boost::atomic<uint64_t> nHits;
+    boost::atomic<uint64_t> nMisses;
+
+    CCountingCache(size_t nCapacity) : pcache(leveldb::NewLRUCache(nCapacity)), nHits(0), nMisses(0) {}
+    ~CCountingCache() { delete pcache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        return pcache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key)
+    {
+        // called from every thread reading the database
+        Handle* handle = pcache->Lookup(key);
+        if (handle)
+            nHits.fetch_add(1, boost::memory_order_relaxed);
+        else
+            nMisses.fetch_add(1, boost::memory_order_relaxed);
+        return handle;
+    }
+
+    void Release(Handle* handle) { pcache->Release(handle); }
+    void* Value(Handle* handle) { return pcache->Value(handle); }
+    void Erase(const leveldb::Slice& key) { pcache->Erase(key); }
+    uint64_t NewId() { return pcache->NewId(); }
+};
+
+static CCountingCache* pTxDBCache = NULL;
+static CTxDBProfile txdbProfile;
+
+static int64_t GetPhysicalMemory()
+{
+#ifdef WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return status.ullTotalPhys;
+    return 0;
+#else
+    long nPages = sysconf(_SC_PHYS_PAGES);
+    long nPageSize = sysconf(_SC_PAGE_SIZE);
+    if (nPages <= 0 || nPageSize <= 0)
+        return 0;
+    return (int64_t)nPages * nPageSize;
+#endif
+}
+
+// Storage profile for the tx/addr index. Unless overridden, the block cache
+// gets 1/64 of physical memory. While the index is being built (new
+// database or -reindexaddr) the write buffer is larger and more tables
+// are kept open, which cuts the number of level-0 compactions at the cost
+// of memory that is not needed once the index only grows block by block.
+static CTxDBProfile MakeProfile(bool fBuild)
+{
+    CTxDBProfile profile;
+    profile.fBuild = fBuild;
+
+    int64_t nMemory = GetPhysicalMemory();
+    int64_t nCacheSize = nMemory / 64;
+    if (mapArgs.count("-txdbcache"))
+        nCacheSize = GetArg("-txdbcache", 0) << 20;
+    else if (mapArgs.count("-dbcache"))
+        nCacheSize = GetArg("-dbcache", 0) << 20;
+    profile.nCacheSize = std::max((int64_t)MIN_TXDB_CACHE << 20, std::min((int64_t)MAX_TXDB_CACHE << 20, nCacheSize));
+
+    if (fBuild)
+    {
+        profile.nWriteBufferSize = 64 << 20;
+        profile.nMaxOpenFiles = 512;
+    }
+    else
+    {
+        profile.nWriteBufferSize = 8 << 20;
+        profile.nMaxOpenFiles = 128;
+    }
+    // leave room for a second memtable being flushed on small machines
+    if (nMemory > 0)
+        profile.nWriteBufferSize = std::max((int64_t)4 << 20, std::min(profile.nWriteBufferSize, nMemory / 128));
+
+    profile.nBlockSize = 4096;
+    profile.fCompression = GetBoolArg("-txdbcompression", true);
+    return profile;
+}
+
+static leveldb::Options GetOptions(const CTxDBProfile& profile) {
     leveldb::Options options;
-    int nCacheSizeMB = GetArg("-dbcache", 10);
-    options.block_cache = leveldb::NewLRUCache(nCacheSizeMB * 1048576);
+    pTxDBCache = new CCountingCache(profile.nCacheSize);
+    options.block_cache = pTxDBCache;
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = profile.nWriteBufferSize;
+    options.max_open_files = profile.nMaxOpenFiles;
+    options.block_size = profile.nBlockSize;
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
     return options;
 }
 
@@ -79,10 +179,16 @@ CTxDB::CTxDB(const char* pszMode)
 
     bool fCreate = strchr(pszMode, 'c');
 
-    options = GetOptions();
+    // LevelDB cannot retune an open database, so the build profile chosen
+    // here stays in effect until the next restart
+    bool fBuild = GetBoolArg("-reindexaddr", false) || !filesystem::exists(GetDataDir() / "txleveldb" / "CURRENT");
+    txdbProfile = MakeProfile(fBuild);
+    options = GetOptions(txdbProfile);
     options.create_if_missing = true;
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
 
+    LogPrintf("LevelDB profile: %s, cache %d MiB, write buffer %d MiB, max open files %d, compression %s\n",
+        fBuild ? "build" : "steady", txdbProfile.nCacheSize >> 20, txdbProfile.nWriteBufferSize >> 20,
+        txdbProfile.nMaxOpenFiles, txdbProfile.fCompression ? "snappy" : "none");
     init_blockindex(options); // Init directory
     pdb = txdb;
 
@@ -101,6 +207,11 @@ CTxDB::CTxDB(const char* pszMode)
             delete activeBatch;
             activeBatch = NULL;
 
+            // the index is rebuilt from scratch
+            txdbProfile = MakeProfile(true);
+            options.write_buffer_size = txdbProfile.nWriteBufferSize;
+            options.max_open_files = txdbProfile.nMaxOpenFiles;
+
             init_blockindex(options, true); // Remove directory and create new database
             pdb = txdb;
 
@@ -127,12 +238,74 @@ void CTxDB::Close()
     txdb = pdb = NULL;
     delete options.filter_policy;
     options.filter_policy = NULL;
+    if (pTxDBCache == options.block_cache)
+        pTxDBCache = NULL;
     delete options.block_cache;
     options.block_cache = NULL;
     delete activeBatch;
     activeBatch = NULL;
 }
 
+CTxDBProfile CTxDB::GetProfile()
+{
+    return txdbProfile;
+}
+
+void CTxDB::GetCacheStats(uint64_t& nHits, uint64_t& nMisses)
+{
+    nHits = pTxDBCache ? pTxDBCache->nHits.load(boost::memory_order_relaxed) : 0;
+    nMisses = pTxDBCache ? pTxDBCache->nMisses.load(boost::memory_order_relaxed) : 0;
+}
+
+bool CTxDB::GetProperty(const std::string& strProperty, std::string& strValue)
+{
+    return pdb && pdb->GetProperty(strProperty, &strValue);
+}
+
+// Key range covering every record whose key starts with the serialized
+// string strPrefix (records are keyed by make_pair(string, ...)).
+static void GetPrefixRange(const std::string& strPrefix, std::string& strBegin, std::string& strEnd)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << strPrefix;
+    strBegin = ssKey.str();
+    strEnd = strBegin;
+    strEnd[strEnd.size() - 1]++;
+}
+
+uint64_t CTxDB::GetApproximateSize(const std::string& strPrefix)
+{
+    if (!pdb)
+        return 0;
+    std::string strBegin, strEnd;
+    GetPrefixRange(strPrefix, strBegin, strEnd);
+    leveldb::Range range(strBegin, strEnd);
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
+
+void CTxDB::CompactRange(const std::string& strPrefix)
+{
+    if (!pdb)
+        return;
+    std::string strBegin, strEnd;
+    GetPrefixRange(strPrefix, strBegin, strEnd);
+    leveldb::Slice begin(strBegin), end(strEnd);
+    pdb->CompactRange(&begin, &end);
+}
+
+void CTxDB::CompactIndexRanges()
+{
+    // After a bulk build most of the tx and adr records sit in overlapping
+    // level-0/1 tables; pushing them down once makes later lookups touch a
+    // single table per level instead of every file written during the build.
+    int64_t nStart = GetTimeMillis();
+    CompactRange("tx");
+    CompactRange("adr");
+    LogPrintf("Compacted transaction and address index in %dms\n", GetTimeMillis() - nStart);
+}
+
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
@@ -285,6 +458,30 @@ bool CTxDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair(string("blockindex"), blockindex.GetBlockHash()), blockindex);
 }
 
+bool CTxDB::ReadBlockHashAtPos(unsigned int nFile, unsigned int nBlockPos, uint256& hashBlock)
+{
+    return Read(make_pair(string("blockpos"), make_pair(nFile, nBlockPos)), hashBlock);
+}
+
+bool CTxDB::WriteBlockHashAtPos(unsigned int nFile, unsigned int nBlockPos, const uint256& hashBlock)
+{
+    return Write(make_pair(string("blockpos"), make_pair(nFile, nBlockPos)), hashBlock);
+}
+
+bool CTxDB::ReadSideChainTx(uint256 hash, uint256& hashBlock)
+{
+    return Read(make_pair(string("sidetx"), hash), hashBlock);
+}
+
+bool CTxDB::WriteSideChainBlock(const CBlock& block)
+{
+    uint256 hashBlock = block.GetHash();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        if (!Write(make_pair(string("sidetx"), tx.GetHash()), hashBlock))
+            return false;
+    return true;
+}
+
 bool CTxDB::ReadHashBestChain(uint256& hashBestChain)
 {
     return Read(string("hashBestChain"), hashBestChain);
@@ -422,7 +619,12 @@ bool CTxDB::LoadBlockIndex()
     if (!ReadHashBestChain(hashBestChain))
     {
         if (pindexGenesisBlock == NULL)
+        {
+            // new database, every block gets its entries as it is stored
+            if (!fReadOnly)
+                Write(string("blockposindex"), 1);
             return true;
+        }
         return error("CTxDB::LoadBlockIndex() : hashBestChain not loaded");
     }
     if (!mapBlockIndex.count(hashBestChain))
@@ -430,6 +632,10 @@ bool CTxDB::LoadBlockIndex()
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexBest->nChainTrust;
+    {
+        LOCK(cs_main);
+        UpdateChainSnapshot(pindexBest);
+    }
 
     LogPrintf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s  date=%s\n",
       hashBestChain.ToString(), nBestHeight, CBigNum(nBestChainTrust).ToString(),
@@ -440,6 +646,42 @@ bool CTxDB::LoadBlockIndex()
     ReadBestInvalidTrust(bnBestInvalidTrust);
     nBestInvalidTrust = bnBestInvalidTrust.getuint256();
 
+    // The block position and side chain transaction entries are written as
+    // blocks are stored; fill them in once for databases that predate them
+    if (!fReadOnly && !Exists(string("blockposindex")))
+    {
+        LogPrintf("LoadBlockIndex() : indexing block positions and side chain transactions\n");
+        int64_t nStart = GetTimeMillis();
+        unsigned int nSideBlocks = 0, nBatch = 0;
+        TxnBegin();
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            boost::this_thread::interruption_point();
+            CBlockIndex* pindex = item.second;
+            WriteBlockHashAtPos(pindex->nFile, pindex->nBlockPos, item.first);
+            if (pindex != pindexBest && pindex->pnext == NULL)
+            {
+                CBlock block;
+                if (block.ReadFromDisk(pindex))
+                {
+                    WriteSideChainBlock(block);
+                    nSideBlocks++;
+                }
+            }
+            if (++nBatch == 10000)
+            {
+                if (!TxnCommit())
+                    return error("LoadBlockIndex() : writing block positions failed");
+                TxnBegin();
+                nBatch = 0;
+            }
+        }
+        Write(string("blockposindex"), 1);
+        if (!TxnCommit())
+            return error("LoadBlockIndex() : writing block positions failed");
+        LogPrintf("LoadBlockIndex() : indexed %u blocks, %u off the main chain  %dms\n", mapBlockIndex.size(), nSideBlocks, GetTimeMillis() - nStart);
+    }
+
     // Verify blocks in the best chain
     int nCheckLevel = GetArg("-checklevel", 1);
     int nCheckDepth = GetArg( "-checkblocks", 500);
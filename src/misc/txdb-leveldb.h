@@ -15,6 +15,23 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+// Bounds for the txdb block cache, in megabytes
+static const int MIN_TXDB_CACHE = 10;
+static const int MAX_TXDB_CACHE = 256;
+
+// LevelDB tuning picked when the txdb is opened
+struct CTxDBProfile
+{
+    bool fBuild;
+    int64_t nCacheSize;
+    int64_t nWriteBufferSize;
+    int nMaxOpenFiles;
+    int nBlockSize;
+    bool fCompression;
+
+    CTxDBProfile() : fBuild(false), nCacheSize(0), nWriteBufferSize(0), nMaxOpenFiles(0), nBlockSize(0), fCompression(false) {}
+};
+
 // Class that provides access to a LevelDB. Note that this class is frequently
 // instantiated on the stack and then destroyed again, so instantiation has to
 // be very cheap. Unfortunately that means, a CTxDB instance is actually just a
@@ -40,6 +57,15 @@ public:
     // Destroys the underlying shared global state accessed by this TxDB.
     void Close();
 
+    // Storage statistics and maintenance, see gettxdbinfo
+    static CTxDBProfile GetProfile();
+    static void GetCacheStats(uint64_t& nHits, uint64_t& nMisses);
+    bool GetProperty(const std::string& strProperty, std::string& strValue);
+    uint64_t GetApproximateSize(const std::string& strPrefix);
+    void CompactRange(const std::string& strPrefix);
+    // Compact the tx and adr ranges after they were rebuilt in bulk
+    void CompactIndexRanges();
+
 private:
     leveldb::DB *pdb;  // Points to the global instance.
 
@@ -195,6 +221,12 @@ public:
     bool ReadDiskTx(COutPoint outpoint, CTransaction& tx, CTxIndex& txindex);
     bool ReadDiskTx(COutPoint outpoint, CTransaction& tx);
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    // Hash of the block stored at a position in the block files
+    bool ReadBlockHashAtPos(unsigned int nFile, unsigned int nBlockPos, uint256& hashBlock);
+    bool WriteBlockHashAtPos(unsigned int nFile, unsigned int nBlockPos, const uint256& hashBlock);
+    // Transactions of blocks that are not (or no longer) on the main chain
+    bool ReadSideChainTx(uint256 hash, uint256& hashBlock);
+    bool WriteSideChainBlock(const CBlock& block);
     bool ReadHashBestChain(uint256& hashBestChain);
     bool WriteHashBestChain(uint256 hashBestChain);
     bool ReadBestInvalidTrust(CBigNum& bnBestInvalidTrust);
@@ -33,6 +33,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
     LOCK(cs);
     {
         mapTx[hash] = tx;
+        mapTx[hash].CacheHash();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
         nTransactionsUpdated++;
@@ -103,5 +104,6 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     std::map<uint256, CTransaction>::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end()) return false;
     result = i->second;
+    result.CacheHash();
     return true;
 }
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_UINT256_H
 #define BITCOIN_UINT256_H
 
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <stdint.h>
@@ -21,6 +22,12 @@ inline signed char HexDigit(char c)
     return p_util_hexdigit[(unsigned char)c];
 }
 
+class uint_error : public std::runtime_error
+{
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
+
 /** Base class without constructors for uint256 and uint160.
  * This makes the compiler let u use it in a union.
  */
@@ -160,7 +167,13 @@ public:
 
     base_uint& operator-=(const base_uint& b)
     {
-        *this += -b;
+        uint64_t borrow = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64_t n = (uint64_t)pn[i] - b.pn[i] - borrow;
+            pn[i] = n & 0xffffffff;
+            borrow = n >> 63;
+        }
         return *this;
     }
 
@@ -181,6 +194,147 @@ public:
     }
 
 
+    base_uint& operator*=(const base_uint& b)
+    {
+        // schoolbook multiplication, truncated to BITS like the other operators
+        base_uint a;
+        for (int i = 0; i < WIDTH; i++)
+            a.pn[i] = 0;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64_t carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64_t n = carry + a.pn[i + j] + (uint64_t)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    base_uint& operator*=(uint64_t b64)
+    {
+        base_uint b;
+        b = b64;
+        *this *= b;
+        return *this;
+    }
+
+    base_uint& operator/=(const base_uint& b)
+    {
+        // Long division on 32-bit digits (Knuth, TAOCP vol. 2, 4.3.1 D)
+        int m = WIDTH, n = WIDTH;
+        while (m > 0 && pn[m - 1] == 0)
+            m--;
+        while (n > 0 && b.pn[n - 1] == 0)
+            n--;
+        if (n == 0)
+            throw uint_error("Division by zero");
+
+        unsigned int q[WIDTH];
+        for (int i = 0; i < WIDTH; i++)
+            q[i] = 0;
+
+        if (n == 1)
+        {
+            uint64_t k = 0;
+            for (int j = m - 1; j >= 0; j--)
+            {
+                uint64_t cur = (k << 32) | pn[j];
+                q[j] = cur / b.pn[0];
+                k = cur - (uint64_t)q[j] * b.pn[0];
+            }
+        }
+        else if (n <= m)
+        {
+            // normalize so the top digit of the divisor has its high bit set
+            int s = 0;
+            while (!(b.pn[n - 1] & (0x80000000U >> s)))
+                s++;
+            unsigned int vn[WIDTH], un[WIDTH + 1];
+            for (int i = n - 1; i > 0; i--)
+                vn[i] = (b.pn[i] << s) | (unsigned int)((uint64_t)b.pn[i - 1] >> (32 - s));
+            vn[0] = b.pn[0] << s;
+            un[m] = (unsigned int)((uint64_t)pn[m - 1] >> (32 - s));
+            for (int i = m - 1; i > 0; i--)
+                un[i] = (pn[i] << s) | (unsigned int)((uint64_t)pn[i - 1] >> (32 - s));
+            un[0] = pn[0] << s;
+
+            for (int j = m - n; j >= 0; j--)
+            {
+                // estimate the quotient digit, then correct it
+                uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+                uint64_t qhat = num / vn[n - 1];
+                uint64_t rhat = num - qhat * vn[n - 1];
+                while (qhat > 0xffffffffULL || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+                {
+                    qhat--;
+                    rhat += vn[n - 1];
+                    if (rhat > 0xffffffffULL)
+                        break;
+                }
+
+                // multiply and subtract
+                int64_t t;
+                uint64_t k = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    uint64_t p = qhat * vn[i];
+                    t = (int64_t)un[i + j] - (int64_t)k - (int64_t)(p & 0xffffffff);
+                    un[i + j] = (unsigned int)t;
+                    k = (p >> 32) - (t >> 32);
+                }
+                t = (int64_t)un[j + n] - (int64_t)k;
+                un[j + n] = (unsigned int)t;
+
+                q[j] = (unsigned int)qhat;
+                if (t < 0)
+                {
+                    // subtracted too much, add back
+                    q[j]--;
+                    k = 0;
+                    for (int i = 0; i < n; i++)
+                    {
+                        uint64_t sum = (uint64_t)un[i + j] + vn[i] + k;
+                        un[i + j] = (unsigned int)sum;
+                        k = sum >> 32;
+                    }
+                    un[j + n] += (unsigned int)k;
+                }
+            }
+        }
+
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = q[i];
+        return *this;
+    }
+
+    base_uint& operator/=(uint64_t b64)
+    {
+        base_uint b;
+        b = b64;
+        *this /= b;
+        return *this;
+    }
+
+    /** Position of the highest set bit plus one, or zero for zero */
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH - 1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & 1U << nbits)
+                        return 32 * pos + nbits + 1;
+                return 32 * pos + 1;
+            }
+        }
+        return 0;
+    }
+
     base_uint& operator++()
     {
         // prefix operator
@@ -582,6 +736,63 @@ public:
         else
             *this = 0;
     }
+
+    /**
+     * The "compact" format is a representation of a whole number N using an
+     * unsigned 32-bit number similar to a floating point format: the high
+     * byte is the number of bytes of N, the lower 23 bits are the mantissa
+     * and bit 0x00800000 is the sign. This is the same encoding as
+     * CBigNum::SetCompact() and GetCompact(), without the heap.
+     *
+     * pfNegative is set for a nonzero mantissa with the sign bit, pfOverflow
+     * when N does not fit in 256 bits; CBigNum would return a negative or a
+     * larger number in those cases, callers treat both as out of range.
+     */
+    uint256& SetCompact(uint32_t nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        int nSize = nCompact >> 24;
+        uint32_t nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    uint32_t GetCompact() const
+    {
+        int nSize = (bits() + 7) / 8;
+        uint32_t nCompact = 0;
+        if (nSize <= 3)
+            nCompact = Get64() << 8 * (3 - nSize);
+        else
+        {
+            uint256 bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = bn.Get64();
+        }
+        // The 0x00800000 bit denotes the sign, so if it is already set,
+        // divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64_t b)                         { return (base_uint256)a == b; }
@@ -632,6 +843,8 @@ inline const uint256 operator&(const uint256& a, const uint256& b)      { return
 inline const uint256 operator|(const uint256& a, const uint256& b)      { return (base_uint256)a |  (base_uint256)b; }
 inline const uint256 operator+(const uint256& a, const uint256& b)      { return (base_uint256)a +  (base_uint256)b; }
 inline const uint256 operator-(const uint256& a, const uint256& b)      { return (base_uint256)a -  (base_uint256)b; }
+inline const uint256 operator*(const uint256& a, const uint256& b)      { uint256 r(a); r *= b; return r; }
+inline const uint256 operator/(const uint256& a, const uint256& b)      { uint256 r(a); r /= b; return r; }
 
 
 
@@ -36,6 +36,7 @@ namespace boost {
 #include <boost/program_options/parsers.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 #include <openssl/crypto.h>
@@ -225,54 +226,287 @@ uint256 GetRandHash()
 // destroyed, and then some later destructor calls OutputDebugStringF,
 // maybe indirectly, and you get a core dump at shutdown trying to lock
 // the mutex).
+// The same goes for the log writer below: everything it touches is
+// allocated once and never freed.
+
+// -debug categories used in the tree, each one a bit in nLogCategoryMask so
+// LogAcceptCategory() is a table scan that never allocates.
+static const char* const pszLogCategories[] = {
+    "addrman", "alert", "bench", "coinage", "coinstake", "darksend", "db",
+    "import", "instantx", "lock", "masternode", "mempool", "net", "rand", "rpc",
+    "selectcoins", "smessage", "stakemodifier"
+};
+static const int LOG_CATEGORIES = sizeof(pszLogCategories) / sizeof(pszLogCategories[0]);
+static const uint64_t LOG_ALL_CATEGORIES = ~(uint64_t)0;
+
+static uint64_t nLogCategoryMask = 0;
+// -debug=<category> values that are not in the table above
+static vector<string>* pvLogCategoriesOther = NULL;
+
+// Per category cap on lines per second, 0 means unlimited
+static unsigned int nLogRateLimit = 0;
+struct CLogRateLimit
+{
+    boost::atomic<int64_t> nWindow;
+    boost::atomic<unsigned int> nLines;
+    boost::atomic<unsigned int> nSuppressed;
+};
+static CLogRateLimit vLogRateLimit[LOG_CATEGORIES];
+
+void SetLogCategories(const vector<string>& categories, unsigned int nLinesPerSecond)
+{
+    uint64_t nMask = 0;
+    vector<string>* pvOther = new vector<string>();
+    BOOST_FOREACH(const string& strCategory, categories)
+    {
+        // -debug without a category turns on everything
+        if (strCategory.empty())
+            nMask = LOG_ALL_CATEGORIES;
+
+        int i = 0;
+        while (i < LOG_CATEGORIES && strCategory != pszLogCategories[i])
+            i++;
+        if (i < LOG_CATEGORIES)
+            nMask |= (uint64_t)1 << i;
+        else if (!strCategory.empty())
+            pvOther->push_back(strCategory);
+    }
+
+    // called once during init, before the threads that log are started
+    nLogCategoryMask = nMask;
+    pvLogCategoriesOther = pvOther;
+    nLogRateLimit = nLinesPerSecond;
+}
+
+// Returns true if this line has to be dropped to stay under -logratelimit
+static bool LogRateLimited(int nCategory)
+{
+    if (nLogRateLimit == 0)
+        return false;
+
+    CLogRateLimit& limit = vLogRateLimit[nCategory];
+    int64_t nNow = GetTime();
+    int64_t nWindow = limit.nWindow.load(boost::memory_order_relaxed);
+    if (nNow != nWindow && limit.nWindow.compare_exchange_strong(nWindow, nNow, boost::memory_order_relaxed))
+    {
+        // first line of a new second, report what the last one dropped
+        limit.nLines.store(0, boost::memory_order_relaxed);
+        unsigned int nSuppressed = limit.nSuppressed.exchange(0, boost::memory_order_relaxed);
+        if (nSuppressed > 0)
+            LogPrintStr(strprintf("Log rate limit: suppressed %u %s messages\n", nSuppressed, pszLogCategories[nCategory]));
+    }
+
+    if (limit.nLines.fetch_add(1, boost::memory_order_relaxed) < nLogRateLimit)
+        return false;
+    limit.nSuppressed.fetch_add(1, boost::memory_order_relaxed);
+    return true;
+}
+
+bool LogAcceptCategory(const char* category)
+{
+    if (category == NULL)
+        return true;
+    if (!fDebug)
+        return false;
+
+    for (int i = 0; i < LOG_CATEGORIES; i++)
+    {
+        if (strcmp(category, pszLogCategories[i]) == 0)
+            return (nLogCategoryMask & ((uint64_t)1 << i)) && !LogRateLimited(i);
+    }
+
+    // not a known category, compare against the names given by -debug
+    if (nLogCategoryMask == LOG_ALL_CATEGORIES)
+        return true;
+    if (pvLogCategoriesOther != NULL)
+    {
+        BOOST_FOREACH(const string& strCategory, *pvLogCategoriesOther)
+            if (strCategory == category)
+                return true;
+    }
+    return false;
+}
+
+// Lines for debug.log are pushed onto a lock-free multi-producer,
+// single-consumer queue (an intrusive list with a stub node) and written
+// in batches by ThreadLogWriter(), so logging threads never wait on the
+// file or on each other. Errors wake the writer instead of waiting for a
+// batch. Fatal exceptions, and every line once the writer has been stopped
+// for shutdown, are written by the logging thread itself before it returns.
+struct CLogEntry
+{
+    boost::atomic<CLogEntry*> next;
+    int64_t nTime;
+    string str;
+};
+
+// wake the writer early once this many lines are queued
+static const unsigned int LOG_WAKE_WRITER = 1024;
+// upper bound on the size of a single write
+static const size_t LOG_MAX_BATCH = 1 << 20;
 
 static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 // We use boost::call_once() to make sure these are initialized in
 // in a thread-safe manner the first time it is called:
 static FILE* fileout = NULL;
+// held by whoever drains the queue and writes to fileout
 static boost::mutex* mutexDebugLog = NULL;
+static boost::atomic<CLogEntry*> plogHead;      // producers push here
+static CLogEntry* plogTail = NULL;              // owned by the writer
+static boost::atomic<unsigned int> nLogQueued;
+static boost::atomic<bool> fLogWriterRunning;
+static boost::mutex* mutexLogWriter = NULL;
+static boost::condition_variable* condLogWriter = NULL;
+static boost::thread* pthreadLogWriter = NULL;
+static bool fStartedNewLine = true;
 
-static void DebugPrintInit()
+static void LogEnqueue(int64_t nTime, const string& str, bool fWake)
 {
-    assert(fileout == NULL);
-    assert(mutexDebugLog == NULL);
+    CLogEntry* pentry = new CLogEntry();
+    pentry->next.store(NULL, boost::memory_order_relaxed);
+    pentry->nTime = nTime;
+    pentry->str = str;
 
-    boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-    fileout = fopen(pathDebug.string().c_str(), "a");
-    if (fileout) setbuf(fileout, NULL); // unbuffered
+    CLogEntry* pprev = plogHead.exchange(pentry, boost::memory_order_acq_rel);
+    pprev->next.store(pentry, boost::memory_order_release);
 
-    mutexDebugLog = new boost::mutex();
+    if (nLogQueued.fetch_add(1, boost::memory_order_relaxed) + 1 == LOG_WAKE_WRITER || fWake)
+        condLogWriter->notify_one();
 }
 
-bool LogAcceptCategory(const char* category)
+// Only called with mutexDebugLog held
+static bool LogDequeue(int64_t& nTime, string& str)
 {
-    if (category != NULL)
-    {
-        if (!fDebug)
-            return false;
+    CLogEntry* ptail = plogTail;
+    CLogEntry* pnext = ptail->next.load(boost::memory_order_acquire);
+    if (pnext == NULL)
+        return false;
+
+    // pnext becomes the new stub node
+    nTime = pnext->nTime;
+    str.swap(pnext->str);
+    plogTail = pnext;
+    delete ptail;
+    return true;
+}
 
-        // Give each thread quick access to -debug settings.
-        // This helps prevent issues debugging global destructors,
-        // where mapMultiArgs might be deleted before another
-        // global destructor calls LogPrint()
-        static boost::thread_specific_ptr<set<string> > ptrCategory;
-        if (ptrCategory.get() == NULL)
+static void LogFormat(string& strOut, int64_t nTime, const string& str)
+{
+    // Debug print useful for profiling
+    if (fLogTimestamps && fStartedNewLine)
+        strOut += DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTime) + " ";
+    if (!str.empty() && str[str.size()-1] == '\n')
+        fStartedNewLine = true;
+    else
+        fStartedNewLine = false;
+    strOut += str;
+}
+
+// Only called with mutexDebugLog held
+static void LogWrite(const string& str)
+{
+    // reopen the log file, if requested
+    if (fReopenDebugLog) {
+        fReopenDebugLog = false;
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        FILE* file = freopen(pathDebug.string().c_str(), "a", fileout);
+        if (file == NULL)
         {
-            const vector<string>& categories = mapMultiArgs["-debug"];
-            ptrCategory.reset(new set<string>(categories.begin(), categories.end()));
-            // thread_specific_ptr automatically deletes the set when the thread ends.
+            // freopen closed the old stream, keep logging to stderr
+            // rather than through a dangling pointer
+            fileout = stderr;
+            fprintf(stderr, "Error: unable to reopen %s\n", pathDebug.string().c_str());
         }
-        const set<string>& setCategories = *ptrCategory.get();
+        else
+            fileout = file;
+    }
 
-        // if not debugging everything and not debugging specific category, LogPrint does nothing.
-        if (setCategories.count(string("")) == 0 &&
-            setCategories.count(string(category)) == 0)
-            return false;
+    fwrite(str.data(), 1, str.size(), fileout);
+    fflush(fileout);
+}
+
+// Drain the queue into a single write, returns the number of lines written.
+// Safe to call from any thread, the writer and the loggers that flush
+// synchronously serialize on mutexDebugLog.
+static unsigned int LogFlushQueue()
+{
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+
+    string strBatch;
+    int64_t nTime;
+    string str;
+    unsigned int nLines = 0;
+    while (strBatch.size() < LOG_MAX_BATCH && LogDequeue(nTime, str))
+    {
+        LogFormat(strBatch, nTime, str);
+        nLines++;
+    }
+    if (nLines > 0)
+    {
+        nLogQueued.fetch_sub(nLines, boost::memory_order_relaxed);
+        LogWrite(strBatch);
+    }
+    return nLines;
+}
+
+static void ThreadLogWriter()
+{
+    RenameThread("shardbit-log");
+
+    while (true)
+    {
+        // look at the flag first so everything queued before a stop is written
+        bool fRunning = fLogWriterRunning.load();
+        if (LogFlushQueue() > 0)
+            continue;
+        if (!fRunning)
+            break;
+
+        boost::mutex::scoped_lock lock(*mutexLogWriter);
+        condLogWriter->timed_wait(lock, boost::posix_time::milliseconds(100));
     }
-    return true;
 }
 
-int LogPrintStr(const std::string &str)
+void StopDebugLog()
+{
+    if (!fLogWriterRunning.exchange(false))
+        return;
+
+    boost::atomic_thread_fence(boost::memory_order_seq_cst);
+    condLogWriter->notify_one();
+    pthreadLogWriter->join();
+
+    // Anything that raced with the stop. A logger that saw the writer
+    // running but enqueued after this drain sees it stopped afterwards and
+    // drains the queue itself, see LogPrintStr().
+    while (LogFlushQueue() > 0)
+        ;
+}
+
+static void DebugPrintInit()
+{
+    assert(fileout == NULL);
+    assert(mutexDebugLog == NULL);
+
+    boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+    fileout = fopen(pathDebug.string().c_str(), "a");
+
+    mutexDebugLog = new boost::mutex();
+    mutexLogWriter = new boost::mutex();
+    condLogWriter = new boost::condition_variable();
+    plogTail = new CLogEntry();
+    plogTail->next.store(NULL);
+    plogHead.store(plogTail);
+
+    if (fileout == NULL)
+        return;
+
+    fLogWriterRunning.store(true);
+    pthreadLogWriter = new boost::thread(&ThreadLogWriter);
+    atexit(StopDebugLog);
+}
+
+int LogPrintStr(const std::string &str, LogUrgency urgency)
 {
     int ret = 0; // Returns total number of characters written
     if (fPrintToConsole)
@@ -282,31 +516,22 @@ int LogPrintStr(const std::string &str)
     }
     else if (fPrintToDebugLog)
     {
-        static bool fStartedNewLine = true;
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
 
         if (fileout == NULL)
             return ret;
 
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        // reopen the log file, if requested
-        if (fReopenDebugLog) {
-            fReopenDebugLog = false;
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                setbuf(fileout, NULL); // unbuffered
+        // Queued even when the writer is stopped, so the lines stay in order.
+        // The fence orders the enqueue before the check, which pairs with
+        // the exchange in StopDebugLog().
+        LogEnqueue(GetTime(), str, urgency == LOG_WAKE);
+        boost::atomic_thread_fence(boost::memory_order_seq_cst);
+        if (urgency == LOG_FLUSH || !fLogWriterRunning.load())
+        {
+            while (LogFlushQueue() > 0)
+                ;
         }
-
-        // Debug print useful for profiling
-        if (fLogTimestamps && fStartedNewLine)
-            ret += fprintf(fileout, "%s ", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()).c_str());
-        if (!str.empty() && str[str.size()-1] == '\n')
-            fStartedNewLine = true;
-        else
-            fStartedNewLine = false;
-
-        ret = fwrite(str.data(), 1, str.size(), fileout);
+        ret = str.size();
     }
 
     return ret;
@@ -1056,7 +1281,7 @@ static std::string FormatException(std::exception* pex, const char* pszThread)
 void PrintException(std::exception* pex, const char* pszThread)
 {
     std::string message = FormatException(pex, pszThread);
-    LogPrintf("\n\n************************\n%s\n", message);
+    LogPrintStr(strprintf("\n\n************************\n%s\n", message), LOG_FLUSH);
     fprintf(stderr, "\n\n************************\n%s\n", message.c_str());
     strMiscWarning = message;
     throw;
@@ -1065,7 +1290,7 @@ void PrintException(std::exception* pex, const char* pszThread)
 void PrintExceptionContinue(std::exception* pex, const char* pszThread)
 {
     std::string message = FormatException(pex, pszThread);
-    LogPrintf("\n\n************************\n%s\n", message);
+    LogPrintStr(strprintf("\n\n************************\n%s\n", message), LOG_WAKE);
     fprintf(stderr, "\n\n************************\n%s\n", message.c_str());
     strMiscWarning = message;
 }
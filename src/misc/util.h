@@ -151,10 +151,21 @@ void RandAddSeedPerfmon();
 
 
 
+/* Set the -debug categories and the per category -logratelimit */
+void SetLogCategories(const std::vector<std::string>& categories, unsigned int nLinesPerSecond);
 /* Return true if log accepts specified category */
 bool LogAcceptCategory(const char* category);
+/* How soon LogPrintStr() gets a line into debug.log */
+enum LogUrgency
+{
+    LOG_DEFER,  // batched by the writer thread
+    LOG_WAKE,   // the writer thread is woken up for it
+    LOG_FLUSH,  // written before LogPrintStr() returns
+};
 /* Send a string to the log output */
-int LogPrintStr(const std::string &str);
+int LogPrintStr(const std::string &str, LogUrgency urgency = LOG_DEFER);
+/* Stop the debug.log writer thread, later lines are written synchronously */
+void StopDebugLog();
 
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
@@ -173,14 +184,14 @@ int LogPrintStr(const std::string &str);
     template<TINYFORMAT_ARGTYPES(n)>                                                 \
     static inline bool error(const char* format, TINYFORMAT_VARARGS(n))              \
     {                                                                                \
-        LogPrintStr("ERROR: " + tfm::format(format, TINYFORMAT_PASSARGS(n)) + "\n"); \
+        LogPrintStr("ERROR: " + tfm::format(format, TINYFORMAT_PASSARGS(n)) + "\n", LOG_WAKE); \
         return false;                                                                \
     }                                                                                \
     /*   Log error and return n */                                                   \
     template<TINYFORMAT_ARGTYPES(n)>                                                 \
     static inline int errorN(int rv, const char* format, TINYFORMAT_VARARGS(n))      \
     {                                                                                \
-        LogPrintStr("ERROR: " + tfm::format(format, TINYFORMAT_PASSARGS(n)) + "\n"); \
+        LogPrintStr("ERROR: " + tfm::format(format, TINYFORMAT_PASSARGS(n)) + "\n", LOG_WAKE); \
         return rv;                                                                   \
     }
 
@@ -197,12 +208,12 @@ static inline int LogPrint(const char* category, const char* format)
 }
 static inline bool error(const char* format)
 {
-    LogPrintStr(std::string("ERROR: ") + format + "\n");
+    LogPrintStr(std::string("ERROR: ") + format + "\n", LOG_WAKE);
     return false;
 }
 static inline int errorN(int n, const char* format)
 {
-    LogPrintStr(std::string("ERROR: ") + format + "\n");
+    LogPrintStr(std::string("ERROR: ") + format + "\n", LOG_WAKE);
     return n;
 }
 
@@ -415,6 +415,7 @@ void MultisigDialog::on_signTransactionButton_clicked()
 
     // Sign what we can
     bool fComplete = true;
+    CSignatureHasher hasher(mergedTx);
     for(unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
@@ -426,9 +427,9 @@ void MultisigDialog::on_signTransactionButton_clicked()
         const CScript& prevPubKey = mapPrevOut[txin.prevout];
 
         txin.scriptSig.clear();
-        SignSignature(*wallet, prevPubKey, mergedTx, i, SIGHASH_ALL);
+        SignSignature(*wallet, prevPubKey, mergedTx, i, SIGHASH_ALL, &hasher);
         txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, tx.vin[i].scriptSig);
-        if(!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0))
+        if(!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0, &hasher))
         {
             fComplete = false;
         }
@@ -0,0 +1,365 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2014 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcserver.h"
+
+#include "misc/util.h"
+#include "main/main.h"
+#include "chainparams/chainparams.h"
+
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, json_spirit::Object& entry);
+
+// Most headers returned by one /rest/headers request
+static const int MAX_REST_HEADERS_RESULTS = 2000;
+
+static const struct {
+    enum RetFormat rf;
+    const char *name;
+} rf_names[] = {
+    { RF_UNDEF,  "" },
+    { RF_BINARY, "bin" },
+    { RF_HEX,    "hex" },
+    { RF_JSON,   "json" },
+};
+
+class RestErr
+{
+public:
+    enum HTTPStatusCode status;
+    string message;
+};
+
+static RestErr RESTERR(enum HTTPStatusCode status, string message)
+{
+    RestErr re;
+    re.status = status;
+    re.message = message;
+    return re;
+}
+
+// Split "<path>.<format>", params[0] receives the path
+enum RetFormat ParseDataFormat(vector<string>& params, const string& strReq)
+{
+    boost::split(params, strReq, boost::is_any_of("."));
+    if (params.size() == 2)
+    {
+        for (unsigned int i = 1; i < ARRAYLEN(rf_names); i++)
+            if (params[1] == rf_names[i].name)
+                return rf_names[i].rf;
+    }
+
+    return RF_UNDEF;
+}
+
+static string AvailableDataFormatsString()
+{
+    string formats = "";
+    for (unsigned int i = 1; i < ARRAYLEN(rf_names); i++)
+    {
+        if (i > 1)
+            formats += ", ";
+        formats += ".";
+        formats += rf_names[i].name;
+    }
+    return formats;
+}
+
+static uint256 ParseHashStr(const string& strHash)
+{
+    if (strHash.size() != 64 || !IsHex(strHash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + strHash);
+    return uint256(strHash);
+}
+
+static void WriteReply(std::ostream& stream, const string& strData, enum RetFormat rf, bool fRun)
+{
+    if (rf == RF_HEX)
+    {
+        string strHex = HexStr(strData.begin(), strData.end()) + "\n";
+        stream << HTTPReply(HTTP_OK, strHex, fRun, "text/plain") << std::flush;
+    }
+    else
+        stream << HTTPReply(HTTP_OK, strData, fRun, "application/octet-stream") << std::flush;
+}
+
+// Copy a block straight from its block file. Blocks are stored with their
+// network encoding, preceded by the message start and their size.
+void WriteRawBlock(std::ostream& stream, unsigned int nFile, unsigned int nBlockPos, enum RetFormat rf, bool fRun)
+{
+    unsigned int nSize = 0;
+    CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos - sizeof(nSize), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        throw RESTERR(HTTP_NOT_FOUND, "Block not available");
+    try {
+        filein >> nSize;
+    }
+    catch (std::exception &e) {
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Block not readable");
+    }
+    if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        throw RESTERR(HTTP_INTERNAL_SERVER_ERROR, "Block not readable");
+
+    size_t nLength = (rf == RF_HEX) ? 2 * (size_t)nSize + 1 : nSize;
+    stream << HTTPReplyHeader(HTTP_OK, fRun, nLength, false, rf == RF_HEX ? "text/plain" : "application/octet-stream");
+
+    // past this point only dropping the connection can signal a failure
+    vector<char> vch(std::min(nSize, (unsigned int)RPC_STREAM_CHUNK_SIZE));
+    unsigned int nRemaining = nSize;
+    while (nRemaining > 0)
+    {
+        unsigned int nRead = std::min(nRemaining, (unsigned int)vch.size());
+        filein.read(&vch[0], nRead);
+        if (rf == RF_HEX)
+            stream << HexStr(vch.begin(), vch.begin() + nRead);
+        else
+            stream.write(&vch[0], nRead);
+        nRemaining -= nRead;
+    }
+    if (rf == RF_HEX)
+        stream << "\n";
+    stream << std::flush;
+}
+
+static Object headerToJSON(const CBlockIndex* pindex, const CChainSnapshot& chain)
+{
+    Object result;
+    result.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+    result.push_back(Pair("height", pindex->nHeight));
+    result.push_back(Pair("version", pindex->nVersion));
+    result.push_back(Pair("merkleroot", pindex->hashMerkleRoot.GetHex()));
+    result.push_back(Pair("time", pindex->GetBlockTime()));
+    result.push_back(Pair("nonce", (uint64_t)pindex->nNonce));
+    result.push_back(Pair("bits", strprintf("%08x", pindex->nBits)));
+    result.push_back(Pair("chaintrust", leftTrim(pindex->nChainTrust.GetHex(), '0')));
+    result.push_back(Pair("flags", pindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work"));
+    if (pindex->pprev)
+        result.push_back(Pair("previousblockhash", pindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex* pnext = chain.Next(pindex);
+    if (pnext)
+        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+    return result;
+}
+
+static CBlockIndex* LookupBlockIndex(const uint256& hash)
+{
+    LOCK(cs_main);
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return NULL;
+    return mi->second;
+}
+
+static bool rest_block(std::ostream& stream, const string& strReq, bool fRun, bool fChunked)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    uint256 hash = ParseHashStr(params[0]);
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (pblockindex == NULL)
+        throw RESTERR(HTTP_NOT_FOUND, hash.GetHex() + " not found");
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        WriteRawBlock(stream, pblockindex->nFile, pblockindex->nBlockPos, rf, fRun);
+        return true;
+    }
+
+    case RF_JSON: {
+        CBlock block;
+        if (!block.ReadFromDisk(pblockindex, true))
+            throw RESTERR(HTTP_NOT_FOUND, hash.GetHex() + " not available");
+        CHTTPReplyWriter writer(stream, fRun, fChunked);
+        blockToJSON(block, pblockindex, true, writer);
+        writer.Finish();
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_tx(std::ostream& stream, const string& strReq, bool fRun, bool fChunked)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    uint256 hash = ParseHashStr(params[0]);
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(hash, tx, hashBlock))
+        throw RESTERR(HTTP_NOT_FOUND, hash.GetHex() + " not found");
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+        ssTx << tx;
+        WriteReply(stream, ssTx.str(), rf, fRun);
+        return true;
+    }
+
+    case RF_JSON: {
+        Object objTx;
+        TxToJSON(tx, hashBlock, objTx);
+        CHTTPReplyWriter writer(stream, fRun, fChunked);
+        writer.Write(objTx);
+        writer.Finish();
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_headers(std::ostream& stream, const string& strReq, bool fRun, bool fChunked)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    long nCount = strtol(path[0].c_str(), NULL, 10);
+    if (nCount < 1 || nCount > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", path[0]));
+
+    uint256 hash = ParseHashStr(path[1]);
+
+    // headers follow the main chain from the requested block, positions come
+    // from the snapshot so only the lookup needs cs_main
+    CChainSnapshotRef chain = GetChainSnapshot();
+    vector<const CBlockIndex*> vHeaders;
+    vHeaders.reserve(nCount);
+    CBlockIndex* pindex = LookupBlockIndex(hash);
+    while (pindex != NULL && chain->Contains(pindex))
+    {
+        vHeaders.push_back(pindex);
+        if ((long)vHeaders.size() == nCount)
+            break;
+        pindex = chain->Next(pindex);
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssHeader(SER_NETWORK | SER_BLOCKHEADERONLY, PROTOCOL_VERSION);
+        BOOST_FOREACH(const CBlockIndex* pindex, vHeaders)
+            ssHeader << pindex->GetBlockHeader();
+        WriteReply(stream, ssHeader.str(), rf, fRun);
+        return true;
+    }
+
+    case RF_JSON: {
+        CHTTPReplyWriter writer(stream, fRun, fChunked);
+        writer.BeginArray();
+        BOOST_FOREACH(const CBlockIndex* pindex, vHeaders)
+            writer.Write(headerToJSON(pindex, *chain));
+        writer.EndArray();
+        writer.Finish();
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_chaininfo(std::ostream& stream, const string& strReq, bool fRun, bool fChunked)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        static const char* const chainNames[] = { "main", "test", "regtest" };
+
+        CChainSnapshotRef chain = GetChainSnapshot();
+        Object obj;
+        obj.push_back(Pair("chain", chainNames[Params().NetworkID()]));
+        obj.push_back(Pair("blocks", chain->nHeight));
+        obj.push_back(Pair("bestblockhash", chain->hashBestChain.GetHex()));
+
+        Object diff;
+        diff.push_back(Pair("proof-of-work", GetDifficulty(GetLastBlockIndex(chain->pindexBest, false))));
+        diff.push_back(Pair("proof-of-stake", GetDifficulty(GetLastBlockIndex(chain->pindexBest, true))));
+        obj.push_back(Pair("difficulty", diff));
+        obj.push_back(Pair("chaintrust", leftTrim(chain->pindexBest->nChainTrust.GetHex(), '0')));
+        obj.push_back(Pair("initialblockdownload", IsInitialBlockDownload()));
+
+        CHTTPReplyWriter writer(stream, fRun, fChunked);
+        writer.Write(obj);
+        writer.Finish();
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static const struct {
+    const char *prefix;
+    bool (*handler)(std::ostream& stream, const string& strReq, bool fRun, bool fChunked);
+} uri_prefixes[] = {
+    { "/rest/tx/",        rest_tx },
+    { "/rest/block/",     rest_block },
+    { "/rest/headers/",   rest_headers },
+    { "/rest/chaininfo",  rest_chaininfo },
+};
+
+bool HTTPReq_REST(std::ostream& stream, const string& strMethod, const string& strURI, bool fRun, bool fChunked)
+{
+    try {
+        if (strMethod != "GET")
+            throw RESTERR(HTTP_BAD_REQUEST, "REST requests must use GET");
+
+        for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++) {
+            unsigned int plen = strlen(uri_prefixes[i].prefix);
+            if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
+                string strReq = strURI.substr(plen);
+                return uri_prefixes[i].handler(stream, strReq, fRun, fChunked);
+            }
+        }
+    }
+    catch (RestErr& re) {
+        stream << HTTPReply(re.status, re.message + "\r\n", false, "text/plain") << std::flush;
+        return false;
+    }
+    catch (std::exception& e) {
+        // the reply may be partially sent, all we can do is close
+        LogPrintf("HTTPReq_REST %s failed: %s\n", strURI, e.what());
+        return false;
+    }
+
+    stream << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
+    return false;
+}
@@ -5,6 +5,7 @@
 
 #include "misc/kernel.h"
 #include "misc/checkpoints.h"
+#include "misc/txdb.h"
 
 #include "rpcserver.h"
 #include "main/main.h"
@@ -104,21 +105,35 @@ double GetPoSKernelPS()
     return result;
 }
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail)
+// Block fields other than the transaction list
+static Object blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
+    // chain position comes from the snapshot, callers don't need cs_main
+    CChainSnapshotRef chain = GetChainSnapshot();
+
     Object result;
     result.push_back(Pair("hash", block.GetHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
-    if (blockindex->IsInMainChain())
-        confirmations = nBestHeight - blockindex->nHeight + 1;
+    if (chain->Contains(blockindex))
+        confirmations = chain->nHeight - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
 #ifndef LOWMEM
-    result.push_back(Pair("mint", ValueFromAmount(blockindex->nMint)));
+    // final once the block is in the snapshot, other blocks may be in
+    // ConnectBlock() right now
+    int64_t nMint;
+    if (chain->Contains(blockindex))
+        nMint = blockindex->nMint;
+    else
+    {
+        LOCK(cs_main);
+        nMint = blockindex->nMint;
+    }
+    result.push_back(Pair("mint", ValueFromAmount(nMint)));
 #endif
     result.push_back(Pair("time", (int64_t)block.GetBlockTime()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -128,15 +143,28 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
     result.push_back(Pair("chaintrust", leftTrim(blockindex->nChainTrust.GetHex(), '0')));
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    if (blockindex->pnext)
-        result.push_back(Pair("nextblockhash", blockindex->pnext->GetBlockHash().GetHex()));
+    CBlockIndex* pnext = chain->Next(blockindex);
+    if (pnext)
+        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
 
     result.push_back(Pair("flags", strprintf("%s%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work", blockindex->GeneratedStakeModifier()? " stake-modifier": "")));
     result.push_back(Pair("proofhash", blockindex->hashProof.GetHex()));
     result.push_back(Pair("entropybit", (int)blockindex->GetStakeEntropyBit()));
     result.push_back(Pair("modifier", strprintf("%016x", blockindex->nStakeModifier)));
     result.push_back(Pair("modifierv2", blockindex->bnStakeModifierV2.GetHex()));
-    Array txinfo;
+
+    return result;
+}
+
+// Writes the block with one transaction entry at a time, so verbose output
+// of a large block is never built as a whole
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONStreamWriter& writer)
+{
+    writer.BeginObject();
+    writer.WriteMembers(blockHeaderToJSON(block, blockindex));
+
+    writer.Key("tx");
+    writer.BeginArray();
     BOOST_FOREACH (const CTransaction& tx, block.vtx)
     {
         if (fPrintTransactionDetail)
@@ -146,18 +174,19 @@ Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPri
             entry.push_back(Pair("txid", tx.GetHash().GetHex()));
             TxToJSON(tx, 0, entry);
 
-            txinfo.push_back(entry);
+            writer.Write(entry);
         }
         else
-            txinfo.push_back(tx.GetHash().GetHex());
+            writer.Write(tx.GetHash().GetHex());
     }
-
-    result.push_back(Pair("tx", txinfo));
+    writer.EndArray();
 
     if (block.IsProofOfStake())
-        result.push_back(Pair("signature", HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end())));
-
-    return result;
+    {
+        writer.Key("signature");
+        writer.Write(HexStr(block.vchBlockSig.begin(), block.vchBlockSig.end()));
+    }
+    writer.EndObject();
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -167,7 +196,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "getbestblockhash\n"
             "Returns the hash of the best block in the longest block chain.");
 
-    return hashBestChain.GetHex();
+    return GetChainSnapshot()->hashBestChain.GetHex();
 }
 
 Value getblockcount(const Array& params, bool fHelp)
@@ -177,7 +206,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "getblockcount\n"
             "Returns the number of blocks in the longest block chain.");
 
-    return nBestHeight;
+    return GetChainSnapshot()->nHeight;
 }
 
 
@@ -191,25 +220,25 @@ Value getdifficulty(const Array& params, bool fHelp)
     //Object obj;
     //obj.push_back(Pair("proof-of-work",        GetDifficulty()));
     //obj.push_back(Pair("proof-of-stake",       GetDifficulty(GetLastBlockIndex(pindexBest, true))));
-    return GetDifficulty(GetLastBlockIndex(pindexBest, true));
+    return GetDifficulty(GetLastBlockIndex(GetChainSnapshot()->pindexBest, true));
 }
 
 
-Value getrawmempool(const Array& params, bool fHelp)
+void getrawmempool(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "getrawmempool\n"
             "Returns all transaction ids in memory pool.");
 
+    // queryHashes takes the mempool lock, the ids are written without it
     vector<uint256> vtxid;
     mempool.queryHashes(vtxid);
 
-    Array a;
+    writer.BeginArray();
     BOOST_FOREACH(const uint256& hash, vtxid)
-        a.push_back(hash.ToString());
-
-    return a;
+        writer.Write(hash.ToString());
+    writer.EndArray();
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -220,14 +249,14 @@ Value getblockhash(const Array& params, bool fHelp)
             "Returns hash of block in best-block-chain at <index>.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (pblockindex == NULL)
         throw runtime_error("Block number out of range.");
 
-    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     return pblockindex->phashBlock->GetHex();
 }
 
-Value getblock(const Array& params, bool fHelp)
+void getblock(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -238,17 +267,24 @@ Value getblock(const Array& params, bool fHelp)
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
 
-    if (mapBlockIndex.count(hash) == 0)
+    // cs_main only covers the index lookup, the block is read without it
+    CBlockIndex* pblockindex = NULL;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+        if (mi != mapBlockIndex.end())
+            pblockindex = (*mi).second;
+    }
+    if (pblockindex == NULL)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
-Value getblockbynumber(const Array& params, bool fHelp)
+void getblockbynumber(const Array& params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -257,20 +293,14 @@ Value getblockbynumber(const Array& params, bool fHelp)
             "Returns details of a block with given block-number.");
 
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > nBestHeight)
+    CBlockIndex* pblockindex = (*GetChainSnapshot())[nHeight];
+    if (pblockindex == NULL)
         throw runtime_error("Block number out of range.");
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-
-    uint256 hash = *pblockindex->phashBlock;
-
-    pblockindex = mapBlockIndex[hash];
     block.ReadFromDisk(pblockindex, true);
 
-    return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
+    blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false, writer);
 }
 
 // ppcoin: get information of sync-checkpoint
@@ -292,3 +322,66 @@ Value getcheckpoint(const Array& params, bool fHelp)
 
     return result;
 }
+
+Value gettxdbinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gettxdbinfo\n"
+            "Returns storage statistics of the transaction index database.");
+
+    CTxDB txdb("r");
+    Object result;
+
+    CTxDBProfile profile = CTxDB::GetProfile();
+    Object objProfile;
+    objProfile.push_back(Pair("mode", profile.fBuild ? "build" : "steady"));
+    objProfile.push_back(Pair("cachebytes", profile.nCacheSize));
+    objProfile.push_back(Pair("writebufferbytes", profile.nWriteBufferSize));
+    objProfile.push_back(Pair("maxopenfiles", profile.nMaxOpenFiles));
+    objProfile.push_back(Pair("blocksize", profile.nBlockSize));
+    objProfile.push_back(Pair("compression", profile.fCompression));
+    result.push_back(Pair("profile", objProfile));
+
+    uint64_t nHits, nMisses;
+    CTxDB::GetCacheStats(nHits, nMisses);
+    Object objCache;
+    objCache.push_back(Pair("hits", nHits));
+    objCache.push_back(Pair("misses", nMisses));
+    objCache.push_back(Pair("hitrate", nHits + nMisses ? (double)nHits / (nHits + nMisses) : 0.0));
+    result.push_back(Pair("cache", objCache));
+
+    // "leveldb.stats" lists one row per non-empty level:
+    // level, files, size (MB), compaction time (s), compaction read/write (MB)
+    Array levels;
+    string strStats;
+    if (txdb.GetProperty("leveldb.stats", strStats))
+    {
+        istringstream stream(strStats);
+        string strLine;
+        while (getline(stream, strLine))
+        {
+            int nLevel, nFiles;
+            double dSize, dTime, dRead, dWrite;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &nLevel, &nFiles, &dSize, &dTime, &dRead, &dWrite) != 6)
+                continue;
+            Object objLevel;
+            objLevel.push_back(Pair("level", nLevel));
+            objLevel.push_back(Pair("files", nFiles));
+            objLevel.push_back(Pair("sizemb", dSize));
+            objLevel.push_back(Pair("compactionsec", dTime));
+            objLevel.push_back(Pair("compactionreadmb", dRead));
+            objLevel.push_back(Pair("compactionwritemb", dWrite));
+            levels.push_back(objLevel);
+        }
+    }
+    result.push_back(Pair("levels", levels));
+
+    Object objRanges;
+    objRanges.push_back(Pair("tx", txdb.GetApproximateSize("tx")));
+    objRanges.push_back(Pair("adr", txdb.GetApproximateSize("adr")));
+    objRanges.push_back(Pair("blockindex", txdb.GetApproximateSize("blockindex")));
+    result.push_back(Pair("rangebytes", objRanges));
+
+    return result;
+}
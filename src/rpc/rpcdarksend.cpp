@@ -10,6 +10,7 @@
 #include "masternode/activemasternode.h"
 #include "masternode/masternodeman.h"
 #include "masternode/masternodeconfig.h"
+#include "instantx/instantx.h"
 
 #include "main/init.h"
 #include "main/main.h"
@@ -129,6 +130,50 @@ Value getpoolinfo(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getinstantxinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getinstantxinfo\n"
+            "Returns an object containing InstantX lock and vote processing statistics.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"locks\": n,             (numeric) transaction locks in memory\n"
+            "  \"votes\": n,             (numeric) consensus votes seen\n"
+            "  \"vote_queue\": n,        (numeric) votes waiting for signature verification\n"
+            "  \"completed\": n,         (numeric) locks that collected the required votes\n"
+            "  \"latency_avg_ms\": n,    (numeric) average time to complete a lock\n"
+            "  \"latency_max_ms\": n,    (numeric) slowest lock\n"
+            "  \"latency_histogram\": [ (array) completed locks per latency bucket\n"
+            "    { \"le_ms\": n, \"count\": n }, ...\n"
+            "  ]\n"
+            "}\n");
+
+    Object obj;
+    Array histogram;
+    {
+        LOCK(cs_instantx);
+        obj.push_back(Pair("locks",          (int)mapTxLocks.size()));
+        obj.push_back(Pair("votes",          (int)mapTxLockVote.size()));
+        obj.push_back(Pair("vote_queue",     GetConsensusVoteQueueSize()));
+        obj.push_back(Pair("completed",      (boost::int64_t)lockLatencyStats.nCount));
+        obj.push_back(Pair("latency_avg_ms", lockLatencyStats.nCount ? lockLatencyStats.nTotalMillis / (int64_t)lockLatencyStats.nCount : 0));
+        obj.push_back(Pair("latency_max_ms", lockLatencyStats.nMaxMillis));
+
+        for (int i = 0; i < CLockLatencyStats::nBuckets; i++)
+        {
+            Object bucket;
+            if (i < CLockLatencyStats::nBuckets - 1)
+                bucket.push_back(Pair("le_ms", CLockLatencyStats::nBucketLimits[i]));
+            else
+                bucket.push_back(Pair("le_ms", "inf"));
+            bucket.push_back(Pair("count", (boost::int64_t)lockLatencyStats.vBucketCount[i]));
+            histogram.push_back(bucket);
+        }
+    }
+    obj.push_back(Pair("latency_histogram", histogram));
+    return obj;
+}
 
 Value masternode(const Array& params, bool fHelp)
 {
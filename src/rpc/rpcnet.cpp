@@ -308,11 +308,15 @@ Value getnettotals(const Array& params, bool fHelp)
         throw runtime_error(
             "getnettotals\n"
             "Returns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.");
+            "the size of the transaction relay cache and current time.");
 
     Object obj;
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
+    {
+        LOCK(cs_mapRelay);
+        obj.push_back(Pair("relaycachebytes", (uint64_t)nRelayMemoryUsage));
+    }
     obj.push_back(Pair("timemillis", GetTimeMillis()));
     return obj;
 }
@@ -7,6 +7,7 @@
 
 #include "misc/util.h"
 
+#include <errno.h>
 #include <stdint.h>
 
 #include <boost/algorithm/string.hpp>
@@ -58,7 +59,7 @@ static string rfc1123Time()
     return DateTimeStrFormat("%a, %d %b %Y %H:%M:%S +0000", GetTime());
 }
 
-string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
+string HTTPReply(int nStatus, const string& strMsg, bool keepalive, const char* pszContentType)
 {
     if (nStatus == HTTP_UNAUTHORIZED)
         return strprintf("HTTP/1.0 401 Authorization Required\r\n"
@@ -77,29 +78,34 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive)
             "</HEAD>\r\n"
             "<BODY><H1>401 Unauthorized.</H1></BODY>\r\n"
             "</HTML>\r\n", rfc1123Time(), FormatFullVersion());
+    return HTTPReplyHeader(nStatus, keepalive, strMsg.size(), false, pszContentType) + strMsg;
+}
+
+string HTTPReplyHeader(int nStatus, bool keepalive, size_t nContentLength, bool fChunked, const char* pszContentType)
+{
     const char *cStatus;
          if (nStatus == HTTP_OK) cStatus = "OK";
     else if (nStatus == HTTP_BAD_REQUEST) cStatus = "Bad Request";
     else if (nStatus == HTTP_FORBIDDEN) cStatus = "Forbidden";
     else if (nStatus == HTTP_NOT_FOUND) cStatus = "Not Found";
     else if (nStatus == HTTP_INTERNAL_SERVER_ERROR) cStatus = "Internal Server Error";
+    else if (nStatus == HTTP_SERVICE_UNAVAILABLE) cStatus = "Service Unavailable";
     else cStatus = "";
     return strprintf(
             "HTTP/1.1 %d %s\r\n"
             "Date: %s\r\n"
             "Connection: %s\r\n"
-            "Content-Length: %u\r\n"
-            "Content-Type: application/json\r\n"
+            "%s\r\n"
+            "Content-Type: %s\r\n"
             "Server: shardbit-json-rpc/%s\r\n"
-            "\r\n"
-            "%s",
+            "\r\n",
         nStatus,
         cStatus,
         rfc1123Time(),
         keepalive ? "keep-alive" : "close",
-        strMsg.size(),
-        FormatFullVersion(),
-        strMsg);
+        fChunked ? string("Transfer-Encoding: chunked") : strprintf("Content-Length: %u", nContentLength),
+        pszContentType,
+        FormatFullVersion());
 }
 
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
@@ -178,6 +184,54 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, map<string, string>& mapHe
 }
 
 
+// Read a body sent with "Transfer-Encoding: chunked": hex size lines each
+// followed by that many bytes, terminated by a zero-size chunk and trailers
+static int ReadHTTPChunkedBody(std::basic_istream<char>& stream, string& strMessageRet, size_t max_size)
+{
+    while (true)
+    {
+        string str;
+        std::getline(stream, str);
+        if (!stream)
+            return HTTP_INTERNAL_SERVER_ERROR;
+        // chunk size in hex, chunk extensions after ';' are ignored
+        const char* pszBegin = str.c_str();
+        char* pszEnd = NULL;
+        errno = 0;
+        unsigned long nChunk = strtoul(pszBegin, &pszEnd, 16);
+        if (pszEnd == pszBegin || !isxdigit((unsigned char)*pszBegin) || errno == ERANGE)
+            return HTTP_INTERNAL_SERVER_ERROR;
+        while (*pszEnd == ' ' || *pszEnd == '\t')
+            pszEnd++;
+        if (*pszEnd != ';' && *pszEnd != '\r' && *pszEnd != '\0')
+            return HTTP_INTERNAL_SERVER_ERROR;
+        if (nChunk == 0)
+            break;
+        if (nChunk > max_size - strMessageRet.size())
+            return HTTP_INTERNAL_SERVER_ERROR;
+
+        size_t nEnd = strMessageRet.size() + nChunk;
+        while (strMessageRet.size() < nEnd)
+        {
+            size_t ptr = strMessageRet.size();
+            size_t bytes_to_read = std::min(nEnd - ptr, POST_READ_SIZE);
+            strMessageRet.resize(ptr + bytes_to_read);
+            stream.read(&strMessageRet[ptr], bytes_to_read);
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // CRLF after the chunk data
+        std::getline(stream, str);
+        if (!stream || !(str.empty() || str == "\r"))
+            return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    // trailer headers, up to the empty line
+    map<string, string> mapTrailers;
+    ReadHTTPHeaders(stream, mapTrailers);
+    return HTTP_OK;
+}
+
 int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
                     string>& mapHeadersRet, string& strMessageRet,
                     int nProto, size_t max_size)
@@ -191,7 +245,13 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    if (mapHeadersRet.count("transfer-encoding") && boost::iequals(mapHeadersRet["transfer-encoding"], "chunked"))
+    {
+        int nStatus = ReadHTTPChunkedBody(stream, strMessageRet, max_size);
+        if (nStatus != HTTP_OK)
+            return nStatus;
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -264,3 +324,133 @@ Object JSONRPCError(int code, const string& message)
     error.push_back(Pair("message", message));
     return error;
 }
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey)
+    {
+        fAfterKey = false;
+        return;
+    }
+    if (vFirst.empty())
+        return;
+    if (vFirst.back())
+        vFirst.back() = false;
+    else
+        strBuffer += ',';
+}
+
+void CJSONStreamWriter::Append(const string& str)
+{
+    strBuffer += str;
+    if (strBuffer.size() >= nChunkSize)
+        Flush(false);
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    vFirst.push_back(true);
+    Append("{");
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    Append("}");
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    vFirst.push_back(true);
+    Append("[");
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    vFirst.pop_back();
+    Append("]");
+}
+
+void CJSONStreamWriter::Key(const string& strKey)
+{
+    assert(!vFirst.empty() && !fAfterKey);
+    Separate();
+    strBuffer += write_string(Value(strKey), false);
+    strBuffer += ':';
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    // Splitting containers costs a write_string call per element, so only
+    // the outer levels, where the bulk of a large result lives, are split.
+    bool fSplit = vFirst.size() < 2;
+    if (fSplit && value.type() == array_type)
+    {
+        BeginArray();
+        BOOST_FOREACH(const Value& element, value.get_array())
+            Write(element);
+        EndArray();
+    }
+    else if (fSplit && value.type() == obj_type)
+    {
+        BeginObject();
+        WriteMembers(value.get_obj());
+        EndObject();
+    }
+    else
+    {
+        Separate();
+        Append(write_string(value, false));
+    }
+}
+
+void CJSONStreamWriter::WriteMembers(const Object& obj)
+{
+    BOOST_FOREACH(const Pair& pair, obj)
+    {
+        Key(pair.name_);
+        Write(pair.value_);
+    }
+}
+
+void CJSONStreamWriter::Finish()
+{
+    assert(vFirst.empty());
+    strBuffer += '\n';
+    Flush(true);
+}
+
+void CHTTPReplyWriter::Flush(bool fFinal)
+{
+    if (!fStarted)
+    {
+        if (fFinal)
+        {
+            // the whole reply fit in the buffer, send it the usual way
+            stream << HTTPReply(HTTP_OK, strBuffer, fKeepAlive) << std::flush;
+            strBuffer.clear();
+            return;
+        }
+        // HTTP/1.0 clients can't take chunked replies, keep buffering
+        if (!fChunked)
+            return;
+        stream << HTTPReplyHeader(HTTP_OK, fKeepAlive, 0, true);
+        fStarted = true;
+    }
+
+    if (!strBuffer.empty())
+    {
+        stream << strprintf("%x\r\n", strBuffer.size());
+        stream.write(strBuffer.data(), strBuffer.size());
+        stream << "\r\n";
+        strBuffer.clear();
+    }
+    if (fFinal)
+        stream << "0\r\n\r\n";
+    stream << std::flush;
+}
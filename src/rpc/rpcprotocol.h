@@ -12,6 +12,10 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#endif
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -30,6 +34,7 @@ enum HTTPStatusCode
     HTTP_FORBIDDEN             = 403,
     HTTP_NOT_FOUND             = 404,
     HTTP_INTERNAL_SERVER_ERROR = 500,
+    HTTP_SERVICE_UNAVAILABLE   = 503,
 };
 
 // Bitcoin RPC error codes
@@ -78,10 +83,13 @@ enum RPCErrorCode
 template <typename Protocol>
 class SSLIOStreamDevice : public boost::iostreams::device<boost::iostreams::bidirectional> {
 public:
-    SSLIOStreamDevice(boost::asio::ssl::stream<typename Protocol::socket> &streamIn, bool fUseSSLIn) : stream(streamIn)
+    // reads give up and report end of stream after nReadTimeoutIn seconds
+    // without data, 0 waits forever
+    SSLIOStreamDevice(boost::asio::ssl::stream<typename Protocol::socket> &streamIn, bool fUseSSLIn, int nReadTimeoutIn = 0) : stream(streamIn)
     {
         fUseSSL = fUseSSLIn;
         fNeedHandshake = fUseSSLIn;
+        nReadTimeout = nReadTimeoutIn;
     }
 
     void handshake(boost::asio::ssl::stream_base::handshake_type role)
@@ -92,6 +100,8 @@ public:
     }
     std::streamsize read(char* s, std::streamsize n)
     {
+        if (!WaitReadable())
+            return -1;
         handshake(boost::asio::ssl::stream_base::server); // HTTPS servers read first
         if (fUseSSL) return stream.read_some(boost::asio::buffer(s, n));
         return stream.next_layer().read_some(boost::asio::buffer(s, n));
@@ -122,11 +132,43 @@ public:
 private:
     bool fNeedHandshake;
     bool fUseSSL;
+    int nReadTimeout;
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
+
+    // false if the read timeout passed without anything to read
+    bool WaitReadable()
+    {
+        if (nReadTimeout <= 0)
+            return true;
+        if (fUseSSL && !fNeedHandshake && SSL_pending(stream.native_handle()) > 0)
+            return true;
+
+        typename Protocol::socket::native_handle_type hSocket = stream.lowest_layer().native_handle();
+#ifdef WIN32
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        FD_SET(hSocket, &fdsetRecv);
+        struct timeval timeout;
+        timeout.tv_sec = nReadTimeout;
+        timeout.tv_usec = 0;
+        return select(hSocket + 1, &fdsetRecv, NULL, NULL, &timeout) > 0;
+#else
+        struct pollfd pfd;
+        pfd.fd = hSocket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        int nRet;
+        do
+            nRet = poll(&pfd, 1, nReadTimeout * 1000);
+        while (nRet < 0 && errno == EINTR);
+        return nRet > 0;
+#endif
+    }
 };
 
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
-std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive);
+std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive, const char* pszContentType = "application/json");
+std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t nContentLength, bool fChunked = false, const char* pszContentType = "application/json");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
@@ -138,4 +180,77 @@ json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
+// Streamed replies are sent in chunks of about this many bytes
+static const size_t RPC_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Writes JSON text incrementally, so large results never exist as a whole
+ * json_spirit::Value tree or as one string. Values are appended in document
+ * order with Begin/End calls for containers and Key() before each object
+ * member; separators are inserted automatically. The output is
+ * byte-for-byte what write_string(value, false) produces for the same tree.
+ *
+ * The base class only accumulates text (see str()); subclasses override
+ * Flush() to pass it on once the buffer grows past the chunk size.
+ */
+class CJSONStreamWriter
+{
+protected:
+    std::string strBuffer;
+    size_t nChunkSize;
+    // one entry per open container: true until its first element is written
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+
+    void Separate();
+    void Append(const std::string& str);
+
+    // Called when the buffer exceeds nChunkSize, and once with fFinal set
+    // from Finish(). Implementations consume strBuffer.
+    virtual void Flush(bool fFinal) {}
+
+public:
+    CJSONStreamWriter(size_t nChunkSizeIn = RPC_STREAM_CHUNK_SIZE) : nChunkSize(nChunkSizeIn), fAfterKey(false) {}
+    virtual ~CJSONStreamWriter() {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& strKey);
+    // Write a complete value; large arrays and objects near the top of the
+    // document are emitted member by member
+    void Write(const json_spirit::Value& value);
+    // Write the members of obj into the currently open object
+    void WriteMembers(const json_spirit::Object& obj);
+    void Finish();
+
+    const std::string& str() const { return strBuffer; }
+};
+
+/**
+ * Sends a JSON-RPC reply over HTTP. A reply that fits in one chunk goes out
+ * with a Content-Length header as before; a larger one switches to chunked
+ * transfer encoding on HTTP/1.1 connections. Once the first chunk has been
+ * sent the status line can no longer change, so an error after Started()
+ * can only be signalled by dropping the connection.
+ */
+class CHTTPReplyWriter : public CJSONStreamWriter
+{
+private:
+    std::ostream& stream;
+    bool fKeepAlive;
+    bool fChunked;
+    bool fStarted;
+
+protected:
+    void Flush(bool fFinal);
+
+public:
+    CHTTPReplyWriter(std::ostream& streamIn, bool fKeepAliveIn, bool fChunkedIn) :
+        stream(streamIn), fKeepAlive(fKeepAliveIn), fChunked(fChunkedIn), fStarted(false) {}
+
+    bool Started() const { return fStarted; }
+};
+
 #endif
@@ -91,13 +91,19 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
-        if (mi != mapBlockIndex.end() && (*mi).second)
+        CBlockIndex* pindex = NULL;
         {
-            CBlockIndex* pindex = (*mi).second;
-            if (pindex->IsInMainChain())
+            LOCK(cs_main);
+            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end())
+                pindex = (*mi).second;
+        }
+        if (pindex)
+        {
+            CChainSnapshotRef chain = GetChainSnapshot();
+            if (chain->Contains(pindex))
             {
-                entry.push_back(Pair("confirmations", 1 + nBestHeight - pindex->nHeight));
+                entry.push_back(Pair("confirmations", 1 + chain->nHeight - pindex->nHeight));
                 entry.push_back(Pair("time", (int64_t)pindex->nTime));
                 entry.push_back(Pair("blocktime", (int64_t)pindex->nTime));
             }
@@ -126,7 +132,8 @@ Value getrawtransaction(const Array& params, bool fHelp)
 
     CTransaction tx;
     uint256 hashBlock = 0;
-    if (!GetTransaction(hash, tx, hashBlock))
+    // only fall back to the locked lookup for transactions of disconnected blocks
+    if (!GetIndexedTransaction(hash, tx, hashBlock) && !GetTransaction(hash, tx, hashBlock))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
@@ -522,6 +529,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
+    CSignatureHasher hasher(mergedTx);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
@@ -535,14 +543,14 @@ Value signrawtransaction(const Array& params, bool fHelp)
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType, &hasher);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CTransaction& txv, txVariants)
         {
             txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
         }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0))
+        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0, &hasher))
             fComplete = false;
     }
 
@@ -601,7 +609,7 @@ Value sendrawtransaction(const Array& params, bool fHelp)
 }
 
 
-Value searchrawtransactions(const Array &params, bool fHelp)
+void searchrawtransactions(const Array &params, bool fHelp, CJSONStreamWriter& writer)
 {
     if (fHelp || params.size() < 1 || params.size() > 4)
         throw runtime_error(
@@ -636,7 +644,9 @@ Value searchrawtransactions(const Array &params, bool fHelp)
     std::vector<uint256>::const_iterator it = vtxhash.begin();
     while (it != vtxhash.end() && nSkip--) it++;
 
-    Array result;
+    // each transaction is read and written in turn, GetTransaction and
+    // TxToJSON take the locks they need
+    writer.BeginArray();
     while (it != vtxhash.end() && nCount--) {
         CTransaction tx;
         uint256 hashBlock;
@@ -645,7 +655,7 @@ Value searchrawtransactions(const Array &params, bool fHelp)
            // throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Cannot read transaction from disk");
            Object obj;
 	   obj.push_back(Pair("ERROR", "Cannot read transaction from disk"));
-	   result.push_back(obj);
+	   writer.Write(obj);
 	}
 	else
 	{
@@ -657,13 +667,13 @@ Value searchrawtransactions(const Array &params, bool fHelp)
             Object object;
             TxToJSON(tx, hashBlock, object);
             object.push_back(Pair("hex", strHex));
-            result.push_back(object);
+            writer.Write(object);
         } else {
-            result.push_back(strHex);
+            writer.Write(strHex);
         }
 
         }
         it++;
     }
-    return result;
+    writer.EndArray();
 }
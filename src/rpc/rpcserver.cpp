@@ -29,7 +29,11 @@
 #include <boost/iostreams/stream.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <deque>
 #include <list>
+#include <set>
 
 using namespace std;
 using namespace boost;
@@ -44,6 +48,62 @@ static map<string, boost::shared_ptr<deadline_timer> > deadlineTimers;
 static ssl::context* rpc_ssl_context = NULL;
 static boost::thread_group* rpc_worker_group = NULL;
 
+// default for -rpcservertimeout, in seconds
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
+// keep-alive connections parked at once beyond which new idle ones are closed
+static const unsigned int MAX_RPC_PARKED_CONNECTIONS = 256;
+
+// number of recent call durations kept per method for the percentiles in getrpcinfo
+static const unsigned int RPC_STATS_SAMPLES = 1024;
+
+/** Call counts and timings of one RPC method */
+class CRPCMethodStats
+{
+public:
+    uint64_t nCalls;
+    uint64_t nErrors;
+    int64_t nLockWaitTotal; // microseconds
+    int64_t nLockWaitMax;
+    int64_t nDurationMax;
+    std::vector<int64_t> vDuration; // most recent durations in microseconds, used as a ring
+    unsigned int nNext;
+
+    CRPCMethodStats()
+    {
+        nCalls = 0;
+        nErrors = 0;
+        nLockWaitTotal = 0;
+        nLockWaitMax = 0;
+        nDurationMax = 0;
+        nNext = 0;
+    }
+
+    void Add(int64_t nLockWait, int64_t nDuration, bool fError)
+    {
+        nCalls++;
+        if (fError)
+            nErrors++;
+        nLockWaitTotal += nLockWait;
+        nLockWaitMax = std::max(nLockWaitMax, nLockWait);
+        nDurationMax = std::max(nDurationMax, nDuration);
+
+        if (vDuration.size() < RPC_STATS_SAMPLES)
+            vDuration.push_back(nDuration);
+        else
+            vDuration[nNext] = nDuration;
+        nNext = (nNext + 1) % RPC_STATS_SAMPLES;
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static map<string, CRPCMethodStats> mapRPCStats;
+
+static void RecordRPCCall(const string& strMethod, int64_t nLockWait, int64_t nDuration, bool fError)
+{
+    LOCK(cs_rpcStats);
+    mapRPCStats[strMethod].Add(nLockWait, nDuration, fError);
+}
+
 void RPCTypeCheck(const Array& params,
                   const list<Value_type>& typesExpected,
                   bool fAllowNull)
@@ -210,6 +270,69 @@ Value stop(const Array& params, bool fHelp)
     return "Shardbit server stopping";
 }
 
+class RPCWorkQueue;
+static RPCWorkQueue* rpc_work_queue = NULL;
+static int nRPCWorkerThreads = 0;
+static size_t RPCWorkQueueDepth();
+
+Value getrpcinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcinfo\n"
+            "Returns an object containing RPC server statistics.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,              (numeric) worker threads\n"
+            "  \"work_queue\": n,           (numeric) connections waiting for a worker\n"
+            "  \"work_queue_max\": n,       (numeric) depth at which new requests are rejected\n"
+            "  \"methods\": {\n"
+            "    \"method\": {\n"
+            "      \"calls\": n,            (numeric) number of calls\n"
+            "      \"errors\": n,           (numeric) calls that returned an error\n"
+            "      \"p50_us\": n,           (numeric) median duration over recent calls\n"
+            "      \"p99_us\": n,           (numeric) 99th percentile duration over recent calls\n"
+            "      \"max_us\": n,           (numeric) longest call\n"
+            "      \"lock_wait_avg_us\": n, (numeric) average time spent acquiring cs_main/cs_wallet\n"
+            "      \"lock_wait_max_us\": n  (numeric) longest time spent acquiring cs_main/cs_wallet\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcinfo", "")
+            + HelpExampleRpc("getrpcinfo", "")
+        );
+
+    Object obj;
+    obj.push_back(Pair("threads",        nRPCWorkerThreads));
+    obj.push_back(Pair("work_queue",     (boost::int64_t)RPCWorkQueueDepth()));
+    obj.push_back(Pair("work_queue_max", GetArg("-rpcworkqueue", 16)));
+
+    Object methods;
+    {
+        LOCK(cs_rpcStats);
+        for (map<string, CRPCMethodStats>::const_iterator it = mapRPCStats.begin(); it != mapRPCStats.end(); ++it)
+        {
+            const CRPCMethodStats& stats = it->second;
+            std::vector<int64_t> vSorted(stats.vDuration);
+            std::sort(vSorted.begin(), vSorted.end());
+
+            Object entry;
+            entry.push_back(Pair("calls",            (boost::int64_t)stats.nCalls));
+            entry.push_back(Pair("errors",           (boost::int64_t)stats.nErrors));
+            entry.push_back(Pair("p50_us",           vSorted.empty() ? 0 : vSorted[(vSorted.size() - 1) * 50 / 100]));
+            entry.push_back(Pair("p99_us",           vSorted.empty() ? 0 : vSorted[(vSorted.size() - 1) * 99 / 100]));
+            entry.push_back(Pair("max_us",           stats.nDurationMax));
+            entry.push_back(Pair("lock_wait_avg_us", stats.nCalls ? stats.nLockWaitTotal / (int64_t)stats.nCalls : 0));
+            entry.push_back(Pair("lock_wait_max_us", stats.nLockWaitMax));
+            methods.push_back(Pair(it->first, entry));
+        }
+    }
+    obj.push_back(Pair("methods", methods));
+
+    return obj;
+}
+
 
 
 //
@@ -218,120 +341,123 @@ Value stop(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  ------------------------  -----------------------  ---------- ---------- ---------
-    { "help",                   &help,                   true,      true,      false },
-    { "stop",                   &stop,                   true,      true,      false },
-    { "getbestblockhash",       &getbestblockhash,       true,      false,     false },
-    { "getblockcount",          &getblockcount,          true,      false,     false },
-    { "getconnectioncount",     &getconnectioncount,     true,      false,     false },
-    { "getpeerinfo",            &getpeerinfo,            true,      false,     false },
-    { "addnode",                &addnode,                true,      true,      false },
-    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false },
-    { "ping",                   &ping,                   true,      false,     false },
-    { "setban",                 &setban,                 true,      false,     false },
-    { "listbanned",             &listbanned,             true,      false,     false },
-    { "clearbanned",            &clearbanned,            true,      false,     false },
-    { "getnettotals",           &getnettotals,           true,      true,      false },
-    { "getdifficulty",          &getdifficulty,          true,      false,     false },
-    { "getinfo",                &getinfo,                true,      false,     false },
-    { "moneysupply",            &moneysupply,            true,      false,     false },
-    { "getrawmempool",          &getrawmempool,          true,      false,     false },
-    { "getblock",               &getblock,               false,     false,     false },
-    { "getblockbynumber",       &getblockbynumber,       false,     false,     false },
-    { "getblockhash",           &getblockhash,           false,     false,     false },
-    { "getrawtransaction",      &getrawtransaction,      false,     false,     false },
-    { "createrawtransaction",   &createrawtransaction,   false,     false,     false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false },
-    { "decodescript",           &decodescript,           false,     false,     false },
-    { "signrawtransaction",     &signrawtransaction,     false,     false,     false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false },
-    { "getcheckpoint",          &getcheckpoint,          true,      false,     false },
-    { "sendalert",              &sendalert,              false,     false,     false },
-    { "listcoins",              &listcoins,              false,     false,     false },
-    { "validateaddress",        &validateaddress,        true,      false,     false },
-    { "validatepubkey",         &validatepubkey,         true,      false,     false },
-    { "verifymessage",          &verifymessage,          false,     false,     false },
-    { "searchrawtransactions",  &searchrawtransactions,  false,     false,     false },
+{ //  name                      actor (function)         okSafeMode threadSafe reqWallet  streamActor
+  //  ------------------------  -----------------------  ---------- ---------- ---------  -----------
+    { "help",                   &help,                   true,      true,      false,     NULL },
+    { "stop",                   &stop,                   true,      true,      false,     NULL },
+    { "getrpcinfo",             &getrpcinfo,             true,      true,      false,     NULL },
+    { "getbestblockhash",       &getbestblockhash,       true,      true,      false,     NULL },
+    { "getblockcount",          &getblockcount,          true,      true,      false,     NULL },
+    { "getconnectioncount",     &getconnectioncount,     true,      false,     false,     NULL },
+    { "getpeerinfo",            &getpeerinfo,            true,      false,     false,     NULL },
+    { "addnode",                &addnode,                true,      true,      false,     NULL },
+    { "getaddednodeinfo",       &getaddednodeinfo,       true,      true,      false,     NULL },
+    { "ping",                   &ping,                   true,      false,     false,     NULL },
+    { "setban",                 &setban,                 true,      false,     false,     NULL },
+    { "listbanned",             &listbanned,             true,      false,     false,     NULL },
+    { "clearbanned",            &clearbanned,            true,      false,     false,     NULL },
+    { "getnettotals",           &getnettotals,           true,      true,      false,     NULL },
+    { "getdifficulty",          &getdifficulty,          true,      true,      false,     NULL },
+    { "getinfo",                &getinfo,                true,      false,     false,     NULL },
+    { "moneysupply",            &moneysupply,            true,      false,     false,     NULL },
+    { "getrawmempool",          &StreamedRPC<&getrawmempool>, true, true, false, &getrawmempool },
+    { "getblock",               &StreamedRPC<&getblock>, false, true, false, &getblock },
+    { "getblockbynumber",       &StreamedRPC<&getblockbynumber>, false, true, false, &getblockbynumber },
+    { "getblockhash",           &getblockhash,           false,     true,      false,     NULL },
+    { "getrawtransaction",      &getrawtransaction,      false,     true,      false,     NULL },
+    { "createrawtransaction",   &createrawtransaction,   false,     false,     false,     NULL },
+    { "decoderawtransaction",   &decoderawtransaction,   false,     false,     false,     NULL },
+    { "decodescript",           &decodescript,           false,     false,     false,     NULL },
+    { "signrawtransaction",     &signrawtransaction,     false,     false,     false,     NULL },
+    { "sendrawtransaction",     &sendrawtransaction,     false,     false,     false,     NULL },
+    { "getcheckpoint",          &getcheckpoint,          true,      false,     false,     NULL },
+    { "gettxdbinfo",            &gettxdbinfo,            true,      true,      false,     NULL },
+    { "sendalert",              &sendalert,              false,     false,     false,     NULL },
+    { "listcoins",              &listcoins,              false,     false,     false,     NULL },
+    { "validateaddress",        &validateaddress,        true,      false,     false,     NULL },
+    { "validatepubkey",         &validatepubkey,         true,      false,     false,     NULL },
+    { "verifymessage",          &verifymessage,          false,     false,     false,     NULL },
+    { "searchrawtransactions",  &StreamedRPC<&searchrawtransactions>, false, true, false, &searchrawtransactions },
 
 /* Dark features */
-    { "spork",                  &spork,                  true,      false,      false },
-    { "masternode",             &masternode,             true,      false,      true },
-    { "masternodelist",         &masternodelist,         true,      false,      false },
+    { "spork",                  &spork,                  true,      false,      false,     NULL },
+    { "masternode",             &masternode,             true,      false,      true,      NULL },
+    { "masternodelist",         &masternodelist,         true,      false,      false,     NULL },
+    { "getinstantxinfo",        &getinstantxinfo,        true,      true,       false,     NULL },
 
 #ifdef ENABLE_WALLET
-    { "darksend",               &darksend,               false,     false,      true },
-    { "getmininginfo",          &getmininginfo,          true,      false,     false },
-    { "getnetworkhashps",       &getnetworkhashps,       true,      false,     false },
-    { "getstakinginfo",         &getstakinginfo,         true,      false,     false },
-    { "getnewaddress",          &getnewaddress,          true,      false,     true },
-    { "getnewpubkey",           &getnewpubkey,           true,      false,     true },
-    { "getaccountaddress",      &getaccountaddress,      true,      false,     true },
-    { "setaccount",             &setaccount,             true,      false,     true },
-    { "getaccount",             &getaccount,             false,     false,     true },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true },
-    { "sendtoaddress",          &sendtoaddress,          false,     false,     true },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true },
-    { "backupwallet",           &backupwallet,           true,      false,     true },
-    { "keypoolrefill",          &keypoolrefill,          true,      false,     true },
-    { "walletpassphrase",       &walletpassphrase,       true,      false,     true },
-    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true },
-    { "walletlock",             &walletlock,             true,      false,     true },
-    { "encryptwallet",          &encryptwallet,          false,     false,     true },
-    { "getbalance",             &getbalance,             false,     false,     true },
-    { "move",                   &movecmd,                false,     false,     true },
-    { "sendfrom",               &sendfrom,               false,     false,     true },
-    { "sendmany",               &sendmany,               false,     false,     true },
-    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true },
-    { "addredeemscript",        &addredeemscript,        false,     false,     true },
-    { "gettransaction",         &gettransaction,         false,     false,     true },
-    { "listtransactions",       &listtransactions,       false,     false,     true },
-    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true },
-    { "signmessage",            &signmessage,            false,     false,     true },
-    { "getwork",                &getwork,                true,      false,     true },
-    { "getworkex",              &getworkex,              true,      false,     true },
-    { "listaccounts",           &listaccounts,           false,     false,     true },
-    { "getblocktemplate",       &getblocktemplate,       true,      false,     false },
-    { "submitblock",            &submitblock,            false,     false,     false },
-    { "listsinceblock",         &listsinceblock,         false,     false,     true },
-    { "dumpprivkey",            &dumpprivkey,            false,     false,     true },
-    { "dumpwallet",             &dumpwallet,             true,      false,     true },
-    { "importprivkey",          &importprivkey,          false,     false,     true },
-    { "importwallet",           &importwallet,           false,     false,     true },
-    { "importaddress",          &importaddress,          false,     false,     true },
-    { "listunspent",            &listunspent,            false,     false,     true },
-    { "settxfee",               &settxfee,               false,     false,     true },
-    { "getsubsidy",             &getsubsidy,             true,      true,      false },
-    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false },
-    { "reservebalance",         &reservebalance,         false,     true,      true },
-    { "createmultisig",         &createmultisig,         true,      true,      false },
-    { "checkwallet",            &checkwallet,            false,     true,      true },
-    { "repairwallet",           &repairwallet,           false,     true,      true },
-    { "resendtx",               &resendtx,               false,     true,      true },
-    { "makekeypair",            &makekeypair,            false,     true,      false },
-    { "checkkernel",            &checkkernel,            true,      false,     true },
-    { "getnewstealthaddress",   &getnewstealthaddress,   false,     false,     true },
-    { "liststealthaddresses",   &liststealthaddresses,   false,     false,     true },
-    { "scanforalltxns",         &scanforalltxns,         false,     false,     false },
-    { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false },
-    { "importstealthaddress",   &importstealthaddress,   false,     false,     true },
-    { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     true },
-    { "smsgenable",             &smsgenable,             false,     false,     false },
-    { "smsgdisable",            &smsgdisable,            false,     false,     false },
-    { "smsglocalkeys",          &smsglocalkeys,          false,     false,     false },
-    { "smsgoptions",            &smsgoptions,            false,     false,     false },
-    { "smsgscanchain",          &smsgscanchain,          false,     false,     false },
-    { "smsgscanbuckets",        &smsgscanbuckets,        false,     false,     false },
-    { "smsgaddkey",             &smsgaddkey,             false,     false,     false },
-    { "smsggetpubkey",          &smsggetpubkey,          false,     false,     false },
-    { "smsgsend",               &smsgsend,               false,     false,     false },
-    { "smsgsendanon",           &smsgsendanon,           false,     false,     false },
-    { "smsginbox",              &smsginbox,              false,     false,     false },
-    { "smsgoutbox",             &smsgoutbox,             false,     false,     false },
-    { "smsgbuckets",            &smsgbuckets,            false,     false,     false },
+    { "darksend",               &darksend,               false,     false,      true,      NULL },
+    { "getmininginfo",          &getmininginfo,          true,      false,     false,     NULL },
+    { "getnetworkhashps",       &getnetworkhashps,       true,      false,     false,     NULL },
+    { "getstakinginfo",         &getstakinginfo,         true,      false,     false,     NULL },
+    { "getnewaddress",          &getnewaddress,          true,      false,     true,      NULL },
+    { "getnewpubkey",           &getnewpubkey,           true,      false,     true,      NULL },
+    { "getaccountaddress",      &getaccountaddress,      true,      false,     true,      NULL },
+    { "setaccount",             &setaccount,             true,      false,     true,      NULL },
+    { "getaccount",             &getaccount,             false,     false,     true,      NULL },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,     true,      NULL },
+    { "sendtoaddress",          &sendtoaddress,          false,     false,     true,      NULL },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,     true,      NULL },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,     true,      NULL },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,     true,      NULL },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,     true,      NULL },
+    { "backupwallet",           &backupwallet,           true,      false,     true,      NULL },
+    { "keypoolrefill",          &keypoolrefill,          true,      false,     true,      NULL },
+    { "walletpassphrase",       &walletpassphrase,       true,      false,     true,      NULL },
+    { "walletpassphrasechange", &walletpassphrasechange, false,     false,     true,      NULL },
+    { "walletlock",             &walletlock,             true,      false,     true,      NULL },
+    { "encryptwallet",          &encryptwallet,          false,     false,     true,      NULL },
+    { "getbalance",             &getbalance,             false,     false,     true,      NULL },
+    { "move",                   &movecmd,                false,     false,     true,      NULL },
+    { "sendfrom",               &sendfrom,               false,     false,     true,      NULL },
+    { "sendmany",               &sendmany,               false,     false,     true,      NULL },
+    { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true,      NULL },
+    { "addredeemscript",        &addredeemscript,        false,     false,     true,      NULL },
+    { "gettransaction",         &gettransaction,         false,     false,     true,      NULL },
+    { "listtransactions",       &listtransactions,       false,     false,     true,      NULL },
+    { "listaddressgroupings",   &listaddressgroupings,   false,     false,     true,      NULL },
+    { "signmessage",            &signmessage,            false,     false,     true,      NULL },
+    { "getwork",                &getwork,                true,      false,     true,      NULL },
+    { "getworkex",              &getworkex,              true,      false,     true,      NULL },
+    { "listaccounts",           &listaccounts,           false,     false,     true,      NULL },
+    { "getblocktemplate",       &getblocktemplate,       true,      false,     false,     NULL },
+    { "submitblock",            &submitblock,            false,     false,     false,     NULL },
+    { "listsinceblock",         &listsinceblock,         false,     false,     true,      NULL },
+    { "dumpprivkey",            &dumpprivkey,            false,     false,     true,      NULL },
+    { "dumpwallet",             &dumpwallet,             true,      false,     true,      NULL },
+    { "importprivkey",          &importprivkey,          false,     false,     true,      NULL },
+    { "importwallet",           &importwallet,           false,     false,     true,      NULL },
+    { "importaddress",          &importaddress,          false,     false,     true,      NULL },
+    { "listunspent",            &listunspent,            false,     false,     true,      NULL },
+    { "settxfee",               &settxfee,               false,     false,     true,      NULL },
+    { "getsubsidy",             &getsubsidy,             true,      true,      false,     NULL },
+    { "getstakesubsidy",        &getstakesubsidy,        true,      true,      false,     NULL },
+    { "reservebalance",         &reservebalance,         false,     true,      true,      NULL },
+    { "createmultisig",         &createmultisig,         true,      true,      false,     NULL },
+    { "checkwallet",            &checkwallet,            false,     true,      true,      NULL },
+    { "repairwallet",           &repairwallet,           false,     true,      true,      NULL },
+    { "resendtx",               &resendtx,               false,     true,      true,      NULL },
+    { "makekeypair",            &makekeypair,            false,     true,      false,     NULL },
+    { "checkkernel",            &checkkernel,            true,      false,     true,      NULL },
+    { "getnewstealthaddress",   &getnewstealthaddress,   false,     false,     true,      NULL },
+    { "liststealthaddresses",   &liststealthaddresses,   false,     false,     true,      NULL },
+    { "scanforalltxns",         &scanforalltxns,         false,     false,     false,     NULL },
+    { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false,     NULL },
+    { "importstealthaddress",   &importstealthaddress,   false,     false,     true,      NULL },
+    { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     true,      NULL },
+    { "smsgenable",             &smsgenable,             false,     false,     false,     NULL },
+    { "smsgdisable",            &smsgdisable,            false,     false,     false,     NULL },
+    { "smsglocalkeys",          &smsglocalkeys,          false,     false,     false,     NULL },
+    { "smsgoptions",            &smsgoptions,            false,     false,     false,     NULL },
+    { "smsgscanchain",          &smsgscanchain,          false,     false,     false,     NULL },
+    { "smsgscanbuckets",        &smsgscanbuckets,        false,     false,     false,     NULL },
+    { "smsgaddkey",             &smsgaddkey,             false,     false,     false,     NULL },
+    { "smsggetpubkey",          &smsggetpubkey,          false,     false,     false,     NULL },
+    { "smsgsend",               &smsgsend,               false,     false,     false,     NULL },
+    { "smsgsendanon",           &smsgsendanon,           false,     false,     false,     NULL },
+    { "smsginbox",              &smsginbox,              false,     false,     false,     NULL },
+    { "smsgoutbox",             &smsgoutbox,             false,     false,     false,     NULL },
+    { "smsgbuckets",            &smsgbuckets,            false,     false,     false,     NULL },
 #endif
 };
 
@@ -408,6 +534,13 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+    // part of the next request has already been read off the socket
+    virtual bool has_buffered_request() = 0;
+    // call handler from the io_service once the socket has data to read
+    virtual void async_wait_readable(boost::function<void(const boost::system::error_code&)> handler) = 0;
+    // call handler from the io_service after nSeconds, unless cancelled
+    virtual void async_wait_idle(int nSeconds, boost::function<void(const boost::system::error_code&)> handler) = 0;
+    virtual void cancel_idle() = 0;
 };
 
 template <typename Protocol>
@@ -417,10 +550,13 @@ public:
     AcceptedConnectionImpl(
             asio::io_service& io_service,
             ssl::context &context,
-            bool fUseSSL) :
+            bool fUseSSL,
+            int nReadTimeout) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        _d(sslStream, fUseSSL, nReadTimeout),
+        _stream(_d),
+        fUseSSL(fUseSSL),
+        idleTimer(io_service)
     {
     }
 
@@ -439,15 +575,215 @@ public:
         _stream.close();
     }
 
+    virtual bool has_buffered_request()
+    {
+        if (_stream.rdbuf()->in_avail() > 0)
+            return true;
+        return fUseSSL && SSL_pending(sslStream.native_handle()) > 0;
+    }
+
+    virtual void async_wait_readable(boost::function<void(const boost::system::error_code&)> handler)
+    {
+        sslStream.next_layer().async_read_some(asio::null_buffers(), boost::bind(handler, asio::placeholders::error));
+    }
+
+    virtual void async_wait_idle(int nSeconds, boost::function<void(const boost::system::error_code&)> handler)
+    {
+        idleTimer.expires_from_now(posix_time::seconds(nSeconds));
+        idleTimer.async_wait(handler);
+    }
+
+    virtual void cancel_idle()
+    {
+        idleTimer.cancel();
+    }
+
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
     SSLIOStreamDevice<Protocol> _d;
     iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
+    bool fUseSSL;
+    deadline_timer idleTimer;
 };
 
-void ServiceConnection(AcceptedConnection *conn);
+/**
+ * Connections with a request waiting, handed from the io_service thread to
+ * the RPC worker threads. The depth is bounded so a burst of calls behind a
+ * slow command gets a 503 instead of piling up.
+ */
+class RPCWorkQueue
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<AcceptedConnection*> queue;
+    size_t nMaxDepth;
+    bool fRunning;
+
+public:
+    RPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    ~RPCWorkQueue()
+    {
+        BOOST_FOREACH(AcceptedConnection* conn, queue)
+        {
+            conn->close();
+            delete conn;
+        }
+    }
+
+    bool Enqueue(AcceptedConnection* conn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(conn);
+        cond.notify_one();
+        return true;
+    }
+
+    // wait for a connection, NULL once the queue is interrupted
+    AcceptedConnection* Dequeue()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (fRunning && queue.empty())
+            cond.wait(lock);
+        if (!fRunning)
+            return NULL;
+        AcceptedConnection* conn = queue.front();
+        queue.pop_front();
+        return conn;
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        cond.notify_all();
+    }
+
+    size_t Depth()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return queue.size();
+    }
+};
+
+static size_t RPCWorkQueueDepth()
+{
+    return rpc_work_queue ? rpc_work_queue->Depth() : 0;
+}
+
+bool ServiceConnection(AcceptedConnection *conn);
+
+static void RPCRequestReady(AcceptedConnection* conn, uint64_t nParkId, bool fUseSSL, const boost::system::error_code& error);
+static void RPCIdleTimeout(AcceptedConnection* conn, uint64_t nParkId, const boost::system::error_code& error);
+
+// Connections parked by RPCWaitForRequest, each with the id of its current
+// wait. Both the readiness and the idle timeout handler claim the connection
+// by removing it here; the one that finds it gone must not touch it, as the
+// other may already have freed it. Handlers never run once the io_service is
+// stopped, so StopRPCThreads frees what is left.
+static boost::mutex cs_parkedConnections;
+static std::map<AcceptedConnection*, uint64_t> mapParkedConnections;
+static uint64_t nLastParkId = 0;
+
+// seconds a connection may sit idle between requests, or stall within one
+static int nRPCServerTimeout = DEFAULT_RPC_SERVER_TIMEOUT;
+
+static bool RPCUnpark(AcceptedConnection* conn, uint64_t nParkId)
+{
+    boost::unique_lock<boost::mutex> lock(cs_parkedConnections);
+    std::map<AcceptedConnection*, uint64_t>::iterator it = mapParkedConnections.find(conn);
+    if (it == mapParkedConnections.end() || it->second != nParkId)
+        return false;
+    mapParkedConnections.erase(it);
+    return true;
+}
+
+/**
+ * Park a connection on the io_service until its next request arrives, so idle
+ * keep-alive connections don't hold a worker thread.
+ */
+static void RPCWaitForRequest(AcceptedConnection* conn, bool fUseSSL)
+{
+    uint64_t nParkId;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_parkedConnections);
+        if (mapParkedConnections.size() >= MAX_RPC_PARKED_CONNECTIONS)
+            nParkId = 0;
+        else
+        {
+            nParkId = ++nLastParkId;
+            mapParkedConnections[conn] = nParkId;
+        }
+    }
+    if (nParkId == 0)
+    {
+        LogPrint("rpc", "Too many idle RPC connections, closing %s\n", conn->peer_address_to_string());
+        conn->close();
+        delete conn;
+        return;
+    }
+
+    // The timer first: once the read wait is started another thread may
+    // take the connection over
+    conn->async_wait_idle(nRPCServerTimeout, boost::bind(&RPCIdleTimeout, conn, nParkId, boost::asio::placeholders::error));
+    conn->async_wait_readable(boost::bind(&RPCRequestReady, conn, nParkId, fUseSSL, boost::asio::placeholders::error));
+}
+
+static void RPCIdleTimeout(AcceptedConnection* conn, uint64_t nParkId, const boost::system::error_code& error)
+{
+    if (error == asio::error::operation_aborted || !RPCUnpark(conn, nParkId))
+        return;
+
+    LogPrint("rpc", "Closing idle RPC connection from %s\n", conn->peer_address_to_string());
+    conn->close();
+    delete conn;
+}
+
+static void RPCRequestReady(AcceptedConnection* conn, uint64_t nParkId, bool fUseSSL, const boost::system::error_code& error)
+{
+    if (!RPCUnpark(conn, nParkId))
+        return;
+    conn->cancel_idle();
+
+    if (error)
+    {
+        conn->close();
+        delete conn;
+        return;
+    }
+
+    if (!rpc_work_queue || !rpc_work_queue->Enqueue(conn))
+    {
+        LogPrint("rpc", "ThreadRPCServer work queue depth exceeded, rejecting %s\n", conn->peer_address_to_string());
+        // As with 403, don't start an SSL handshake on the io_service thread
+        if (!fUseSSL)
+            conn->stream() << HTTPReply(HTTP_SERVICE_UNAVAILABLE, "", false) << std::flush;
+        conn->close();
+        delete conn;
+    }
+}
+
+static void RPCWorkerThread(bool fUseSSL)
+{
+    RenameThread("shardbit-rpcworker");
+
+    AcceptedConnection* conn;
+    while ((conn = rpc_work_queue->Dequeue()) != NULL)
+    {
+        if (ServiceConnection(conn))
+            RPCWaitForRequest(conn, fUseSSL);
+        else
+        {
+            conn->close();
+            delete conn;
+        }
+    }
+}
 
 // Forward declaration required for RPCListen
 template <typename Protocol>
@@ -466,7 +802,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol> > accep
                    const bool fUseSSL)
 {
     // Accept connection
-    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL);
+    AcceptedConnectionImpl<Protocol>* conn = new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL, nRPCServerTimeout);
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -513,9 +849,7 @@ static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol>
         delete conn;
     }
     else {
-        ServiceConnection(conn);
-        conn->close();
-        delete conn;
+        RPCWaitForRequest(conn, fUseSSL);
     }
 }
 
@@ -556,6 +890,7 @@ void StartRPCThreads()
     rpc_ssl_context = new ssl::context(ssl::context::sslv23);
 
     const bool fUseSSL = GetBoolArg("-rpcssl", false);
+    nRPCServerTimeout = std::max((int)GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT), 1);
 
     if (fUseSSL)
     {
@@ -633,9 +968,15 @@ void StartRPCThreads()
         return;
     }
 
+    // One thread drives the io_service (accepts, readiness and timers), the
+    // calls themselves run on the worker threads.
+    rpc_work_queue = new RPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", 16), 1));
+    nRPCWorkerThreads = std::max((int)GetArg("-rpcthreads", 4), 1);
+
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nRPCWorkerThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&RPCWorkerThread, fUseSSL));
 }
 
 void StopRPCThreads()
@@ -644,9 +985,23 @@ void StopRPCThreads()
 
     deadlineTimers.clear();
     rpc_io_service->stop();
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
+
+    // idle keep-alive connections, before the io_service their sockets use
+    {
+        boost::unique_lock<boost::mutex> lock(cs_parkedConnections);
+        for (std::map<AcceptedConnection*, uint64_t>::iterator it = mapParkedConnections.begin(); it != mapParkedConnections.end(); ++it)
+        {
+            it->first->close();
+            delete it->first;
+        }
+        mapParkedConnections.clear();
+    }
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -745,7 +1100,12 @@ static string JSONRPCExecBatch(const Array& vReq)
     return write_string(Value(ret), false) + "\n";
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/**
+ * Serve the requests available on a connection. Pipelined requests that are
+ * already buffered are answered in order; returns true if the connection is
+ * kept alive and should wait for its next request.
+ */
+bool ServiceConnection(AcceptedConnection *conn)
 {
     bool fRun = true;
     while (fRun)
@@ -756,21 +1116,38 @@ void ServiceConnection(AcceptedConnection *conn)
 
         // Read HTTP request line
         if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+            return false;
 
         // Read HTTP message headers and body
         ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+        // the read timed out or the peer went away part way through the
+        // request, don't act on what was read
+        if (!conn->stream())
+            return false;
+
+        // REST requests are served without authentication when -rest is set,
+        // the listener still only accepts -rpcallowip peers
+        if (boost::starts_with(strURI, "/rest/") && GetBoolArg("-rest", false))
+        {
+            if (mapHeaders["connection"] == "close")
+                fRun = false;
+            if (!HTTPReq_REST(conn->stream(), strMethod, strURI, fRun, nProto >= 1))
+                return false;
+            if (!conn->has_buffered_request())
+                break;
+            continue;
+        }
 
         if (strURI != "/") {
             conn->stream() << HTTPReply(HTTP_NOT_FOUND, "", false) << std::flush;
-            break;
+            return false;
         }
 
         // Check authorization
         if (mapHeaders.count("authorization") == 0)
         {
             conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            return false;
         }
         if (!HTTPAuthorized(mapHeaders))
         {
@@ -782,12 +1159,14 @@ void ServiceConnection(AcceptedConnection *conn)
                 MilliSleep(250);
 
             conn->stream() << HTTPReply(HTTP_UNAUTHORIZED, "", false) << std::flush;
-            break;
+            return false;
         }
         if (mapHeaders["connection"] == "close")
             fRun = false;
 
         JSONRequest jreq;
+        // chunked replies need HTTP/1.1
+        CHTTPReplyWriter writer(conn->stream(), fRun, nProto >= 1);
         try
         {
             // Parse request
@@ -795,39 +1174,53 @@ void ServiceConnection(AcceptedConnection *conn)
             if (!read_string(strRequest, valRequest))
                 throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
-            string strReply;
-
-            // singleton request
+            // singleton request, the reply is written as it is produced
             if (valRequest.type() == obj_type) {
                 jreq.parse(valRequest);
 
-                Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-                // Send reply
-                strReply = JSONRPCReply(result, Value::null, jreq.id);
+                writer.BeginObject();
+                writer.Key("result");
+                tableRPC.execute(jreq.strMethod, jreq.params, writer);
+                writer.Key("error");
+                writer.Write(Value::null);
+                writer.Key("id");
+                writer.Write(jreq.id);
+                writer.EndObject();
+                writer.Finish();
 
             // array of requests
             } else if (valRequest.type() == array_type)
-                strReply = JSONRPCExecBatch(valRequest.get_array());
+                conn->stream() << HTTPReply(HTTP_OK, JSONRPCExecBatch(valRequest.get_array()), fRun) << std::flush;
             else
                 throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-            conn->stream() << HTTPReply(HTTP_OK, strReply, fRun) << std::flush;
         }
         catch (Object& objError)
         {
-            ErrorReply(conn->stream(), objError, jreq.id);
-            break;
+            // after the first chunk the status is sent, so the client can
+            // only learn about the failure from the truncated reply
+            if (writer.Started())
+                LogPrintf("ThreadRPCServer %s failed while streaming its reply: %s\n", jreq.strMethod, write_string(Value(objError), false));
+            else
+                ErrorReply(conn->stream(), objError, jreq.id);
+            return false;
         }
         catch (std::exception& e)
         {
-            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-            break;
+            if (writer.Started())
+                LogPrintf("ThreadRPCServer %s failed while streaming its reply: %s\n", jreq.strMethod, e.what());
+            else
+                ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+            return false;
         }
+
+        if (!conn->has_buffered_request())
+            break;
     }
+
+    return fRun;
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+const CRPCCommand* CRPCTable::find(const std::string &strMethod) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -844,32 +1237,72 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    Value result;
+    run(find(strMethod), params, result, NULL);
+    return result;
+}
+
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONStreamWriter& writer) const
+{
+    const CRPCCommand *pcmd = find(strMethod);
+    Value result;
+    run(pcmd, params, result, &writer);
+    // a plain command's result is serialized after its locks are released
+    if (!pcmd->streamActor)
+        writer.Write(result);
+}
+
+static void RunActor(const CRPCCommand *pcmd, const json_spirit::Array &params, json_spirit::Value& result, CJSONStreamWriter* pwriter)
+{
+    if (pwriter && pcmd->streamActor)
+        pcmd->streamActor(params, false, *pwriter);
+    else
+        result = pcmd->actor(params, false);
+}
+
+void CRPCTable::run(const CRPCCommand *pcmd, const json_spirit::Array &params, json_spirit::Value& result, CJSONStreamWriter* pwriter) const
+{
+    int64_t nStart = GetTimeMicros();
+    int64_t nLockWait = 0;
     try
     {
         // Execute
-        Value result;
         {
             if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
+                RunActor(pcmd, params, result, pwriter);
 #ifdef ENABLE_WALLET
             else if (!pwalletMain) {
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nStart;
+                RunActor(pcmd, params, result, pwriter);
             } else {
                 LOCK2(cs_main, pwalletMain->cs_wallet);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nStart;
+                RunActor(pcmd, params, result, pwriter);
             }
 #else // ENABLE_WALLET
             else {
                 LOCK(cs_main);
-                result = pcmd->actor(params, false);
+                nLockWait = GetTimeMicros() - nStart;
+                RunActor(pcmd, params, result, pwriter);
             }
 #endif // !ENABLE_WALLET
         }
-        return result;
+        RecordRPCCall(pcmd->name, nLockWait, GetTimeMicros() - nStart, false);
+    }
+    catch (Object& objError)
+    {
+        RecordRPCCall(pcmd->name, nLockWait, GetTimeMicros() - nStart, true);
+        throw;
     }
     catch (std::exception& e)
     {
+        RecordRPCCall(pcmd->name, nLockWait, GetTimeMicros() - nStart, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 }
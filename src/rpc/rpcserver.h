@@ -9,9 +9,11 @@
 #include "misc/uint256.h"
 #include "rpcprotocol.h"
 
+#include <limits>
 #include <list>
 #include <map>
 
+class CBlock;
 class CBlockIndex;
 
 void StartRPCThreads();
@@ -38,6 +40,10 @@ void RPCTypeCheck(const json_spirit::Object& o,
 void RPCRunLater(const std::string& name, boost::function<void(void)> func, int64_t nSeconds);
 
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+// Commands with large results write them to the reply as they are produced.
+// They run without cs_main when the command is thread safe, which is
+// required in practice, as writing may block on a slow client.
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -47,8 +53,24 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    rpcstreamfn_type streamActor; // optional, NULL if the command only returns a Value
 };
 
+/**
+ * Value adapter for streaming commands, for help, batch requests and the
+ * GUI console. The command writes into a memory buffer that is parsed back.
+ */
+template<rpcstreamfn_type F>
+json_spirit::Value StreamedRPC(const json_spirit::Array& params, bool fHelp)
+{
+    CJSONStreamWriter writer(std::numeric_limits<size_t>::max());
+    F(params, fHelp, writer);
+    json_spirit::Value result;
+    if (!json_spirit::read_string(writer.str(), result))
+        throw std::runtime_error("StreamedRPC() : invalid JSON written");
+    return result;
+}
+
 /**
  * Bitcoin RPC command dispatcher.
  */
@@ -69,6 +91,17 @@ public:
      * @throws an exception (json_spirit::Value) when an error happens.
      */
     json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+
+    /**
+     * Execute a method and write its result to writer, incrementally if
+     * the command has a streaming implementation.
+     * @throws as above; the writer may hold partial output in that case.
+     */
+    void execute(const std::string &method, const json_spirit::Array &params, CJSONStreamWriter& writer) const;
+
+private:
+    const CRPCCommand* find(const std::string &method) const;
+    void run(const CRPCCommand *pcmd, const json_spirit::Array &params, json_spirit::Value& result, CJSONStreamWriter* pwriter) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -80,6 +113,23 @@ extern int64_t nWalletUnlockTime;
 extern int64_t AmountFromValue(const json_spirit::Value& value);
 extern json_spirit::Value ValueFromAmount(int64_t amount);
 extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool fPrintTransactionDetail, CJSONStreamWriter& writer);
+
+// in rest.cpp; answers a /rest/ request, returns false if the connection
+// should be closed afterwards
+extern bool HTTPReq_REST(std::ostream& stream, const std::string& strMethod, const std::string& strURI, bool fRun, bool fChunked);
+
+// reply formats of the /rest/ requests, picked by the extension
+enum RetFormat {
+    RF_UNDEF,
+    RF_BINARY,
+    RF_HEX,
+    RF_JSON,
+};
+// split "<path>.<format>", params[0] receives the path
+extern enum RetFormat ParseDataFormat(std::vector<std::string>& params, const std::string& strReq);
+// reply with a block copied straight from its block file, nBlockPos as in CBlockIndex
+extern void WriteRawBlock(std::ostream& stream, unsigned int nFile, unsigned int nBlockPos, enum RetFormat rf, bool fRun);
 
 extern double GetPoWMHashPS();
 extern double GetPoSKernelPS();
@@ -159,6 +209,7 @@ extern json_spirit::Value walletlock(const json_spirit::Array& params, bool fHel
 extern json_spirit::Value encryptwallet(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value validateaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrpcinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value moneysupply(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value reservebalance(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value addmultisigaddress(const json_spirit::Array& params, bool fHelp);
@@ -171,7 +222,7 @@ extern json_spirit::Value validatepubkey(const json_spirit::Array& params, bool
 extern json_spirit::Value getnewpubkey(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
-extern json_spirit::Value searchrawtransactions(const json_spirit::Array& params, bool fHelp);
+extern void searchrawtransactions(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -184,11 +235,12 @@ extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, boo
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern void getrawmempool(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
-extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
+extern void getblock(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
+extern void getblockbynumber(const json_spirit::Array& params, bool fHelp, CJSONStreamWriter& writer);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value gettxdbinfo(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 
 extern json_spirit::Value getnewstealthaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value liststealthaddresses(const json_spirit::Array& params, bool fHelp);
@@ -201,6 +253,7 @@ extern json_spirit::Value darksend(const json_spirit::Array& params, bool fHelp)
 extern json_spirit::Value spork(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value masternode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value masternodelist(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getinstantxinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value smsgenable(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value smsgdisable(const json_spirit::Array& params, bool fHelp);
@@ -793,7 +793,12 @@ Value smsgbuckets(const Array& params, bool fHelp)
         uint32_t nMessages = 0;
         uint64_t nBytes = 0;
         {
-            LOCK(cs_smsg);
+            LOCK2(cs_smsg, cs_smsgDB);
+
+            SecMsgDB dbStore;
+            if (!dbStore.Open("cr+"))
+                throw runtime_error("Could not open DB.");
+
             std::map<int64_t, SecMsgBucket>::iterator it;
             it = smsgBuckets.begin();
 
@@ -802,12 +807,11 @@ Value smsgbuckets(const Array& params, bool fHelp)
                 std::set<SecMsgToken>& tokenSet = it->second.setTokens;
 
                 std::string sBucket = boost::lexical_cast<std::string>(it->first);
-                std::string sFile = sBucket + "_01.dat";
 
                 snprintf(cbuf, sizeof(cbuf), "%" PRIszu, tokenSet.size());
                 std::string snContents(cbuf);
 
-                std::string sHash = boost::lexical_cast<std::string>(it->second.hash);
+                std::string sHash = boost::lexical_cast<std::string>(it->second.getHash());
 
                 nBuckets++;
                 nMessages += tokenSet.size();
@@ -819,33 +823,14 @@ Value smsgbuckets(const Array& params, bool fHelp)
                 objM.push_back(Pair("hash", sHash));
                 objM.push_back(Pair("last changed", getTimeString(it->second.timeChanged, cbuf, sizeof(cbuf))));
 
-                boost::filesystem::path fullPath = GetDataDir() / "smsgStore" / sFile;
-
-
-                if (!boost::filesystem::exists(fullPath))
-                {
-                    // -- If there is a file for an empty bucket something is wrong.
-                    if (tokenSet.size() == 0)
-                        objM.push_back(Pair("file size", "Empty bucket."));
-                    else
-                        objM.push_back(Pair("file size, error", "File not found."));
-                } else
-                {
-                    try {
-
-                        uint64_t nFBytes = 0;
-                        nFBytes = boost::filesystem::file_size(fullPath);
-                        nBytes += nFBytes;
-                        objM.push_back(Pair("file size", bytesReadable(nFBytes)));
-                    } catch (const boost::filesystem::filesystem_error& ex)
-                    {
-                        objM.push_back(Pair("file size, error", ex.what()));
-                    };
-                };
+                // -- approximate, leveldb only counts data already flushed to table files
+                uint64_t nBBytes = dbStore.BucketSize(it->first);
+                nBytes += nBBytes;
+                objM.push_back(Pair("size", bytesReadable(nBBytes)));
 
                 result.push_back(Pair("bucket", objM));
             };
-        }; // LOCK(cs_smsg);
+        }; // LOCK2(cs_smsg, cs_smsgDB);
 
 
         std::string snBuckets = boost::lexical_cast<std::string>(nBuckets);
@@ -861,25 +846,15 @@ Value smsgbuckets(const Array& params, bool fHelp)
     if (mode == "dump")
     {
         {
-            LOCK(cs_smsg);
-            std::map<int64_t, SecMsgBucket>::iterator it;
-            it = smsgBuckets.begin();
+            LOCK2(cs_smsg, cs_smsgDB);
 
-            for (it = smsgBuckets.begin(); it != smsgBuckets.end(); ++it)
-            {
-                std::string sFile = boost::lexical_cast<std::string>(it->first) + "_01.dat";
+            SecMsgDB dbStore;
+            if (!dbStore.Open("cr+")
+                || !dbStore.EraseBuckets(std::numeric_limits<int64_t>::max()))
+                throw runtime_error("Could not remove buckets from DB.");
 
-                try {
-                    boost::filesystem::path fullPath = GetDataDir() / "smsgStore" / sFile;
-                    boost::filesystem::remove(fullPath);
-                } catch (const boost::filesystem::filesystem_error& ex)
-                {
-                    //objM.push_back(Pair("file size, error", ex.what()));
-                    printf("Error removing bucket file %s.\n", ex.what());
-                };
-            };
             smsgBuckets.clear();
-        }; // LOCK(cs_smsg);
+        }; // LOCK2(cs_smsg, cs_smsgDB);
 
         result.push_back(Pair("result", "Removed all buckets."));
 
@@ -613,16 +613,24 @@ Value getreceivedbyaddress(const Array& params, bool fHelp)
 
     // Tally
     CAmount nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    CWallet::TxDestinations::const_iterator mi = pwalletMain->mapAddressOutputs.find(address.Get());
+    if (mi != pwalletMain->mapAddressOutputs.end())
     {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
-            continue;
+        BOOST_FOREACH(const COutPoint& outpoint, mi->second)
+        {
+            // the index can outlive a transaction removed from the wallet
+            map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.find(outpoint.hash);
+            if (it == pwalletMain->mapWallet.end() || outpoint.n >= it->second.vout.size())
+                continue;
+            const CWalletTx& wtx = it->second;
+            if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
+                continue;
 
-        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            const CTxOut& txout = wtx.vout[outpoint.n];
             if (txout.scriptPubKey == scriptPubKey)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
+        }
     }
 
     return  ValueFromAmount(nAmount);
@@ -1183,28 +1191,30 @@ Value ListReceived(const Array& params, bool fByAccounts)
 
     // Tally
     map<CShardbitAddress, tallyitem> mapTally;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    BOOST_FOREACH(const PAIRTYPE(const CTxDestination, set<COutPoint>)& entry, pwalletMain->mapAddressOutputs)
     {
-        const CWalletTx& wtx = (*it).second;
-
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
-            continue;
-
-        int nDepth = wtx.GetDepthInMainChain();
-        int nBCDepth = wtx.GetDepthInMainChain(false);
-        if (nDepth < nMinDepth)
+        const CTxDestination& address = entry.first;
+        isminefilter mine = IsMine(*pwalletMain, address);
+        if(!(mine & filter))
             continue;
 
-        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        BOOST_FOREACH(const COutPoint& outpoint, entry.second)
         {
-            CTxDestination address;
-            if (!ExtractDestination(txout.scriptPubKey, address))
+            // the index can outlive a transaction removed from the wallet
+            map<uint256, CWalletTx>::const_iterator it = pwalletMain->mapWallet.find(outpoint.hash);
+            if (it == pwalletMain->mapWallet.end() || outpoint.n >= it->second.vout.size())
+                continue;
+            const CWalletTx& wtx = it->second;
+
+            if (wtx.IsCoinBase() || wtx.IsCoinStake() || !IsFinalTx(wtx))
                 continue;
 
-            isminefilter mine = IsMine(*pwalletMain, address);
-            if(!(mine & filter))
+            int nDepth = wtx.GetDepthInMainChain();
+            int nBCDepth = wtx.GetDepthInMainChain(false);
+            if (nDepth < nMinDepth)
                 continue;
 
+            const CTxOut& txout = wtx.vout[outpoint.n];
             tallyitem& item = mapTally[address];
             item.nAmount += txout.nValue;
             item.nConf = min(item.nConf, nDepth);
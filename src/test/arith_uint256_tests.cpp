@@ -0,0 +1,116 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "uint256.h"
+#include "util.h"
+
+// Differential tests of the fixed-width uint256 arithmetic used by the
+// consensus code against the CBigNum results it replaced.
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+static uint256 RandomUint256()
+{
+    // vary the magnitude so small and large operands are both covered
+    uint256 n = GetRandHash();
+    return n >> GetRandInt(256);
+}
+
+static unsigned int RandomCompact()
+{
+    unsigned int nSize = GetRandInt(36);
+    unsigned int nWord = GetRandInt(0x01000000);
+    return (nSize << 24) | nWord;
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_compact)
+{
+    for (int i = 0; i < 20000; i++)
+    {
+        unsigned int nCompact = RandomCompact();
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+
+        bool fNegative, fOverflow;
+        uint256 n;
+        n.SetCompact(nCompact, &fNegative, &fOverflow);
+
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        if (!fNegative)
+            BOOST_CHECK_EQUAL(fOverflow, bn > CBigNum(~uint256(0)));
+        if (!fNegative && !fOverflow)
+        {
+            BOOST_CHECK(n == bn.getuint256());
+            BOOST_CHECK_EQUAL(n.GetCompact(), bn.GetCompact());
+        }
+
+        uint256 m = RandomUint256();
+        BOOST_CHECK_EQUAL(m.GetCompact(), CBigNum(m).GetCompact());
+    }
+    BOOST_CHECK_EQUAL(uint256(0).GetCompact(), CBigNum(0).GetCompact());
+    BOOST_CHECK_EQUAL(uint256(~uint256(0)).GetCompact(), CBigNum(~uint256(0)).GetCompact());
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_muldiv)
+{
+    for (int i = 0; i < 20000; i++)
+    {
+        uint256 a = RandomUint256();
+        uint256 b = RandomUint256();
+        uint64_t c = GetRand(std::numeric_limits<uint64_t>::max()) >> GetRandInt(64);
+
+        CBigNum bnModulus = CBigNum(1) << 256;
+        BOOST_CHECK((a * b) == ((CBigNum(a) * CBigNum(b)) % bnModulus).getuint256());
+        BOOST_CHECK((uint256(a) *= c) == ((CBigNum(a) * CBigNum(c)) % bnModulus).getuint256());
+        if (b != 0)
+            BOOST_CHECK((a / b) == (CBigNum(a) / CBigNum(b)).getuint256());
+        if (c != 0)
+            BOOST_CHECK((uint256(a) /= c) == (CBigNum(a) / CBigNum(c)).getuint256());
+    }
+    BOOST_CHECK_THROW(uint256(1) / uint256(0), uint_error);
+
+    // mixed base_uint256, uint256 and integer operands, as in GetBlockTrust()
+    uint256 nTarget = uint256(0xffff) << 208;
+    BOOST_CHECK(uint256(6) * uint256(7) == 42);
+    BOOST_CHECK(uint256(42) / 5 == 8);
+    BOOST_CHECK(~nTarget / (nTarget + 1) == (uint256(1) << 48) / 0xffff - 1);
+    BOOST_CHECK((~nTarget / (nTarget + 1)) + 1 == (uint256(1) << 48) / 0xffff);
+    BOOST_CHECK(nTarget * 2 / 2 == nTarget);
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_blocktrust)
+{
+    // CBlockIndex::GetBlockTrust() and the stake kernel target
+    for (int i = 0; i < 20000; i++)
+    {
+        unsigned int nBits = RandomCompact();
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+
+        bool fNegative, fOverflow;
+        uint256 nTarget;
+        nTarget.SetCompact(nBits, &fNegative, &fOverflow);
+
+        if (bnTarget > 0 && !fOverflow)
+        {
+            uint256 nTrust = (~nTarget / (nTarget + 1)) + 1;
+            BOOST_CHECK(nTrust == ((CBigNum(1)<<256) / (bnTarget+1)).getuint256());
+        }
+
+        int64_t nValueIn = GetRand(std::numeric_limits<int64_t>::max()) >> GetRandInt(63);
+        uint256 hash = RandomUint256();
+        if (bnTarget >= 0)
+        {
+            uint64_t nWeight = nValueIn;
+            bool fTargetOverflow = nWeight > 0 && (fOverflow || nTarget > ~uint256(0) / nWeight);
+            uint256 nWeighted = nTarget;
+            nWeighted *= nWeight;
+
+            CBigNum bnWeighted = bnTarget * CBigNum(nValueIn);
+            BOOST_CHECK_EQUAL(!fTargetOverflow && hash > nWeighted, CBigNum(hash) > bnWeighted);
+            BOOST_CHECK(nWeighted == (bnWeighted % (CBigNum(1) << 256)).getuint256());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,100 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bloom.h"
+#include "limitedmap.h"
+#include "uint256.h"
+#include "util.h"
+
+#include <vector>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+// Test that a rolling bloom filter always remembers the most recent entries
+// and forgets old ones at roughly the configured false positive rate
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    CRollingBloomFilter rb1(100, 0.01);
+    vector<uint256> vData;
+    for (int i = 0; i < 399; i++)
+        vData.push_back(GetRandHash());
+
+    for (int i = 0; i < 100; i++)
+    {
+        rb1.insert(vData[i]);
+        BOOST_CHECK(rb1.contains(vData[i]));
+    }
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(rb1.contains(vData[i]));
+
+    // after 300 more entries the first ones are gone, bar false positives
+    for (int i = 100; i < 399; i++)
+        rb1.insert(vData[i]);
+    int nHits = 0;
+    for (int i = 0; i < 100; i++)
+        if (rb1.contains(vData[i]))
+            nHits++;
+    BOOST_CHECK(nHits < 5);
+
+    // the last 100 are always remembered
+    for (int i = 299; i < 399; i++)
+        BOOST_CHECK(rb1.contains(vData[i]));
+
+    // false positives on items never inserted
+    nHits = 0;
+    for (int i = 0; i < 1000; i++)
+        if (rb1.contains(GetRandHash()))
+            nHits++;
+    BOOST_CHECK(nHits < 40);
+
+    rb1.reset();
+    for (int i = 299; i < 399; i++)
+        BOOST_CHECK(!rb1.contains(vData[i]));
+}
+
+struct IntHasher
+{
+    size_t operator()(int n) const { return n; }
+};
+
+// Test that a limitedhashmap keeps the entries with the highest values
+BOOST_AUTO_TEST_CASE(limitedhashmap_eviction)
+{
+    limitedhashmap<int, int, IntHasher> map(10);
+    for (int i = 0; i < 100; i++)
+        map.insert(make_pair(i, i));
+    BOOST_CHECK_EQUAL(map.size(), 9U);
+    for (int i = 91; i < 100; i++)
+        BOOST_CHECK(map.count(i));
+
+    // raising a value protects it from eviction, erased keys stay gone
+    map.update(map.find(91), 1000);
+    map.erase(92);
+    for (int i = 100; i < 108; i++)
+        map.insert(make_pair(i, i));
+    BOOST_CHECK_EQUAL(map.size(), 9U);
+    BOOST_CHECK(map.count(91));
+    BOOST_CHECK_EQUAL(map.find(91)->second, 1000);
+    BOOST_CHECK(!map.count(92));
+    BOOST_CHECK(!map.count(99));
+
+    map.max_size(5);
+    BOOST_CHECK_EQUAL(map.size(), 5U);
+    BOOST_CHECK(map.count(91));
+
+    // as with limitedmap, a new entry is kept even if its value is the lowest
+    map.insert(make_pair(0, 0));
+    BOOST_CHECK_EQUAL(map.size(), 5U);
+    BOOST_CHECK(map.count(0));
+    BOOST_CHECK(!map.count(104));
+
+    // a stale heap entry for a reinserted key does not evict it
+    map.erase(0);
+    map.insert(make_pair(200, 200));
+    map.insert(make_pair(0, 0));
+    BOOST_CHECK_EQUAL(map.size(), 4U);
+    BOOST_CHECK(map.count(0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
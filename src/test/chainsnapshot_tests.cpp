@@ -0,0 +1,92 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main/main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(chainsnapshot_tests)
+
+// Build a branch of nLength blocks on top of pindexFork (or a new genesis)
+static void BuildBranch(vector<CBlockIndex*>& vBranch, vector<uint256*>& vHashes, CBlockIndex* pindexFork, int nLength, int nSalt)
+{
+    CBlockIndex* pprev = pindexFork;
+    for (int i = 0; i < nLength; i++)
+    {
+        CBlockIndex* pindex = new CBlockIndex();
+        uint256* phash = new uint256(nSalt * 1000000 + i + 1);
+        pindex->phashBlock = phash;
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+        vBranch.push_back(pindex);
+        vHashes.push_back(phash);
+        pprev = pindex;
+    }
+}
+
+static void CheckChain(const CChainSnapshot& chain, CBlockIndex* pindexTip)
+{
+    BOOST_CHECK_EQUAL(chain.nHeight, pindexTip->nHeight);
+    BOOST_CHECK(chain.pindexBest == pindexTip);
+    BOOST_CHECK(chain.hashBestChain == pindexTip->GetBlockHash());
+    BOOST_CHECK(chain[pindexTip->nHeight + 1] == NULL);
+    BOOST_CHECK(chain[-1] == NULL);
+
+    for (CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev)
+    {
+        BOOST_CHECK(chain[pindex->nHeight] == pindex);
+        BOOST_CHECK(chain.Contains(pindex));
+        if (pindex->pprev)
+            BOOST_CHECK(chain.Next(pindex->pprev) == pindex);
+    }
+    BOOST_CHECK(chain.Next(pindexTip) == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(chainsnapshot_extend_and_reorg)
+{
+    LOCK(cs_main);
+
+    vector<CBlockIndex*> vMain, vSide;
+    vector<uint256*> vHashes;
+
+    // span a few chunks so shared and copied chunks are both exercised
+    int nLength = 2 * CChainSnapshot::CHUNK_SIZE + 10;
+    BuildBranch(vMain, vHashes, NULL, nLength, 0);
+
+    // connect one block at a time for the first part, then jump to the tip
+    for (int i = 0; i < 20; i++)
+    {
+        UpdateChainSnapshot(vMain[i]);
+        CheckChain(*GetChainSnapshot(), vMain[i]);
+    }
+    CChainSnapshotRef pold = GetChainSnapshot();
+    UpdateChainSnapshot(vMain.back());
+    CheckChain(*GetChainSnapshot(), vMain.back());
+
+    // snapshots taken earlier are not affected by later updates
+    CheckChain(*pold, vMain[19]);
+
+    // reorganize to a longer side branch forking right before a chunk boundary
+    CBlockIndex* pindexFork = vMain[CChainSnapshot::CHUNK_SIZE - 2];
+    BuildBranch(vSide, vHashes, pindexFork, nLength, 1);
+    UpdateChainSnapshot(vSide.back());
+    CChainSnapshotRef chain = GetChainSnapshot();
+    CheckChain(*chain, vSide.back());
+    BOOST_CHECK(chain->Contains(pindexFork));
+    BOOST_CHECK(!chain->Contains(vMain[CChainSnapshot::CHUNK_SIZE - 1]));
+    BOOST_CHECK(!chain->Contains(vMain.back()));
+
+    // and back to the shorter original chain
+    UpdateChainSnapshot(vMain.back());
+    CheckChain(*GetChainSnapshot(), vMain.back());
+    BOOST_CHECK(!GetChainSnapshot()->Contains(vSide.front()));
+
+    UpdateChainSnapshot(vMain.front());
+    BOOST_FOREACH(CBlockIndex* pindex, vMain)
+        delete pindex;
+    BOOST_FOREACH(CBlockIndex* pindex, vSide)
+        delete pindex;
+    BOOST_FOREACH(uint256* phash, vHashes)
+        delete phash;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
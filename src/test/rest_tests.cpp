@@ -0,0 +1,179 @@
+#include <boost/test/unit_test.hpp>
+
+#include "rpc/rpcserver.h"
+#include "chainparams/chainparams.h"
+#include "main/main.h"
+#include "util.h"
+
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(rest_tests)
+
+// Answer one GET and return its status, the reply body in strBody
+static int RESTRequest(const string& strURI, string& strBody)
+{
+    stringstream ss;
+    HTTPReq_REST(ss, "GET", strURI, false, false);
+    int nProto = 0;
+    int nStatus = ReadHTTPStatus(ss, nProto);
+    map<string, string> mapHeaders;
+    strBody.clear();
+    ReadHTTPMessage(ss, mapHeaders, strBody, nProto, MAX_SIZE);
+    return nStatus;
+}
+
+static int RESTRequest(const string& strURI)
+{
+    string strBody;
+    return RESTRequest(strURI, strBody);
+}
+
+// not the hash of any block the test knows about
+static const string strUnknownHash = "00000000000000000000000000000000000000000000000000000000deadbeef";
+
+BOOST_AUTO_TEST_CASE(rest_parse_data_format)
+{
+    vector<string> params;
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc.bin"), RF_BINARY);
+    BOOST_CHECK_EQUAL(params[0], "abc");
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc.hex"), RF_HEX);
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "10/abc.json"), RF_JSON);
+    BOOST_CHECK_EQUAL(params[0], "10/abc");
+
+    // the path is still split off when the format isn't recognized
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc"), RF_UNDEF);
+    BOOST_CHECK_EQUAL(params[0], "abc");
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc.xml"), RF_UNDEF);
+    BOOST_CHECK_EQUAL(params[0], "abc");
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc."), RF_UNDEF);
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc.JSON"), RF_UNDEF);
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, "abc.json.hex"), RF_UNDEF);
+    BOOST_CHECK_EQUAL(ParseDataFormat(params, ""), RF_UNDEF);
+    BOOST_CHECK_EQUAL(params.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(rest_headers_count_bounds)
+{
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/0/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/-1/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/2001/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/99999999999999999999/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/abc/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    // the count is required
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/1/2/" + strUnknownHash + ".json"), HTTP_BAD_REQUEST);
+
+    // in range, a block off the main chain has no headers to list
+    string strBody;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/1/" + strUnknownHash + ".json", strBody), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, "[]\n");
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/2000/" + strUnknownHash + ".bin", strBody), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, "");
+}
+
+BOOST_AUTO_TEST_CASE(rest_bad_hash)
+{
+    // too short, too long, not hex
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/1234.json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + strUnknownHash + "00.json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + string(64, 'z') + ".bin"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/.json"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/tx/" + string(63, '0') + "g.hex"), HTTP_BAD_REQUEST);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/5/" + strUnknownHash.substr(1) + ".json"), HTTP_BAD_REQUEST);
+
+    // well formed but unknown
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/block/" + strUnknownHash + ".json"), HTTP_NOT_FOUND);
+}
+
+BOOST_AUTO_TEST_CASE(rest_unknown_format)
+{
+    string strBody;
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/chaininfo.xml", strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK(strBody.find("output format not found") != string::npos);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/chaininfo.bin"), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/chaininfo"), HTTP_NOT_FOUND);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/1/" + strUnknownHash + ".xml", strBody), HTTP_NOT_FOUND);
+    BOOST_CHECK(strBody.find(".bin, .hex, .json") != string::npos);
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/headers/1/" + strUnknownHash, strBody), HTTP_NOT_FOUND);
+
+    // unknown request and method
+    BOOST_CHECK_EQUAL(RESTRequest("/rest/nothing/" + strUnknownHash + ".json"), HTTP_NOT_FOUND);
+    stringstream ss;
+    BOOST_CHECK(!HTTPReq_REST(ss, "POST", "/rest/chaininfo.json", true, false));
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_BAD_REQUEST);
+}
+
+BOOST_AUTO_TEST_CASE(rest_raw_block_roundtrip)
+{
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test_shardbit_rest_%%%%-%%%%");
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    // WriteRawBlock reads the size stored in front of the block, write two
+    // blocks so the second doesn't start at the beginning of the file. The
+    // second is shaped as proof-of-stake, ReadFromDisk checks the proof of
+    // work of any other block.
+    CBlock genesis = Params().GenesisBlock();
+    CBlock block = genesis;
+    block.hashPrevBlock = genesis.GetHash();
+    block.nTime++;
+    CTransaction txCoinStake;
+    txCoinStake.nTime = block.nTime;
+    txCoinStake.vin.push_back(CTxIn(COutPoint(genesis.vtx[0].GetHash(), 0)));
+    txCoinStake.vout.resize(2);
+    txCoinStake.vout[0].SetEmpty();
+    txCoinStake.vout[1].nValue = 1000;
+    txCoinStake.vout[1].scriptPubKey = genesis.vtx[0].vout[0].scriptPubKey;
+    block.vtx.push_back(txCoinStake);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.vchBlockSig.assign(72, 0x30);
+    BOOST_REQUIRE(block.IsProofOfStake());
+
+    unsigned int nFile = 0, nBlockPos = 0;
+    BOOST_REQUIRE(genesis.WriteToDisk(nFile, nBlockPos));
+    BOOST_REQUIRE(block.WriteToDisk(nFile, nBlockPos));
+
+    CBlock blockDisk;
+    BOOST_REQUIRE(blockDisk.ReadFromDisk(nFile, nBlockPos));
+    BOOST_CHECK(blockDisk.GetHash() == block.GetHash());
+
+    stringstream ss;
+    WriteRawBlock(ss, nFile, nBlockPos, RF_BINARY, true);
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    map<string, string> mapHeaders;
+    string strBody;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strBody, nProto, MAX_SIZE), HTTP_OK);
+    BOOST_CHECK_EQUAL(mapHeaders["connection"], "keep-alive");
+
+    CDataStream ssDisk(SER_NETWORK, PROTOCOL_VERSION);
+    ssDisk << blockDisk;
+    BOOST_CHECK_EQUAL(strBody.size(), ssDisk.size());
+    BOOST_CHECK(strBody == ssDisk.str());
+
+    CDataStream ssBlock(strBody.data(), strBody.data() + strBody.size(), SER_NETWORK, PROTOCOL_VERSION);
+    CBlock blockRest;
+    ssBlock >> blockRest;
+    BOOST_CHECK(ssBlock.empty());
+    BOOST_CHECK(blockRest.GetHash() == blockDisk.GetHash());
+    BOOST_CHECK_EQUAL(blockRest.vtx.size(), blockDisk.vtx.size());
+    BOOST_CHECK(blockRest.hashMerkleRoot == blockDisk.hashMerkleRoot);
+
+    // the hex reply is the same bytes
+    stringstream ssHex;
+    WriteRawBlock(ssHex, nFile, nBlockPos, RF_HEX, false);
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ssHex, nProto), HTTP_OK);
+    mapHeaders.clear();
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ssHex, mapHeaders, strBody, nProto, MAX_SIZE), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, HexStr(ssDisk.begin(), ssDisk.end()) + "\n");
+
+    mapArgs.erase("-datadir");
+    boost::filesystem::remove_all(pathTemp);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,133 @@
+#include <boost/test/unit_test.hpp>
+
+#include "rpc/rpcprotocol.h"
+#include "util.h"
+
+#include <sstream>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(rpc_tests)
+
+static Value SampleValue()
+{
+    Array inner;
+    inner.push_back(1);
+    inner.push_back("two \"quoted\"\n");
+    inner.push_back(Value::null);
+    inner.push_back(Array());
+    inner.push_back(Object());
+
+    Object nested;
+    nested.push_back(Pair("list", inner));
+    nested.push_back(Pair("amount", 1.5));
+
+    Array outer;
+    for (int i = 0; i < 2000; i++)
+    {
+        Object entry;
+        entry.push_back(Pair("n", i));
+        entry.push_back(Pair("nested", nested));
+        entry.push_back(Pair("flag", i % 2 == 0));
+        outer.push_back(entry);
+    }
+
+    Object result;
+    result.push_back(Pair("result", outer));
+    result.push_back(Pair("error", Value::null));
+    result.push_back(Pair("id", "x"));
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_stream_writer_matches_write_string)
+{
+    Value value = SampleValue();
+
+    CJSONStreamWriter writer;
+    writer.Write(value);
+    writer.Finish();
+    BOOST_CHECK_EQUAL(writer.str(), write_string(value, false) + "\n");
+
+    // the same document written piece by piece
+    const Object& obj = value.get_obj();
+    CJSONStreamWriter writer2;
+    writer2.BeginObject();
+    writer2.Key("result");
+    writer2.BeginArray();
+    BOOST_FOREACH(const Value& entry, find_value(obj, "result").get_array())
+        writer2.Write(entry);
+    writer2.EndArray();
+    writer2.Key("error");
+    writer2.Write(Value::null);
+    writer2.Key("id");
+    writer2.Write("x");
+    writer2.EndObject();
+    writer2.Finish();
+    BOOST_CHECK_EQUAL(writer2.str(), writer.str());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_chunked_reply_roundtrip)
+{
+    Value value = SampleValue();
+    string strExpected = write_string(value, false) + "\n";
+
+    // larger than RPC_STREAM_CHUNK_SIZE, HTTP/1.1
+    stringstream ss;
+    {
+        CHTTPReplyWriter writer(ss, true, true);
+        writer.Write(value);
+        writer.Finish();
+        BOOST_CHECK(writer.Started());
+    }
+
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    map<string, string> mapHeaders;
+    string strBody;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strBody, nProto, MAX_SIZE), HTTP_OK);
+    BOOST_CHECK_EQUAL(mapHeaders["transfer-encoding"], "chunked");
+    BOOST_CHECK_EQUAL(strBody, strExpected);
+
+    // without chunking the reply goes out in one piece with a length
+    stringstream ss2;
+    CHTTPReplyWriter writer2(ss2, false, false);
+    writer2.Write(value);
+    writer2.Finish();
+    BOOST_CHECK(!writer2.Started());
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss2, nProto), HTTP_OK);
+    mapHeaders.clear();
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss2, mapHeaders, strBody, nProto, MAX_SIZE), HTTP_OK);
+    BOOST_CHECK_EQUAL(mapHeaders.count("transfer-encoding"), 0U);
+    BOOST_CHECK_EQUAL(strBody, strExpected);
+}
+
+static int ReadChunked(const string& strBody, string& strRet)
+{
+    stringstream ss("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" + strBody);
+    int nProto = 0;
+    ReadHTTPStatus(ss, nProto);
+    map<string, string> mapHeaders;
+    return ReadHTTPMessage(ss, mapHeaders, strRet, nProto, MAX_SIZE);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_chunked_body_malformed)
+{
+    string strBody;
+    BOOST_CHECK_EQUAL(ReadChunked("5;ext=1\r\nhello\r\n3\r\nabc\r\n0\r\n\r\n", strBody), HTTP_OK);
+    BOOST_CHECK_EQUAL(strBody, "helloabc");
+
+    // a size line without hex digits is not the last chunk
+    BOOST_CHECK(ReadChunked("5\r\nhello\r\nzz\r\nabc\r\n0\r\n\r\n", strBody) != HTTP_OK);
+    BOOST_CHECK(ReadChunked("5\r\nhello\r\n\r\n", strBody) != HTTP_OK);
+    BOOST_CHECK(ReadChunked("-1\r\nhello\r\n0\r\n\r\n", strBody) != HTTP_OK);
+    BOOST_CHECK(ReadChunked("5x\r\nhello\r\n0\r\n\r\n", strBody) != HTTP_OK);
+    // the chunk data must be followed by CRLF
+    BOOST_CHECK(ReadChunked("3\r\nhello\r\n0\r\n\r\n", strBody) != HTTP_OK);
+    // truncated stream
+    BOOST_CHECK(ReadChunked("5\r\nhel", strBody) != HTTP_OK);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
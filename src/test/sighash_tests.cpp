@@ -0,0 +1,75 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main/main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+static CScript RandomScript()
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int ops = GetRandInt(10);
+    for (int i = 0; i < ops; i++)
+        script << oplist[GetRandInt(sizeof(oplist)/sizeof(oplist[0]))];
+    return script;
+}
+
+static void RandomTransaction(CTransaction& tx, int nInputs, int nOutputs)
+{
+    tx.nVersion = GetRandInt(3);
+    tx.nTime = GetRandInt(2000000000);
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = GetRandInt(2) ? GetRandInt(1000000) : 0;
+    for (int in = 0; in < nInputs; in++)
+    {
+        tx.vin.push_back(CTxIn());
+        CTxIn& txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = GetRandInt(4);
+        txin.scriptSig = RandomScript();
+        txin.nSequence = GetRandInt(2) ? GetRandInt(1000000) : (unsigned int)-1;
+    }
+    for (int out = 0; out < nOutputs; out++)
+    {
+        tx.vout.push_back(CTxOut());
+        CTxOut& txout = tx.vout.back();
+        txout.nValue = GetRandInt(100000000);
+        txout.scriptPubKey = RandomScript();
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_hasher_matches_legacy)
+{
+    static const int hashtypes[] = {
+        SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 0, 4, 0x21,
+        SIGHASH_ALL|SIGHASH_ANYONECANPAY, SIGHASH_NONE|SIGHASH_ANYONECANPAY, SIGHASH_SINGLE|SIGHASH_ANYONECANPAY
+    };
+
+    for (int i = 0; i < 200; i++)
+    {
+        CTransaction tx;
+        RandomTransaction(tx, 1 + GetRandInt(20), GetRandInt(6));
+        CSignatureHasher hasher(tx);
+
+        for (unsigned int nIn = 0; nIn <= tx.vin.size(); nIn++)
+        {
+            CScript scriptCode = RandomScript();
+            BOOST_FOREACH(int nHashType, hashtypes)
+                BOOST_CHECK(hasher.SignatureHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, tx, nIn, nHashType));
+        }
+
+        // signing rewrites scriptSigs, which the hasher must not depend on
+        BOOST_FOREACH(CTxIn& txin, tx.vin)
+            txin.scriptSig = RandomScript();
+        CScript scriptCode = RandomScript();
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++)
+            BOOST_CHECK(hasher.SignatureHash(scriptCode, nIn, SIGHASH_ALL) == SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
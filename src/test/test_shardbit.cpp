@@ -0,0 +1,12 @@
+#define BOOST_TEST_MODULE Shardbit Test Suite
+#include <boost/test/unit_test.hpp>
+
+#include "util.h"
+
+struct TestingSetup {
+    TestingSetup() {
+        fPrintToDebugLog = false; // don't want to write to debug.log file
+    }
+};
+
+BOOST_GLOBAL_FIXTURE(TestingSetup);
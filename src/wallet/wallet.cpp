@@ -463,6 +463,76 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::AddToAddressIndex(const CWalletTx& wtx)
+{
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        CTxDestination address;
+        if (ExtractDestination(wtx.vout[i].scriptPubKey, address))
+            mapAddressOutputs[address].insert(COutPoint(hash, i));
+    }
+}
+
+void CWallet::RemoveFromAddressIndex(const CWalletTx& wtx)
+{
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        CTxDestination address;
+        if (!ExtractDestination(wtx.vout[i].scriptPubKey, address))
+            continue;
+        TxDestinations::iterator mi = mapAddressOutputs.find(address);
+        if (mi == mapAddressOutputs.end())
+            continue;
+        mi->second.erase(COutPoint(hash, i));
+        if (mi->second.empty())
+            mapAddressOutputs.erase(mi);
+    }
+}
+
+// While unlocked for staking only, cache just the keys that own wallet
+// outputs and can therefore sign a kernel; any other key is decrypted
+// for the single use and not kept.
+bool CWallet::CanCacheKey(const CKeyID &address) const
+{
+    if (!fWalletUnlockStakingOnly)
+        return true;
+
+    LOCK(cs_wallet);
+    return mapAddressOutputs.count(CTxDestination(address)) > 0;
+}
+
+void CWallet::BuildSpendIndex()
+{
+    AssertLockHeld(cs_wallet);
+
+    // Sort first so the multimap is filled with hinted, constant time inserts
+    std::vector<std::pair<COutPoint, uint256> > vSpends;
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+    {
+        const CWalletTx& wtx = item.second;
+        if (wtx.IsCoinBase()) // Coinbases don't spend anything!
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            vSpends.push_back(make_pair(txin.prevout, item.first));
+    }
+    std::sort(vSpends.begin(), vSpends.end());
+
+    mapTxSpends.clear();
+    for (unsigned int i = 0; i < vSpends.size(); i++)
+        mapTxSpends.insert(mapTxSpends.end(), vSpends[i]);
+
+    // conflicting spends get the metadata of the oldest, as AddToSpends() does
+    TxSpends::iterator it = mapTxSpends.begin();
+    while (it != mapTxSpends.end())
+    {
+        pair<TxSpends::iterator, TxSpends::iterator> range = mapTxSpends.equal_range(it->first);
+        if (std::distance(range.first, range.second) > 1)
+            SyncMetaData(range);
+        it = range.second;
+    }
+}
 
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
@@ -603,8 +673,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         mapWallet[hash] = wtxIn;
         CWalletTx& wtx = mapWallet[hash];
         wtx.BindWallet(this);
+        wtx.CacheHash();
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
-        AddToSpends(hash);
+        AddToAddressIndex(wtx);
+        // mapTxSpends is rebuilt by BuildSpendIndex() once everything is loaded
     }
     else
     {
@@ -613,12 +685,14 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
+        wtx.CacheHash();
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
             wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
+            AddToAddressIndex(wtx);
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -700,6 +774,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        // Rounds of this transaction and its descendants, recomputed bottom-up
+        // from the already known inputs
+        if (fInsertedNew || fUpdated)
+        {
+            InvalidateDarksendRounds(hash);
+            for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                if (IsMine(wtx.vout[i]) && IsDenominatedAmount(wtx.vout[i].nValue))
+                    GetRealInputDarksendRounds(CTxIn(hash, i), 0);
+        }
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -764,6 +848,8 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool
 
     if (!fConnect)
     {
+        InvalidateDarksendRounds(tx.GetHash());
+
         // wallets need to refund inputs when disconnecting coinstake
         if (tx.IsCoinStake())
         {
@@ -782,8 +868,14 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        InvalidateDarksendRounds(hash);
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            RemoveFromAddressIndex(mi->second);
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -822,8 +914,6 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 // Recursively determine the rounds of a given input (How deep is the Darksend chain for a given input)
 int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
 {
-    static std::map<uint256, CTransaction> mDenomWtxes;
-
     if(rounds >= 16) return 15; // 16 rounds max
 
     uint256 hash = in.prevout.hash;
@@ -832,19 +922,10 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
     const CWalletTx* wtx = GetWalletTx(hash);
     if(wtx != NULL)
     {
-        std::map<uint256, CTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        // not known yet, let's add it
-        if(mdwi == mDenomWtxes.end())
-        {
-            LogPrint("darksend", "GetInputDarksendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CTransaction(*wtx);
-        }
-        // found and it's not an initial value, just return it
-        else if(mDenomWtxes[hash].vout[nout].nRounds != -10)
-        {
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
+        // already computed, just return it
+        std::map<COutPoint, int>::const_iterator mi = mapOutpointRounds.find(in.prevout);
+        if(mi != mapOutpointRounds.end())
+            return (*mi).second;
 
         // bounds check
         if(nout >= wtx->vout.size())
@@ -854,60 +935,85 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
             return -4;
         }
 
-        if(pwalletMain->IsCollateralAmount(wtx->vout[nout].nValue))
+        int nRounds;
+        if(IsCollateralAmount(wtx->vout[nout].nValue))
         {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+            nRounds = -3;
         }
-
         //make sure the final output is non-denominate
-        if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
+        else if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
         {
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+            nRounds = -2;
         }
-
-        bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx->vout)
-        {
-            fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
-        }
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if(!fAllDenoms)
+        else
         {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+            bool fAllDenoms = true;
+            BOOST_FOREACH(const CTxOut& out, wtx->vout)
+            {
+                fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
+            }
 
-        int nShortest = -10; // an initial value, should be no way to get this by calculations
-        bool fDenomFound = false;
-        // only denoms here so let's look up
-        BOOST_FOREACH(CTxIn in2, wtx->vin)
-        {
-            if(IsMine(in2))
+            // this one is denominated but there is another non-denominated output found in the same tx
+            if(!fAllDenoms)
+            {
+                nRounds = 0;
+            }
+            else
             {
-                int n = GetRealInputDarksendRounds(in2, rounds+1);
-                // denom found, find the shortest chain or initially assign nShortest with the first found value
-                if(n >= 0 && (n < nShortest || nShortest == -10))
+                int nShortest = -10; // an initial value, should be no way to get this by calculations
+                bool fDenomFound = false;
+                // only denoms here so let's look up
+                BOOST_FOREACH(const CTxIn& in2, wtx->vin)
                 {
-                    nShortest = n;
-                    fDenomFound = true;
+                    if(IsMine(in2))
+                    {
+                        int n = GetRealInputDarksendRounds(in2, rounds+1);
+                        // denom found, find the shortest chain or initially assign nShortest with the first found value
+                        if(n >= 0 && (n < nShortest || nShortest == -10))
+                        {
+                            nShortest = n;
+                            fDenomFound = true;
+                        }
+                    }
                 }
+                nRounds = fDenomFound
+                        ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
+                        : 0;            // too bad, we are the fist one in that chain
             }
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
-                ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
-                : 0;            // too bad, we are the fist one in that chain
-        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+
+        mapOutpointRounds[in.prevout] = nRounds;
+        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, nRounds);
+        return nRounds;
     }
 
     return rounds-1;
 }
 
+void CWallet::InvalidateDarksendRounds(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+
+    // walk the spending chain, the rounds of every descendant may depend on this transaction
+    std::vector<uint256> vToDo(1, hash);
+    std::set<uint256> setDone;
+    while(!vToDo.empty())
+    {
+        uint256 hashTx = vToDo.back();
+        vToDo.pop_back();
+        if(!setDone.insert(hashTx).second)
+            continue;
+
+        std::map<COutPoint, int>::iterator mi = mapOutpointRounds.lower_bound(COutPoint(hashTx, 0));
+        while(mi != mapOutpointRounds.end() && (*mi).first.hash == hashTx)
+            mapOutpointRounds.erase(mi++);
+
+        TxSpends::const_iterator it = mapTxSpends.lower_bound(COutPoint(hashTx, 0));
+        for(; it != mapTxSpends.end() && (*it).first.hash == hashTx; ++it)
+            vToDo.push_back((*it).second);
+    }
+}
+
 // respect current settings
 int CWallet::GetInputDarksendRounds(CTxIn in) const {
     LOCK(cs_wallet);
@@ -1174,6 +1280,10 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK2(cs_main, cs_wallet);
+
+        // a rescan usually follows a key import, which can change which inputs count towards rounds
+        mapOutpointRounds.clear();
+
         while (pindex)
         {
             // no need to read and scan block, if block was created before
@@ -1276,7 +1386,10 @@ void CWalletTx::RelayWalletTransaction(CTxDB& txdb, std::string strCommand)
             uint256 hash = GetHash();
             if(strCommand == "txlreq"){
                 LogPrintf("Relaying txlreq %s\n", hash.ToString());
-                mapTxLockReq.insert(make_pair(hash, ((CTransaction)*this)));
+                {
+                    LOCK(cs_instantx);
+                    mapTxLockReq.insert(make_pair(hash, ((CTransaction)*this)));
+                }
                 CreateNewLock(((CTransaction)*this));
                 RelayTransactionLockReq((CTransaction)*this, true);
             } else {
@@ -2548,8 +2661,9 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64_t> >& vecSend,
 
                 // Sign
                 int nIn = 0;
+                CSignatureHasher hasher(wtxNew);
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
+                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++, SIGHASH_ALL, &hasher))
                     {
                         strFailReason = _(" Signing transaction failed");
                         return false;
@@ -3627,9 +3741,10 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
 
     // Sign
     int nIn = 0;
+    CSignatureHasher hasher(txNew);
     BOOST_FOREACH(const CWalletTx* pcoin, vwtxPrev)
     {
-        if (!SignSignature(*this, *pcoin, txNew, nIn++))
+        if (!SignSignature(*this, *pcoin, txNew, nIn++, SIGHASH_ALL, &hasher))
             return error("CreateCoinStake : failed to sign coinstake");
     }
 
@@ -4169,9 +4284,9 @@ std::map<CTxDestination, int64_t> CWallet::GetAddressBalances()
 
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& walletEntry, mapWallet)
         {
-            CWalletTx *pcoin = &walletEntry.second;
+            const CWalletTx *pcoin = &walletEntry.second;
 
             if (!IsFinalTx(*pcoin) || !pcoin->IsTrusted())
                 continue;
@@ -4209,15 +4324,15 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
     set< set<CTxDestination> > groupings;
     set<CTxDestination> grouping;
 
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+    BOOST_FOREACH(const PAIRTYPE(const uint256, CWalletTx)& walletEntry, mapWallet)
     {
-        CWalletTx *pcoin = &walletEntry.second;
+        const CWalletTx *pcoin = &walletEntry.second;
 
         if (pcoin->vin.size() > 0 && IsMine(pcoin->vin[0]))
         {
             bool any_mine = false;
             // group all input addresses with each other
-            BOOST_FOREACH(CTxIn txin, pcoin->vin)
+            BOOST_FOREACH(const CTxIn& txin, pcoin->vin)
             {
                 CTxDestination address;
                 if(!IsMine(txin)) /* If this input isn't mine, ignore it */
@@ -4231,11 +4346,10 @@ set< set<CTxDestination> > CWallet::GetAddressGroupings()
             // group change with input addresses
             if (any_mine)
             {
-                BOOST_FOREACH(CTxOut txout, pcoin->vout)
+                BOOST_FOREACH(const CTxOut& txout, pcoin->vout)
                 {
                     if (IsChange(txout))
                     {
-                        CWalletTx tx = mapWallet[pcoin->vin[0].prevout.hash];
                         CTxDestination txoutAddr;
                         if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
                             continue;
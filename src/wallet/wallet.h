@@ -112,6 +112,17 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    void AddToAddressIndex(const CWalletTx& wtx);
+    void RemoveFromAddressIndex(const CWalletTx& wtx);
+
+    bool CanCacheKey(const CKeyID &address) const;
+
+    // Darksend rounds of wallet outputs, memoized by GetRealInputDarksendRounds.
+    // A transaction's entries and those of everything spending from it are
+    // dropped when it is added, updated, disconnected or erased.
+    mutable std::map<COutPoint, int> mapOutpointRounds;
+    void InvalidateDarksendRounds(const uint256& hash);
+
 public:
     /// Main wallet lock.
     /// This lock protects all the fields added by CWallet
@@ -178,6 +189,13 @@ public:
     std::map<uint256, CWalletTx> mapWallet;
     std::list<CAccountingEntry> laccentries;
 
+    // Outputs of the transactions in mapWallet by destination, so received-by
+    // queries need not walk the whole wallet. Outputs never change, so entries
+    // only come and go with mapWallet; depth and spent state are looked up
+    // from the transaction when queried.
+    typedef std::map<CTxDestination, std::set<COutPoint> > TxDestinations;
+    TxDestinations mapAddressOutputs;
+
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
@@ -252,6 +270,8 @@ public:
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet=false);
+    // Rebuild mapTxSpends from mapWallet in one pass, after loading
+    void BuildSpendIndex();
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect = true);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
@@ -12,8 +12,11 @@
 
 #include "wallet.h"
 
+#include <deque>
+
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 using namespace boost;
@@ -355,6 +358,99 @@ public:
     }
 };
 
+// Deserialize and check a "tx" record. Only looks at the record itself, so
+// it can run on the wallet load worker threads.
+static bool ReadWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash,
+                         CWalletTx& wtx, bool& fUpgrade, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    wtx.CacheHash();
+    if (!(wtx.CheckTransaction() && (wtx.GetHash() == hash)))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgrade = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgrade = true;
+    }
+    return true;
+}
+
+// Deserialize and verify a "key" or "wkey" record, like ReadWalletTx()
+static bool ReadWalletKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue,
+                          CPubKey& vchPubKey, CKey& key, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash = 0;
+
+    if (strType == "key")
+        ssValue >> pkey;
+    else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try
+    {
+        ssValue >> hash;
+    }
+    catch(...){}
+
+    bool fSkipCheck = false;
+
+    if (hash != 0)
+    {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash)
+        {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -373,44 +469,17 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
-            CWalletTx& wtx = pwallet->mapWallet[hash];
-            ssValue >> wtx;
-            if (!(wtx.CheckTransaction() && (wtx.GetHash() == hash)))
+            CWalletTx wtx;
+            bool fUpgrade;
+            if (!ReadWalletTx(ssKey, ssValue, hash, wtx, fUpgrade, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
+            if (fUpgrade)
                 wss.vWalletUpgrade.push_back(hash);
-            }
 
             if (wtx.nOrderPos == -1)
                 wss.fAnyUnordered = true;
 
             pwallet->AddToWallet(wtx, true);
-
-            //// debug print
-            //LogPrintf("LoadWallet  %s\n", wtx.GetHash().ToString());
-            //LogPrintf(" %12d  %s  %s  %s\n",
-            //    wtx.vout[0].nValue,
-            //    DateTimeStrFormat("%x %H:%M:%S", wtx.GetBlockTime()),
-            //    wtx.hashBlock.ToString(),
-            //    wtx.mapValue["message"]);
         }
         else if (strType == "sxAddr")
         {
@@ -454,62 +523,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "key" || strType == "wkey")
         {
-            CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
-            CKey key;
-            CPrivKey pkey;
-            uint256 hash = 0;
-
             if (strType == "key")
-            {
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch(...){}
-
-            bool fSkipCheck = false;
-
-            if (hash != 0)
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            CPubKey vchPubKey;
+            CKey key;
+            if (!ReadWalletKey(strType, ssKey, ssValue, vchPubKey, key, strErr))
                 return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey))
             {
                 strErr = "Error reading wallet database: LoadKey failed";
@@ -627,6 +646,162 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+// A raw record read from the wallet cursor. "tx", "key" and "wkey" records
+// are decoded by DecodeWalletRecord() on worker threads, everything else is
+// left to ReadKeyValue() when the records are applied in cursor order.
+class CWalletRecord
+{
+public:
+    CDataStream ssKey;
+    CDataStream ssValue;
+    string strType;
+    bool fDecoded;
+    bool fOK;
+    string strErr;
+
+    // "tx"
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgrade;
+
+    // "key", "wkey"
+    CPubKey vchPubKey;
+    CKey key;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION)
+    {
+        fDecoded = false;
+        fOK = false;
+        fUpgrade = false;
+    }
+};
+
+static void DecodeWalletRecord(CWalletRecord& rec)
+{
+    try {
+        // peek at the type without consuming the key
+        CDataStream ssType(rec.ssKey);
+        ssType >> rec.strType;
+        if (rec.strType == "tx")
+        {
+            rec.ssKey >> rec.strType;
+            rec.fOK = ReadWalletTx(rec.ssKey, rec.ssValue, rec.hash, rec.wtx, rec.fUpgrade, rec.strErr);
+            rec.fDecoded = true;
+        }
+        else if (rec.strType == "key" || rec.strType == "wkey")
+        {
+            rec.ssKey >> rec.strType;
+            rec.fOK = ReadWalletKey(rec.strType, rec.ssKey, rec.ssValue, rec.vchPubKey, rec.key, rec.strErr);
+            rec.fDecoded = true;
+        }
+    } catch (...) {
+        rec.fOK = false;
+        rec.fDecoded = true;
+    }
+}
+
+// Apply a record decoded by DecodeWalletRecord(), the counterpart of the
+// "tx" and "key" branches of ReadKeyValue(). The spend index is built in
+// bulk once everything is loaded.
+static bool ApplyWalletRecord(CWallet* pwallet, CWalletRecord& rec, CWalletScanState& wss)
+{
+    if (rec.strType == "key")
+        wss.nKeys++;
+    if (!rec.fOK)
+        return false;
+
+    if (rec.strType == "tx")
+    {
+        if (rec.fUpgrade)
+            wss.vWalletUpgrade.push_back(rec.hash);
+        if (rec.wtx.nOrderPos == -1)
+            wss.fAnyUnordered = true;
+        pwallet->AddToWallet(rec.wtx, true);
+    }
+    else if (!pwallet->LoadKey(rec.key, rec.vchPubKey))
+    {
+        rec.strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    return true;
+}
+
+// Batches of records handed from the cursor reader to the decoding
+// workers. Owns the batches and the worker threads.
+class CWalletLoadQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::vector<CWalletRecord>*> queue;
+    std::vector<std::vector<CWalletRecord>*> vBatches;
+    boost::thread_group workers;
+    bool fDone;
+
+    std::vector<CWalletRecord>* Pop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.empty() && !fDone)
+            cond.wait(lock);
+        if (queue.empty())
+            return NULL;
+        std::vector<CWalletRecord>* pbatch = queue.front();
+        queue.pop_front();
+        return pbatch;
+    }
+
+    void Worker()
+    {
+        RenameThread("shardbit-walletload");
+
+        std::vector<CWalletRecord>* pbatch;
+        while ((pbatch = Pop()) != NULL)
+            BOOST_FOREACH(CWalletRecord& rec, *pbatch)
+                DecodeWalletRecord(rec);
+    }
+
+public:
+    CWalletLoadQueue(int nThreads) : fDone(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            workers.create_thread(boost::bind(&CWalletLoadQueue::Worker, this));
+    }
+
+    ~CWalletLoadQueue()
+    {
+        Wait();
+        BOOST_FOREACH(std::vector<CWalletRecord>* pbatch, vBatches)
+            delete pbatch;
+    }
+
+    void Push(std::vector<CWalletRecord>* pbatch)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            queue.push_back(pbatch);
+            vBatches.push_back(pbatch);
+        }
+        cond.notify_one();
+    }
+
+    // No more batches: wait until the workers have decoded everything
+    void Wait()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fDone = true;
+        }
+        cond.notify_all();
+        workers.join_all();
+    }
+
+    // All batches in cursor order, only valid after Wait()
+    const std::vector<std::vector<CWalletRecord>*>& Batches() const { return vBatches; }
+};
+
+static const unsigned int WALLET_LOAD_BATCH = 256;
+static const int WALLET_LOAD_MAX_THREADS = 8;
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -634,6 +809,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     bool fNoncriticalErrors = false;
     DBErrors result = DB_LOAD_OK;
 
+    int64_t nStart = GetTimeMillis();
+    int64_t nTimeRead = 0, nTimeDecoded = 0, nTimeApplied = 0, nTimeIndexed = 0;
+    unsigned int nRecords = 0;
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), WALLET_LOAD_MAX_THREADS));
+
     try {
         LOCK(pwallet->cs_wallet);
         int nMinVersion = 0;
@@ -652,41 +832,81 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Read raw records here while the workers deserialize and verify
+        // transactions and keys, then apply everything in cursor order
+        CWalletLoadQueue queue(nThreads);
+        std::vector<CWalletRecord>* pbatch = NULL;
         while (true)
         {
+            if (pbatch == NULL)
+            {
+                pbatch = new std::vector<CWalletRecord>();
+                pbatch->reserve(WALLET_LOAD_BATCH);
+            }
+
             // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            pbatch->resize(pbatch->size() + 1);
+            CWalletRecord& rec = pbatch->back();
+            int ret = ReadAtCursor(pcursor, rec.ssKey, rec.ssValue);
             if (ret == DB_NOTFOUND)
+            {
+                pbatch->pop_back();
                 break;
+            }
             else if (ret != 0)
             {
+                delete pbatch;
+                pcursor->close();
                 LogPrintf("Error reading next record from wallet database\n");
                 return DB_CORRUPT;
             }
 
+            nRecords++;
+            if (pbatch->size() == WALLET_LOAD_BATCH)
+            {
+                queue.Push(pbatch);
+                pbatch = NULL;
+            }
+        }
+        pcursor->close();
+        if (pbatch != NULL)
+            queue.Push(pbatch);
+        nTimeRead = GetTimeMillis();
+
+        queue.Wait();
+        nTimeDecoded = GetTimeMillis();
+
+        BOOST_FOREACH(std::vector<CWalletRecord>* pvRecords, queue.Batches())
+        BOOST_FOREACH(CWalletRecord& rec, *pvRecords)
+        {
             // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            bool fRead;
+            if (rec.fDecoded)
+                fRead = ApplyWalletRecord(pwallet, rec, wss);
+            else
+                fRead = ReadKeyValue(pwallet, rec.ssKey, rec.ssValue, wss, rec.strType, rec.strErr);
+            if (!fRead)
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
-                if (IsKeyType(strType))
+                if (IsKeyType(rec.strType))
                     result = DB_CORRUPT;
                 else
                 {
                     // Leave other errors alone, if we try to fix them we might make things worse.
                     fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx")
+                    if (rec.strType == "tx")
                         // Rescan if there is a bad transaction record:
                         SoftSetBoolArg("-rescan", true);
                 }
             }
-            if (!strErr.empty())
-                LogPrintf("%s\n", strErr);
+            if (!rec.strErr.empty())
+                LogPrintf("%s\n", rec.strErr);
         }
-        pcursor->close();
+        nTimeApplied = GetTimeMillis();
+
+        pwallet->BuildSpendIndex();
+        nTimeIndexed = GetTimeMillis();
     }
     catch (boost::thread_interrupted) {
         throw;
@@ -695,6 +915,11 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         result = DB_CORRUPT;
     }
 
+    if (nTimeIndexed != 0)
+        LogPrintf("LoadWallet : %u records, read %dms, decode wait %dms (%d threads), apply %dms, spend index %dms, total %dms\n",
+                  nRecords, nTimeRead - nStart, nTimeDecoded - nTimeRead, nThreads,
+                  nTimeApplied - nTimeDecoded, nTimeIndexed - nTimeApplied, nTimeIndexed - nStart);
+
     if (fNoncriticalErrors && result == DB_LOAD_OK)
         result = DB_NONCRITICAL_ERROR;
 